@@ -0,0 +1,596 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * alloc_check.c
+ * makes sure nothing between monome_open and monome_close allocates.
+ * malloc and friends are overridden here, so the library and protocol
+ * modules end up calling ours, and anything they allocate while the
+ * workload runs is counted.  exits non-zero if there's anything.
+ *
+ * the workload is every LED call and a stream of presses, through both
+ * event_next and handlers, for each protocol in each orientation, and
+ * then all of it again with tracing and capture switched on.  the
+ * protocols are series and 40h on mem:// devices, and the osc module
+ * (if it was built) over UDP on localhost, with and without delta sync.
+ *
+ * when monomeserial is built it's linked in too (everything but main),
+ * and the same goes for its steady state: LED messages coming in over
+ * UDP, compositing and flushing to a mem:// device, and presses going
+ * back out through forward_press and ms_fan_out.  there are no threads,
+ * each queue is drained by calling its consumer directly.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <monome.h>
+
+#ifdef ALLOC_CHECK_MONOMESERIAL
+#include "monomeserial.h"
+#endif
+
+#define ROUNDS 64
+
+#define OSC_PORT 18092 /* the osc module listens here, and sends to +1 */
+#define MS_PORT  18094 /* monomeserial listens here, and sends to +1 */
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static volatile int armed;
+static volatile unsigned long allocs, frees;
+static volatile size_t first_size;
+
+static void count_alloc(size_t size) {
+	if( !armed )
+		return;
+
+	if( !allocs++ )
+		first_size = size;
+}
+
+void *malloc(size_t size) {
+	count_alloc(size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	count_alloc(nmemb * size);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	count_alloc(size);
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+	if( armed && ptr )
+		frees++;
+
+	__libc_free(ptr);
+}
+
+static void arm() {
+	allocs = frees = 0;
+	armed  = 1;
+}
+
+/* prints how it went and returns non-zero if anything was allocated */
+static int disarm(const char *name, const char *variant) {
+	armed = 0;
+
+	printf("alloc_check/%s/%s %lu allocations, %lu frees\n",
+		   name, variant, allocs, frees);
+
+	if( allocs )
+		printf("alloc_check/%s/%s first allocation was %zu bytes\n",
+			   name, variant, first_size);
+
+	return allocs || frees;
+}
+
+/**
+ * OSC, by hand so building packets doesn't allocate either
+ */
+
+static uint8_t *put_string(uint8_t *p, const char *str) {
+	size_t len = strlen(str), padded = (len + 4) & ~3;
+
+	memcpy(p, str, len);
+	memset(p + len, 0, padded - len);
+
+	return p + padded;
+}
+
+/* ints are 'i', one blob at most ('b') */
+static size_t osc_build(uint8_t *buf, const char *path, const char *types,
+						const int *ints, const uint8_t *blob, size_t blob_len) {
+	char tags[32] = ",";
+	uint8_t *p;
+	uint32_t i;
+
+	strncat(tags, types, sizeof(tags) - 2);
+
+	p = put_string(buf, path);
+	p = put_string(p, tags);
+
+	for( ; *types; types++ ) {
+		i = htonl((*types == 'b') ? blob_len : *ints++);
+		memcpy(p, &i, sizeof(i));
+		p += sizeof(i);
+
+		if( *types == 'b' ) {
+			memcpy(p, blob, blob_len);
+			memset(p + blob_len, 0, ((blob_len + 3) & ~3) - blob_len);
+			p += (blob_len + 3) & ~3;
+		}
+	}
+
+	return p - buf;
+}
+
+static int udp_socket(int port) {
+	struct sockaddr_in sin;
+	int fd;
+
+	if( (fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 )
+		return -1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family      = AF_INET;
+	sin.sin_port        = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if( port && bind(fd, (struct sockaddr *) &sin, sizeof(sin)) ) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void udp_send(int fd, int port, const void *buf, size_t len) {
+	struct sockaddr_in sin;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family      = AF_INET;
+	sin.sin_port        = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	sendto(fd, buf, len, 0, (struct sockaddr *) &sin, sizeof(sin));
+}
+
+/* returns how many packets there were */
+static int udp_drain(int fd) {
+	uint8_t buf[4096];
+	int n = 0;
+
+	while( recv(fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0 )
+		n++;
+
+	return n;
+}
+
+/**
+ * the workload
+ */
+
+typedef enum {
+	SERIES,
+	FORTY_H,
+	OSC
+} kind_t;
+
+static const char *orientations[] = {"left", "bottom", "right", "top"};
+
+static int handled;
+
+/* presses to the osc module come from here, and what it sends goes to
+   the sink */
+static int osc_peer = -1, osc_sink = -1;
+static uint8_t osc_presses[64][64];
+static size_t osc_press_len;
+
+static void handle_press(const monome_event_t *e, void *data) {
+	handled++;
+}
+
+static void serial_presses(uint8_t *buf, size_t len, int series) {
+	size_t i;
+
+	/* down/up pairs, over every button */
+	for( i = 0; i < len; i += 2 ) {
+		buf[i]     = (series) ? ((i & 2) ? 0x10 : 0x00) : !(i & 2);
+		buf[i + 1] = i * 7;
+	}
+}
+
+static void send_osc_presses() {
+	int i;
+
+	for( i = 0; i < 64; i++ )
+		udp_send(osc_peer, OSC_PORT, osc_presses[i], osc_press_len);
+}
+
+static void workload(monome_t *monome, kind_t kind) {
+	uint8_t buf[256], frame[8], map[32];
+	monome_event_t e;
+	int i, x, y;
+
+	for( i = 0; i < sizeof(frame); i++ )
+		frame[i] = 0x55 << (i & 1);
+
+	for( i = 0; i < sizeof(map); i++ )
+		map[i] = i * 37;
+
+	serial_presses(buf, sizeof(buf), kind == SERIES);
+
+	monome_clear(monome, MONOME_CLEAR_ON);
+	monome_intensity(monome, 8);
+	monome_mode(monome, MONOME_MODE_NORMAL);
+
+	for( y = 0; y < 8; y++ )
+		for( x = 0; x < 8; x++ ) {
+			monome_led_on(monome, x, y);
+			monome_led_off(monome, x, y);
+		}
+
+	for( i = 0; i < 8; i++ ) {
+		monome_led_row(monome, i, 1, frame);
+		monome_led_row(monome, i, 2, frame);
+		monome_led_col(monome, i, 1, frame);
+		monome_led_col(monome, i, 2, frame);
+	}
+
+	for( i = 0; i < 4; i++ )
+		monome_led_frame(monome, i, frame);
+
+	monome_led_map(monome, 16, 16, map);
+
+	if( kind == OSC ) {
+		send_osc_presses();
+		while( monome_event_next(monome, &e) );
+
+		send_osc_presses();
+		while( monome_event_handle_next(monome) );
+
+		udp_drain(osc_sink);
+		return;
+	}
+
+	monome_mem_inject(monome, buf, sizeof(buf));
+	while( monome_event_next(monome, &e) );
+
+	monome_mem_inject(monome, buf, sizeof(buf));
+	while( monome_event_handle_next(monome) );
+
+	while( monome_mem_drain(monome, buf, sizeof(buf)) > 0 );
+}
+
+static int check(const char *name, const char *dev, kind_t kind) {
+	char port[8];
+	monome_t *monome;
+	int i, r, failed = 0;
+
+	snprintf(port, sizeof(port), "%d", OSC_PORT);
+
+	for( i = 0; i < 4; i++ ) {
+		if( !(monome = monome_open(dev, port)) ) {
+			/* the osc module only gets built if liblo's around */
+			if( kind == OSC ) {
+				printf("alloc_check/%s skipped, no osc module\n", name);
+				return 0;
+			}
+
+			printf("alloc_check/%s/%s couldn't open %s\n",
+				   name, orientations[i], dev);
+			return 1;
+		}
+
+		monome_register_handler(monome, MONOME_BUTTON_DOWN, handle_press, NULL);
+		monome_set_orientation(monome, i);
+
+		arm();
+
+		for( r = 0; r < ROUNDS; r++ )
+			workload(monome, kind);
+
+		failed |= disarm(name, orientations[i]);
+		monome_close(monome);
+	}
+
+	return failed;
+}
+
+static int osc_setup() {
+	int i, args[3];
+
+	if( (osc_peer = udp_socket(0)) < 0 ||
+		(osc_sink = udp_socket(OSC_PORT + 1)) < 0 ) {
+		printf("alloc_check: couldn't open sockets for the osc module\n");
+		return -1;
+	}
+
+	for( i = 0; i < 64; i++ ) {
+		args[0] = i & 15;
+		args[1] = i / 8;
+		args[2] = !(i & 1);
+
+		osc_press_len = osc_build(osc_presses[i], "/alloc/press", "iii",
+								  args, NULL, 0);
+	}
+
+	return 0;
+}
+
+/* plain, then with delta sync */
+static int check_osc(const char *name) {
+	char dev[64], sync_name[64];
+	int failed;
+
+	snprintf(dev, sizeof(dev), "osc.udp://127.0.0.1:%d/alloc", OSC_PORT + 1);
+	snprintf(sync_name, sizeof(sync_name), "%s_sync", name);
+
+	failed = check(name, dev, OSC);
+
+	setenv("MONOME_OSC_SYNC", "16", 1);
+	failed |= check(sync_name, dev, OSC);
+	unsetenv("MONOME_OSC_SYNC");
+
+	return failed;
+}
+
+#ifdef ALLOC_CHECK_MONOMESERIAL
+
+/**
+ * monomeserial
+ */
+
+ms_state_t state;
+
+static int ms_client = -1, ms_app = -1;
+static monome_t *ms_monome;
+
+static uint8_t ms_leds[9][128];
+static size_t ms_led_lens[9];
+static int ms_nleds;
+
+static void ms_press(const monome_event_t *e, void *data) {
+	ms_pipeline_press(data, e);
+}
+
+static void ms_add_led(const char *path, const char *types, const int *ints,
+					   const uint8_t *blob, size_t blob_len) {
+	ms_led_lens[ms_nleds] = osc_build(ms_leds[ms_nleds], path, types, ints,
+									  blob, blob_len);
+	ms_nleds++;
+}
+
+/* everything open_layer() and main() in monomeserial.c would do for one
+   device with one layer */
+static int ms_setup() {
+	int led[3] = {3, 5, 1}, row[3] = {2, 0x5A, 0xA5}, frame[9] = {0x5A, 0xA5, 0x0F, 0xF0, 0x33, 0xCC,
+										0x81, 0x18, 3};
+	int whole[4] = {0, 0, 16, 16};
+	static char prefix[] = "alloc";
+	uint8_t map[32], blank[32] = {0}, packet[128];
+	ms_device_t *dev;
+	ms_layer_t *layer;
+	lo_message msg;
+	size_t len;
+	char port[8];
+	int i;
+
+	for( i = 0; i < sizeof(map); i++ )
+		map[i] = i * 37;
+
+	snprintf(port, sizeof(port), "%d", MS_PORT);
+
+	state.transport = LO_UDP;
+
+	if( ms_event_loop_init(&state.device_loop) ||
+		ms_event_loop_init(&state.network_loop) ||
+		ms_pipeline_init() || ms_transport_open(port) ||
+		(ms_client = udp_socket(0)) < 0 ||
+		(ms_app = udp_socket(MS_PORT + 1)) < 0 ||
+		!(ms_monome = monome_open("mem://m256-002")) )
+		return -1;
+
+	dev = &state.devices[0];
+	state.ndevices = 1;
+
+	if( ms_device_output_init(dev, 115200, monome_get_proto(ms_monome)) )
+		return -1;
+
+	/* there's no fd to watch for a mem:// device, so this is as much of
+	   ms_device_attach() as applies */
+	dev->monome = ms_monome;
+	monome_register_handler(ms_monome, MONOME_BUTTON_DOWN, ms_press, dev);
+	monome_register_handler(ms_monome, MONOME_BUTTON_UP, ms_press, dev);
+
+	layer = &dev->layers[0];
+	layer->dev    = dev;
+	layer->prefix = prefix;
+	layer->mode   = MS_LAYER_APP;
+	ms_layer_set_region(layer, 0, 0, 16, 16);
+	osc_sync_init(&layer->sync, 0);
+
+	/* the press template, the way monomeserial.c builds it */
+	msg = lo_message_new();
+
+	for( i = 0; i < 3; i++ )
+		lo_message_add_int32(msg, 0);
+
+	len = sizeof(layer->press_msg);
+	lo_message_serialise(msg, "/alloc/press", layer->press_msg, &len);
+	layer->press_len = len;
+	lo_message_free(msg);
+
+	snprintf(port, sizeof(port), "%d", MS_PORT + 1);
+
+	if( ms_transport_resolve(&layer->app_dest, "127.0.0.1", port) )
+		return -1;
+
+	ms_register_osc_methods(layer);
+	dev->nlayers = 1;
+
+	/* the first one clears the grid, see ms_workload() */
+	ms_add_led("/alloc/map", "iiiib", whole, blank, sizeof(blank));
+	ms_add_led("/alloc/map", "iiiib", whole, map, sizeof(map));
+	ms_add_led("/alloc/led", "iii", led, NULL, 0);
+	ms_add_led("/alloc/led_row", "ii", row, NULL, 0);
+	ms_add_led("/alloc/led_row", "iii", row, NULL, 0);
+	ms_add_led("/alloc/led_col", "ii", row, NULL, 0);
+	ms_add_led("/alloc/led_col", "iii", row, NULL, 0);
+	ms_add_led("/alloc/frame", "iiiiiiii", frame, NULL, 0);
+	ms_add_led("/alloc/frame", "iiiiiiiii", frame, NULL, 0);
+
+	/* every one of them has to be picked up without liblo, or there's
+	   no point checking that doing so doesn't allocate */
+	for( i = 0; i < ms_nleds; i++ ) {
+		memcpy(packet, ms_leds[i], ms_led_lens[i]);
+
+		if( !ms_osc_dispatch_led(packet, ms_led_lens[i]) ) {
+			printf("alloc_check/monomeserial: LED message %d went to liblo\n", i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int ms_workload() {
+	uint8_t buf[256];
+	int i;
+
+	/* LED messages in, one per wakeup, same as the event loop would */
+	for( i = 1; i < ms_nleds; i++ ) {
+		udp_send(ms_client, MS_PORT, ms_leds[i], ms_led_lens[i]);
+		state.server_watch.cb(&state.server_watch);
+
+		/* a blank grid in between, so every one of them changes it and
+		   goes all the way through to the device thread's queue */
+		udp_send(ms_client, MS_PORT, ms_leds[0], ms_led_lens[0]);
+		state.server_watch.cb(&state.server_watch);
+	}
+
+	/* the device thread's side: composited grids out to the device */
+	state.to_device.watch.cb(&state.to_device.watch);
+	while( monome_mem_drain(ms_monome, buf, sizeof(buf)) > 0 );
+
+	/* presses in from the device, and on out to the application */
+	serial_presses(buf, sizeof(buf), 1);
+	monome_mem_inject(ms_monome, buf, sizeof(buf));
+	while( monome_event_handle_next(ms_monome) );
+
+	state.to_network.watch.cb(&state.to_network.watch);
+	return udp_drain(ms_app);
+}
+
+static int check_monomeserial(const char *variant) {
+	int r, presses = 0, failed;
+
+	arm();
+
+	for( r = 0; r < ROUNDS; r++ )
+		presses += ms_workload();
+
+	failed = disarm("monomeserial", variant);
+
+	if( !presses ) {
+		printf("alloc_check/monomeserial/%s no presses made it out\n", variant);
+		failed = 1;
+	}
+
+	return failed;
+}
+
+#endif /* ALLOC_CHECK_MONOMESERIAL */
+
+int main(int argc, char *argv[]) {
+	int failed = 0;
+
+	if( osc_setup() )
+		return EXIT_FAILURE;
+
+#ifdef ALLOC_CHECK_MONOMESERIAL
+	if( ms_setup() ) {
+		printf("alloc_check: couldn't set up monomeserial\n");
+		return EXIT_FAILURE;
+	}
+#endif
+
+	failed |= check("series", "mem://m256-000", SERIES);
+	failed |= check("40h", "mem://m40h000", FORTY_H);
+	failed |= check_osc("osc");
+
+#ifdef ALLOC_CHECK_MONOMESERIAL
+	failed |= check_monomeserial("plain");
+#endif
+
+	if( monome_trace_start(4096) || monome_capture_start("/dev/null") ) {
+		printf("alloc_check: couldn't start tracing and capture\n");
+		return EXIT_FAILURE;
+	}
+
+	failed |= check("series_traced", "mem://m256-000", SERIES);
+	failed |= check("40h_traced", "mem://m40h000", FORTY_H);
+	failed |= check_osc("osc_traced");
+
+#ifdef ALLOC_CHECK_MONOMESERIAL
+	failed |= check_monomeserial("traced");
+#endif
+
+	monome_capture_stop();
+	monome_trace_stop();
+
+	if( !handled ) {
+		printf("alloc_check: no presses made it to the handler\n");
+		failed = 1;
+	}
+
+	return (failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#else
+int main(int argc, char *argv[]) {
+	printf("alloc_check: needs glibc to interpose malloc, skipping\n");
+	return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,21 @@
+#!/bin/sh
+# lines up two sets of benchmark results (as printed by make bench) and
+# shows how each number changed:
+#
+#   make bench > before.txt
+#   ...
+#   make bench > after.txt
+#   bench/compare.sh before.txt after.txt
+
+if [ $# -ne 2 ]; then
+	echo "usage: $0 <before> <after>"
+	exit 1
+fi
+
+awk '
+	NF == 3 && $1 ~ /\// && FNR == NR { before[$1] = $2; next }
+	NF == 3 && ($1 in before) {
+		change = (before[$1] != 0) ? ($2 - before[$1]) * 100 / before[$1] : 0
+		printf "%-48s %14s %14s %+8.1f%% %s\n", $1, before[$1], $2, change, $3
+	}
+' "$1" "$2"
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * devices.c
+ * times the library itself: how long each LED call takes, how many
+ * messages and bytes a second that adds up to, how fast presses get
+ * parsed, and how long monome_open and monome_open_serial take.  every
+ * protocol in every orientation, against mem:// devices (just the
+ * library) and against the emulator on a pty (the library plus the serial
+ * syscalls).
+ *
+ * results are one per line, as "devices/<device>/<test> <value> <unit>",
+ * so two runs can be lined up with compare.sh.
+ */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <monome.h>
+
+#define MEM_CALLS  100000
+#define PTY_CALLS  5000
+#define EVENTS     1000000
+#define MEM_OPENS  1000
+#define PTY_OPENS  100
+
+#define OSC_PORT   "18090"
+
+typedef enum {
+	MEM,
+	PTY,
+	OSC
+} kind_t;
+
+typedef struct {
+	const char *name;
+	kind_t kind;
+	const char *serial;
+	char dev[64];
+	pid_t emulator;
+} target_t;
+
+static const char *orientations[] = {"left", "bottom", "right", "top"};
+
+static uint64_t *samples;
+
+static uint64_t now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_samples(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* prints the mean, median and 99th percentile of the first n samples,
+   and returns the total */
+static uint64_t report_samples(const char *prefix, const char *test, int n) {
+	uint64_t total = 0;
+	int i;
+
+	for( i = 0; i < n; i++ )
+		total += samples[i];
+
+	qsort(samples, n, sizeof(*samples), compare_samples);
+
+	printf("%s/%s_mean %.0f ns\n", prefix, test, (double) total / n);
+	printf("%s/%s_p50 %llu ns\n", prefix, test, (unsigned long long) samples[n / 2]);
+	printf("%s/%s_p99 %llu ns\n", prefix, test,
+		   (unsigned long long) samples[n - n / 100 - 1]);
+
+	return total;
+}
+
+/**
+ * the tests
+ */
+
+typedef int (*led_call_t)(monome_t *monome, int i);
+
+static int call_led_on(monome_t *monome, int i) {
+	return monome_led_on(monome, i & 0x7, (i >> 3) & 0x7);
+}
+
+static int call_led_row(monome_t *monome, int i) {
+	uint8_t data[2] = {i, i >> 8};
+	return monome_led_row(monome, i & 0x7, 2, data);
+}
+
+static int call_led_col(monome_t *monome, int i) {
+	uint8_t data[2] = {i, i >> 8};
+	return monome_led_col(monome, i & 0x7, 2, data);
+}
+
+static int call_led_frame(monome_t *monome, int i) {
+	uint8_t data[8] = {i, i >> 1, i >> 2, i >> 3, i >> 4, i >> 5, i >> 6, i >> 7};
+	return monome_led_frame(monome, i & 0x3, data);
+}
+
+static struct {
+	const char *name;
+	led_call_t call;
+	monome_cmd_t cmd;
+} led_tests[] = {
+	{"led_on",    call_led_on,    MONOME_CMD_LED_ON},
+	{"led_row",   call_led_row,   MONOME_CMD_LED_ROW},
+	{"led_col",   call_led_col,   MONOME_CMD_LED_COL},
+	{"led_frame", call_led_frame, MONOME_CMD_LED_FRAME},
+	{NULL}
+};
+
+static void bench_output(monome_t *monome, const char *prefix, int calls) {
+	monome_stats_t stats;
+	uint64_t start, total;
+	char test[64];
+	int i, t;
+
+	for( t = 0; led_tests[t].name; t++ ) {
+		monome_reset_stats(monome);
+
+		for( i = 0; i < calls; i++ ) {
+			start = now();
+			led_tests[t].call(monome, i);
+			samples[i] = now() - start;
+		}
+
+		total = report_samples(prefix, led_tests[t].name, calls);
+		monome_get_stats(monome, &stats);
+
+		snprintf(test, sizeof(test), "%s/%s", prefix, led_tests[t].name);
+		printf("%s_rate %.0f msg/s\n", test, calls / (total / 1e9));
+
+		/* the OSC module doesn't go through the serial code, so there's
+		   nothing counting its bytes */
+		if( stats.cmd[led_tests[t].cmd].bytes )
+			printf("%s_bytes %.0f B/s\n", test,
+				   stats.cmd[led_tests[t].cmd].bytes / (total / 1e9));
+	}
+}
+
+static void bench_input(monome_t *monome, const char *prefix, int series) {
+	uint8_t buf[512];
+	uint64_t start, total = 0;
+	monome_event_t e;
+	int i, n, parsed = 0;
+
+	/* down/up pairs, over every button */
+	for( i = 0; i < sizeof(buf); i += 2 ) {
+		buf[i]     = (series) ? ((i & 2) ? 0x10 : 0x00) : !(i & 2);
+		buf[i + 1] = i * 7;
+	}
+
+	for( n = 0; n < EVENTS; n += sizeof(buf) / 2 ) {
+		monome_mem_inject(monome, buf, sizeof(buf));
+
+		start = now();
+
+		while( monome_event_next(monome, &e) )
+			parsed++;
+
+		total += now() - start;
+	}
+
+	printf("%s/parse_rate %.0f events/s\n", prefix, parsed / (total / 1e9));
+	printf("%s/parse_mean %.1f ns\n", prefix, (double) total / parsed);
+}
+
+/* by serial goes through the index rather than the platform's lookup */
+static void bench_open(target_t *t, int opens, int by_serial) {
+	monome_t *monome;
+	char prefix[64];
+	int i;
+
+	for( i = 0; i < opens; i++ ) {
+		samples[i] = now();
+
+		if( by_serial )
+			monome = monome_open_serial(t->serial);
+		else
+			monome = monome_open(t->dev, OSC_PORT);
+
+		if( !monome )
+			return;
+
+		monome_close(monome);
+		samples[i] = now() - samples[i];
+	}
+
+	snprintf(prefix, sizeof(prefix), "devices/%s", t->name);
+	report_samples(prefix, (by_serial) ? "open_serial" : "open", opens);
+}
+
+static void bench_target(target_t *t) {
+	monome_t *monome;
+	char prefix[64];
+	int o;
+
+	if( !(monome = monome_open(t->dev, OSC_PORT)) ) {
+		fprintf(stderr, "devices: couldn't open %s, skipping it\n", t->dev);
+		return;
+	}
+
+	for( o = 0; o < 4; o++ ) {
+		snprintf(prefix, sizeof(prefix), "devices/%s/%s", t->name, orientations[o]);
+		monome_set_orientation(monome, o);
+
+		bench_output(monome, prefix, (t->kind == PTY) ? PTY_CALLS : MEM_CALLS);
+
+		if( t->kind == MEM )
+			bench_input(monome, prefix, strncmp(t->serial, "m40h", 4));
+	}
+
+	monome_close(monome);
+	bench_open(t, (t->kind == PTY) ? PTY_OPENS : MEM_OPENS, 0);
+
+	if( t->kind == PTY )
+		bench_open(t, PTY_OPENS, 1);
+}
+
+/**
+ * the emulator
+ */
+
+static int start_emulator(target_t *t) {
+	struct stat st;
+	int i;
+
+	snprintf(t->dev, sizeof(t->dev), "/tmp/monome-bench-%d-%s", getpid(), t->serial);
+
+	if( !(t->emulator = fork()) ) {
+		freopen("/dev/null", "w", stdout);
+		execl("./emulator", "emulator", "-b", "0", "-s", t->serial,
+			  "-L", t->dev, NULL);
+		_exit(1);
+	}
+
+	/* wait for it to make the link */
+	for( i = 0; i < 100; i++ ) {
+		if( !lstat(t->dev, &st) )
+			return 0;
+
+		usleep(10000);
+	}
+
+	return -1;
+}
+
+static void stop_emulator(target_t *t) {
+	if( t->emulator <= 0 )
+		return;
+
+	kill(t->emulator, SIGTERM);
+	waitpid(t->emulator, NULL, 0);
+}
+
+int main(int argc, char *argv[]) {
+	char serials[256];
+	int i, len = 0;
+
+	target_t targets[] = {
+		{"series",     MEM, "m256-000"},
+		{"40h",        MEM, "m40h000"},
+		{"osc",        OSC, NULL},
+		{"series_pty", PTY, "m256-001"},
+		{"40h_pty",    PTY, "m40h001"},
+		{NULL}
+	};
+
+	if( !(samples = calloc(MEM_CALLS, sizeof(*samples))) )
+		return EXIT_FAILURE;
+
+	for( i = 0; targets[i].name; i++ ) {
+		switch( targets[i].kind ) {
+		case MEM:
+			snprintf(targets[i].dev, sizeof(targets[i].dev), "mem://%s", targets[i].serial);
+			break;
+
+		case OSC:
+			snprintf(targets[i].dev, sizeof(targets[i].dev),
+					 "osc.udp://127.0.0.1:%d/bench", atoi(OSC_PORT) + 1);
+			break;
+
+		case PTY:
+			if( start_emulator(&targets[i]) ) {
+				fprintf(stderr, "devices: couldn't start the emulator\n");
+				targets[i].dev[0] = 0;
+				break;
+			}
+
+			len += snprintf(serials + len, sizeof(serials) - len, "%s%s=%s",
+							(len) ? "," : "", targets[i].dev, targets[i].serial);
+			break;
+		}
+	}
+
+	setenv("MONOME_SERIAL", serials, 1);
+
+	for( i = 0; targets[i].name; i++ )
+		if( targets[i].dev[0] )
+			bench_target(&targets[i]);
+
+	for( i = 0; targets[i].name; i++ )
+		stop_emulator(&targets[i]);
+
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * emulator.c
+ * pretends to be a monome on the end of a pseudo-terminal, so the serial
+ * code in libmonome and monomeserial can be exercised without hardware:
+ *
+ *   emulator -s m128-007 -L /tmp/m128 -r 20 -j 500 -d 0.1 &
+ *   MONOME_SERIAL=/tmp/m128=m128-007 monomeserial -d /tmp/m128
+ *
+ * the serial picks the protocol and size, the same way libmonome maps
+ * them.  MONOME_SERIAL stands in for the FTDI serial lookup, which a pty
+ * doesn't have.
+ *
+ * whatever the host sends gets decoded into an LED framebuffer (dumped on
+ * SIGUSR1 and at exit).  presses come from a script, or at random, and
+ * go back out through a model of the link: a baud rate cap in both
+ * directions, added latency and jitter on the way out, and dropped bytes
+ * both ways.  the pty has a few KB of buffer of its own, so the host
+ * only feels the baud cap once a burst has filled that up.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/select.h>
+#include <sys/types.h>
+
+#include "grid.h"
+
+#define DEFAULT_SERIAL  "m256-001"
+#define DEFAULT_BAUD    115200
+#define HOLD_USEC       50000 /* how long a random press is held down */
+#define MAX_PENDING     1024  /* presses in flight on the way out */
+#define LINK_BUFFER     64    /* bytes of backlog the link absorbs */
+
+typedef struct {
+	uint64_t due;
+	uint8_t buf[2];
+} message_t;
+
+static struct {
+	grid_t grid;
+
+	/* the link */
+	uint baud, latency, jitter;
+	double drop;
+
+	message_t pending[MAX_PENDING];
+	uint head, tail;
+
+	struct {
+		unsigned long in_bytes, in_dropped;
+		unsigned long out_bytes, out_msgs, out_dropped, overflows;
+	} counts;
+} emu;
+
+static volatile sig_atomic_t running = 1, dump_requested = 0;
+
+static uint64_t now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int dropped() {
+	return emu.drop > 0 && rand() < emu.drop * (RAND_MAX / 100.0);
+}
+
+/* 10 bits on the wire per byte, 8N1 */
+static uint64_t wire_time(size_t bytes) {
+	return (emu.baud) ? bytes * 10000000ULL / emu.baud : 0;
+}
+
+/**
+ * host -> device
+ */
+
+static void receive(const uint8_t *buf, ssize_t len) {
+	ssize_t i;
+
+	for( i = 0; i < len; i++ ) {
+		emu.counts.in_bytes++;
+
+		if( dropped() )
+			emu.counts.in_dropped++;
+		else
+			grid_receive(&emu.grid, buf[i]);
+	}
+}
+
+/**
+ * device -> host
+ */
+
+static void press(uint x, uint y, int down) {
+	message_t *m, *last;
+	uint64_t due;
+
+	if( emu.tail - emu.head >= MAX_PENDING ) {
+		emu.counts.overflows++;
+		return;
+	}
+
+	due = now() + emu.latency;
+
+	if( emu.jitter )
+		due += rand() % emu.jitter;
+
+	/* jitter can't reorder anything, it's still one wire */
+	if( emu.tail != emu.head ) {
+		last = &emu.pending[(emu.tail - 1) % MAX_PENDING];
+
+		if( due < last->due + wire_time(sizeof(last->buf)) )
+			due = last->due + wire_time(sizeof(last->buf));
+	}
+
+	m = &emu.pending[emu.tail++ % MAX_PENDING];
+	m->due = due;
+
+	grid_encode_press(&emu.grid, m->buf, x, y, down);
+}
+
+static void send_due(int fd) {
+	uint64_t t = now();
+	message_t *m;
+	uint8_t buf[2];
+	int i, len;
+
+	while( emu.head != emu.tail ) {
+		m = &emu.pending[emu.head % MAX_PENDING];
+
+		if( m->due > t )
+			break;
+
+		for( i = len = 0; i < sizeof(m->buf); i++ ) {
+			if( dropped() )
+				emu.counts.out_dropped++;
+			else
+				buf[len++] = m->buf[i];
+		}
+
+		/* if the host isn't reading, the bytes are lost, same as a real
+		   device with a full FTDI buffer */
+		if( len && write(fd, buf, len) == len )
+			emu.counts.out_bytes += len;
+
+		emu.counts.out_msgs++;
+		emu.head++;
+	}
+}
+
+/**
+ * presses
+ */
+
+typedef struct {
+	FILE *script;
+	uint64_t script_at;
+	struct {
+		uint x, y;
+		int down;
+	} line;
+
+	/* random presses */
+	uint rate;
+	uint64_t random_at, release_at;
+	uint x, y;
+} presser_t;
+
+/* script lines are "<delay ms> <x> <y> <1 for down, 0 for up>", with the
+   delay counted from the line before.  # starts a comment. */
+static void next_scripted(presser_t *p, uint64_t t) {
+	char buf[128];
+	uint delay;
+
+	if( p->script_at )
+		press(p->line.x, p->line.y, p->line.down);
+
+	while( fgets(buf, sizeof(buf), p->script) ) {
+		if( *buf == '#' || sscanf(buf, "%u %u %u %d", &delay,
+								  &p->line.x, &p->line.y, &p->line.down) != 4 )
+			continue;
+
+		p->script_at = t + delay * 1000ULL;
+		return;
+	}
+
+	fclose(p->script);
+	p->script = NULL;
+	p->script_at = 0;
+}
+
+static void next_random(presser_t *p, uint64_t t) {
+	double u = rand() / (RAND_MAX + 1.0);
+
+	if( p->release_at && p->release_at <= t ) {
+		press(p->x, p->y, 0);
+		p->release_at = 0;
+	}
+
+	if( p->random_at > t )
+		return;
+
+	/* one button at a time, so a press that comes up while the last is
+	   still held just gets skipped */
+	if( !p->release_at ) {
+		p->x = rand() % emu.grid.cols;
+		p->y = rand() % emu.grid.rows;
+		p->release_at = t + HOLD_USEC;
+
+		press(p->x, p->y, 1);
+	}
+
+	/* exponential gaps, so presses bunch up now and then */
+	p->random_at = t + (uint64_t) (-log1p(-u) * 1000000 / p->rate);
+}
+
+#define EARLIEST(a, b) ((!(a) || ((b) && (b) < (a))) ? (b) : (a))
+
+/* presses whatever's due, and returns when to come back */
+static uint64_t next_press(presser_t *p) {
+	uint64_t t = now(), wake = 0;
+
+	if( p->script && p->script_at <= t )
+		next_scripted(p, t);
+
+	if( p->rate && (p->random_at <= t || (p->release_at && p->release_at <= t)) )
+		next_random(p, t);
+
+	if( p->script )
+		wake = p->script_at;
+
+	if( p->rate ) {
+		wake = EARLIEST(wake, p->random_at);
+		wake = EARLIEST(wake, p->release_at);
+	}
+
+	return wake;
+}
+
+/**
+ * everything else
+ */
+
+static void dump_leds() {
+	int x, y;
+
+	printf("intensity %u, mode %u\n", emu.grid.intensity, emu.grid.mode);
+
+	for( y = 0; y < emu.grid.rows; y++ ) {
+		for( x = 0; x < emu.grid.cols; x++ )
+			putchar((emu.grid.leds[y] & (1 << x)) ? '#' : '.');
+
+		putchar('\n');
+	}
+}
+
+static void dump_counts() {
+	printf("in:  %lu bytes, %lu messages, %lu bytes dropped, %lu parse errors\n"
+		   "out: %lu bytes, %lu messages, %lu bytes dropped, %lu overflows\n",
+		   emu.counts.in_bytes, emu.grid.msgs, emu.counts.in_dropped,
+		   emu.grid.parse_errors, emu.counts.out_bytes, emu.counts.out_msgs,
+		   emu.counts.out_dropped, emu.counts.overflows);
+}
+
+static void on_signal(int sig) {
+	if( sig == SIGUSR1 )
+		dump_requested = 1;
+	else
+		running = 0;
+}
+
+static void usage(const char *app) {
+	printf("usage: %s [options...]\n"
+		   "\n"
+		   "  -h, --help			display this information\n"
+		   "\n"
+		   "  -s, --serial <serial>		which device to be (default %s)\n"
+		   "  -L, --link <path>		also make a symlink to the pty here\n"
+		   "\n"
+		   "  -b, --baud <rate>		link speed, 0 for unlimited "
+		       "(default %d)\n"
+		   "  -l, --latency <usec>		added to every press\n"
+		   "  -j, --jitter <usec>		up to this much more, at random\n"
+		   "  -d, --drop <percent>		chance of losing any one byte\n"
+		   "\n"
+		   "  -r, --random <per second>	press random buttons this often\n"
+		   "  -S, --script <file>		press buttons as the file says\n"
+		   "				(\"-\" for stdin)\n"
+		   "\n", app, DEFAULT_SERIAL, DEFAULT_BAUD);
+}
+
+int main(int argc, char *argv[]) {
+	const char *serial = DEFAULT_SERIAL, *link = NULL;
+	uint64_t t, wake, credit_at, earned;
+	struct timeval tv, *timeout;
+	char *slave_name;
+	presser_t presser;
+	uint8_t buf[256];
+	ssize_t len;
+	int fd, slave, c;
+	size_t credit;
+	fd_set rfds;
+
+	struct option arguments[] = {
+		{"help",    no_argument,       0, 'h'},
+		{"serial",  required_argument, 0, 's'},
+		{"link",    required_argument, 0, 'L'},
+		{"baud",    required_argument, 0, 'b'},
+		{"latency", required_argument, 0, 'l'},
+		{"jitter",  required_argument, 0, 'j'},
+		{"drop",    required_argument, 0, 'd'},
+		{"random",  required_argument, 0, 'r'},
+		{"script",  required_argument, 0, 'S'},
+		{0, 0, 0, 0}
+	};
+
+	memset(&presser, 0, sizeof(presser));
+	emu.baud = DEFAULT_BAUD;
+
+	while( (c = getopt_long(argc, argv, "hs:L:b:l:j:d:r:S:", arguments, NULL)) > 0 ) {
+		switch( c ) {
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+
+		case 's':
+			serial = optarg;
+			break;
+
+		case 'L':
+			link = optarg;
+			break;
+
+		case 'b':
+			emu.baud = atoi(optarg);
+			break;
+
+		case 'l':
+			emu.latency = atoi(optarg);
+			break;
+
+		case 'j':
+			emu.jitter = atoi(optarg);
+			break;
+
+		case 'd':
+			emu.drop = atof(optarg);
+			break;
+
+		case 'r':
+			presser.rate = atoi(optarg);
+			break;
+
+		case 'S':
+			if( !(presser.script = (strcmp(optarg, "-")) ? fopen(optarg, "r") : stdin) ) {
+				perror("emulator: couldn't open script");
+				return EXIT_FAILURE;
+			}
+
+			break;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if( grid_init(&emu.grid, serial) ) {
+		fprintf(stderr, "emulator: don't know what kind of device \"%s\" is\n", serial);
+		return EXIT_FAILURE;
+	}
+
+	if( (fd = grid_open_pty(&slave_name, &slave)) < 0 ) {
+		perror("emulator: couldn't open a pty");
+		return EXIT_FAILURE;
+	}
+
+	if( link ) {
+		unlink(link);
+
+		if( symlink(slave_name, link) ) {
+			perror("emulator: couldn't make the link");
+			return EXIT_FAILURE;
+		}
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGUSR1, on_signal);
+
+	srand(time(NULL));
+
+	printf("%s (%s, %dx%d) on %s\n"
+		   "export MONOME_SERIAL=%s=%s\n",
+		   serial, (emu.grid.proto == GRID_SERIES) ? "series" : "40h", emu.grid.cols, emu.grid.rows,
+		   slave_name, (link) ? link : slave_name, serial);
+	fflush(stdout);
+
+	credit = LINK_BUFFER;
+	credit_at = now();
+
+	while( running ) {
+		if( dump_requested ) {
+			dump_leds();
+			dump_counts();
+			fflush(stdout);
+			dump_requested = 0;
+		}
+
+		t = now();
+
+		/* the link only carries so many bytes a second from the host.
+		   whatever it can't take backs up in the pty, and eventually
+		   the host's writes start blocking, like on a real device. */
+		if( emu.baud ) {
+			earned = (t - credit_at) * emu.baud / 10000000;
+			credit_at += wire_time(earned);
+			credit    += earned;
+
+			if( credit >= LINK_BUFFER ) {
+				credit    = LINK_BUFFER;
+				credit_at = t;
+			}
+		} else
+			credit = sizeof(buf);
+
+		send_due(fd);
+		wake = next_press(&presser);
+
+		if( emu.head != emu.tail )
+			wake = EARLIEST(wake, emu.pending[emu.head % MAX_PENDING].due);
+
+		if( !credit )
+			wake = EARLIEST(wake, credit_at + wire_time(1));
+
+		FD_ZERO(&rfds);
+
+		if( credit )
+			FD_SET(fd, &rfds);
+
+		timeout = NULL;
+		t = now();
+
+		if( wake ) {
+			wake = (wake > t) ? wake - t : 0;
+			tv.tv_sec  = wake / 1000000;
+			tv.tv_usec = wake % 1000000;
+			timeout = &tv;
+		}
+
+		if( select(fd + 1, &rfds, NULL, NULL, timeout) < 0 ) {
+			if( errno == EINTR )
+				continue;
+
+			perror("emulator: select");
+			break;
+		}
+
+		if( !FD_ISSET(fd, &rfds) )
+			continue;
+
+		if( (len = read(fd, buf, (credit < sizeof(buf)) ? credit : sizeof(buf))) > 0 ) {
+			receive(buf, len);
+
+			if( emu.baud )
+				credit -= len;
+		}
+	}
+
+	dump_leds();
+	dump_counts();
+
+	if( link )
+		unlink(link);
+
+	close(slave);
+	close(fd);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,457 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * end_to_end.c
+ * how long things take to get through monomeserial: from a press on the
+ * grid to the application hearing about it, and from the application
+ * sending /led to the bytes turning up on the serial line.
+ *
+ * this plays both ends.  the grid is a pty (see grid.c), pressed on a
+ * schedule and paced like a 115200 baud link would be.  the application
+ * is a liblo server.  presses are timed from when they "happen", so
+ * time spent queued behind the link counts.  LED messages are timed
+ * until the framebuffer shows them, so it doesn't matter what
+ * monomeserial coalesces them into on the way.
+ *
+ * each direction is run at a series of rates, and the results printed
+ * as "end_to_end/<direction>/<rate>/<stat> <value> <unit>", finishing
+ * with the rate where the link ran out.
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <lo/lo.h>
+
+#include "grid.h"
+
+#define SERIAL       "m256-001"
+#define PREFIX       "bench"
+#define SERVER_PORT  "18100"
+#define APP_PORT     "18101"
+#define MONOMESERIAL "../src/monomeserial/monomeserial"
+
+#define BAUD         115200
+#define MESSAGES     2000    /* per rate */
+#define SETTLE_NS    1000000000ULL /* how long to wait for stragglers */
+
+/* a rate is saturated once it can't keep up, or once the typical
+   latency has blown up to this many times what it was at the start */
+#define SATURATED_RATIO 10
+
+static const uint rates[] = {250, 500, 1000, 2000, 4000, 8000, 16000, 0};
+
+typedef struct {
+	uint64_t due;   /* when it should happen */
+	uint64_t done;  /* when it was seen at the other end, 0 if not yet */
+} sample_t;
+
+static struct {
+	grid_t grid;
+	int fd;
+
+	lo_server srv;
+	lo_address ms;
+
+	sample_t samples[MESSAGES];
+	int sent, seen;
+
+	/* LED messages still waiting to show up, by button.  the index into
+	   samples, or -1. */
+	int pending[256];
+	uint8_t target[256];
+	unsigned long superseded;
+} e2e;
+
+static uint64_t now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 10 bits on the wire per byte, 8N1 */
+static uint64_t wire_time(size_t bytes) {
+	return bytes * 10000000000ULL / BAUD;
+}
+
+static int compare_latency(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * the grid end
+ */
+
+static void press_coords(int k, uint *x, uint *y) {
+	*x = (k / 2) % e2e.grid.cols;
+	*y = (k / 2 / e2e.grid.cols) % e2e.grid.rows;
+}
+
+static void check_leds(uint64_t t) {
+	uint i, x, y;
+	int s;
+
+	for( i = 0; i < 256; i++ ) {
+		if( (s = e2e.pending[i]) < 0 )
+			continue;
+
+		x = i % 16;
+		y = i / 16;
+
+		if( !!(e2e.grid.leds[y] & (1 << x)) != e2e.target[i] )
+			continue;
+
+		e2e.samples[s].done = t;
+		e2e.pending[i] = -1;
+		e2e.seen++;
+	}
+}
+
+static void read_grid() {
+	uint8_t buf[256];
+	ssize_t len, i;
+	int changed = 0;
+
+	while( (len = read(e2e.fd, buf, sizeof(buf))) > 0 )
+		for( i = 0; i < len; i++ )
+			changed |= grid_receive(&e2e.grid, buf[i]);
+
+	if( changed )
+		check_leds(now());
+}
+
+/**
+ * the application end
+ */
+
+static int press_handler(const char *path, const char *types,
+						 lo_arg **argv, int argc,
+						 lo_message data, void *user_data) {
+	uint64_t t = now();
+	uint x, y;
+	int k;
+
+	/* presses come in order, so anything skipped over got lost */
+	for( k = e2e.seen; k < e2e.sent; k++ ) {
+		press_coords(k, &x, &y);
+
+		if( argv[0]->i == x && argv[1]->i == y && argv[2]->i == !(k & 1) ) {
+			e2e.samples[k].done = t;
+			e2e.seen = k + 1;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * the runs
+ */
+
+/* sends message k, at or after its due time */
+typedef void (*send_t)(int k);
+
+static void send_press(int k) {
+	uint8_t buf[2];
+	uint x, y;
+
+	press_coords(k, &x, &y);
+	grid_encode_press(&e2e.grid, buf, x, y, !(k & 1));
+
+	if( write(e2e.fd, buf, sizeof(buf)) != sizeof(buf) )
+		perror("end_to_end: couldn't press");
+}
+
+static void send_led(int k) {
+	uint i = k % 256;
+
+	if( e2e.pending[i] >= 0 )
+		e2e.superseded++;
+
+	/* every time round, each button flips */
+	e2e.pending[i] = k;
+	e2e.target[i]  = !((k / 256) & 1);
+
+	lo_send(e2e.ms, "/" PREFIX "/led", "iii", i % 16, i / 16, e2e.target[i]);
+}
+
+static void reset(const uint64_t start, uint rate, uint64_t spacing) {
+	uint64_t link_free = start;
+	int k;
+
+	memset(e2e.pending, -1, sizeof(e2e.pending));
+	e2e.sent = e2e.seen = 0;
+	e2e.superseded = 0;
+
+	for( k = 0; k < MESSAGES; k++ ) {
+		e2e.samples[k].due  = start + (uint64_t) k * 1000000000ULL / rate;
+		e2e.samples[k].done = 0;
+
+		/* the grid can't send any faster than the link goes */
+		if( spacing ) {
+			if( e2e.samples[k].due < link_free )
+				e2e.samples[k].due = link_free;
+
+			link_free = e2e.samples[k].due + spacing;
+		}
+	}
+}
+
+static void run(uint rate, send_t send, uint64_t spacing) {
+	uint64_t start = now() + 10000000, t, wait, last;
+	int fd = lo_server_get_socket_fd(e2e.srv), maxfd;
+	struct timeval tv;
+	fd_set rfds;
+
+	reset(start, rate, spacing);
+	last = e2e.samples[MESSAGES - 1].due + SETTLE_NS;
+
+	while( (t = now()) < last && e2e.seen < MESSAGES ) {
+		while( e2e.sent < MESSAGES && e2e.samples[e2e.sent].due <= t )
+			send(e2e.sent++);
+
+		wait = (e2e.sent < MESSAGES) ? e2e.samples[e2e.sent].due : last;
+		wait = (wait > t) ? wait - t : 0;
+
+		FD_ZERO(&rfds);
+		FD_SET(e2e.fd, &rfds);
+		FD_SET(fd, &rfds);
+		maxfd = (fd > e2e.fd) ? fd : e2e.fd;
+
+		tv.tv_sec  = wait / 1000000000;
+		tv.tv_usec = (wait % 1000000000) / 1000;
+
+		if( select(maxfd + 1, &rfds, NULL, NULL, &tv) < 1 )
+			continue;
+
+		if( FD_ISSET(e2e.fd, &rfds) )
+			read_grid();
+
+		if( FD_ISSET(fd, &rfds) )
+			lo_server_recv_noblock(e2e.srv, 0);
+	}
+}
+
+/* returns the median, in microseconds */
+static double report(const char *dir, uint rate, double *achieved) {
+	static uint64_t latency[MESSAGES];
+	double mean = 0, var = 0;
+	uint64_t first = 0, end = 0;
+	int k, n = 0;
+
+	for( k = 0; k < MESSAGES; k++ ) {
+		if( !e2e.samples[k].done )
+			continue;
+
+		latency[n] = e2e.samples[k].done - e2e.samples[k].due;
+		mean += latency[n++];
+
+		if( !first )
+			first = e2e.samples[k].due;
+
+		end = e2e.samples[k].done;
+	}
+
+	if( !n ) {
+		printf("end_to_end/%s/%u/lost %d msg\n", dir, rate, MESSAGES);
+		*achieved = 0;
+		return INFINITY;
+	}
+
+	mean /= n;
+
+	for( k = 0; k < n; k++ )
+		var += (latency[k] - mean) * (latency[k] - mean);
+
+	qsort(latency, n, sizeof(*latency), compare_latency);
+	*achieved = (end > first) ? n * 1e9 / (end - first) : 0;
+
+#define PCT(p) (latency[(int) ((n - 1) * (p))] / 1000.0)
+	printf("end_to_end/%s/%u/p50 %.1f us\n", dir, rate, PCT(0.5));
+	printf("end_to_end/%s/%u/p99 %.1f us\n", dir, rate, PCT(0.99));
+	printf("end_to_end/%s/%u/p999 %.1f us\n", dir, rate, PCT(0.999));
+	printf("end_to_end/%s/%u/jitter %.1f us\n", dir, rate, sqrt(var / n) / 1000);
+	printf("end_to_end/%s/%u/achieved %.0f msg/s\n", dir, rate, *achieved);
+	printf("end_to_end/%s/%u/lost %d msg\n", dir, rate, MESSAGES - n);
+#undef PCT
+
+	fflush(stdout);
+	return latency[(n - 1) / 2] / 1000.0;
+}
+
+/* so every run starts from a dark grid */
+static void clear_grid() {
+	lo_send(e2e.ms, "/" PREFIX "/clear", "i", 0);
+	usleep(100000);
+	read_grid();
+}
+
+static void sweep(const char *dir, send_t send, uint64_t spacing) {
+	double p50, base = 0, achieved;
+	uint saturated = 0;
+	int r;
+
+	for( r = 0; rates[r]; r++ ) {
+		clear_grid();
+		run(rates[r], send, spacing);
+		p50 = report(dir, rates[r], &achieved);
+
+		if( !base )
+			base = p50;
+
+		if( !saturated &&
+			(achieved < rates[r] * 0.9 || p50 > base * SATURATED_RATIO) )
+			saturated = rates[r];
+
+		if( !strcmp(dir, "led") && e2e.superseded )
+			printf("end_to_end/%s/%u/superseded %lu msg\n", dir, rates[r], e2e.superseded);
+	}
+
+	if( saturated )
+		printf("end_to_end/%s/saturation %u msg/s\n", dir, saturated);
+}
+
+/**
+ * setup
+ */
+
+static pid_t start_monomeserial(const char *link) {
+	char spec[128];
+	pid_t pid;
+
+	snprintf(spec, sizeof(spec), "%s:" PREFIX, link);
+
+	if( !(pid = fork()) ) {
+		freopen("/dev/null", "w", stdout);
+		execl(MONOMESERIAL, "monomeserial", "-d", spec,
+			  "-s", SERVER_PORT, "-a", APP_PORT, NULL);
+		_exit(1);
+	}
+
+	return pid;
+}
+
+/* keep clearing the grid until monomeserial's up and it comes through */
+static int wait_for_monomeserial() {
+	uint64_t give_up = now() + 5000000000ULL;
+	uint8_t buf[256];
+
+	while( now() < give_up ) {
+		lo_send(e2e.ms, "/" PREFIX "/clear", "i", 0);
+		usleep(50000);
+
+		if( read(e2e.fd, buf, sizeof(buf)) > 0 ) {
+			/* let whatever else it does at startup go by */
+			usleep(200000);
+			while( read(e2e.fd, buf, sizeof(buf)) > 0 );
+
+			memset(e2e.grid.leds, 0, sizeof(e2e.grid.leds));
+			e2e.grid.have = 0;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int main(int argc, char *argv[]) {
+	char link[64], *slave_name, *env;
+	int slave, ret = EXIT_FAILURE;
+	pid_t ms;
+
+	grid_init(&e2e.grid, SERIAL);
+
+	if( (e2e.fd = grid_open_pty(&slave_name, &slave)) < 0 ) {
+		perror("end_to_end: couldn't open a pty");
+		return EXIT_FAILURE;
+	}
+
+	snprintf(link, sizeof(link), "/tmp/monome-e2e-%d", getpid());
+
+	if( symlink(slave_name, link) ) {
+		perror("end_to_end: couldn't make the link");
+		return EXIT_FAILURE;
+	}
+
+	asprintf(&env, "%s=" SERIAL, link);
+	setenv("MONOME_SERIAL", env, 1);
+	free(env);
+
+	if( !(e2e.srv = lo_server_new(APP_PORT, NULL)) ||
+		!(e2e.ms = lo_address_new("127.0.0.1", SERVER_PORT)) ) {
+		fprintf(stderr, "end_to_end: couldn't set up OSC\n");
+		goto err_osc;
+	}
+
+	lo_server_add_method(e2e.srv, "/" PREFIX "/press", "iii", press_handler, NULL);
+
+	ms = start_monomeserial(link);
+
+	if( wait_for_monomeserial() ) {
+		fprintf(stderr, "end_to_end: monomeserial never showed up\n");
+		goto err_ms;
+	}
+
+	sweep("press", send_press, wire_time(2));
+	sweep("led", send_led, 0);
+
+	ret = EXIT_SUCCESS;
+
+err_ms:
+	kill(ms, SIGTERM);
+	waitpid(ms, NULL, 0);
+
+err_osc:
+	if( e2e.ms )
+		lo_address_free(e2e.ms);
+
+	if( e2e.srv )
+		lo_server_free(e2e.srv);
+
+	unlink(link);
+	close(slave);
+	close(e2e.fd);
+
+	return ret;
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "series.h"
+#include "40h.h"
+#include "grid.h"
+
+/* the same table libmonome uses to go from a serial to a device */
+static struct {
+	const char *sermatch;
+	grid_proto_t proto;
+	int rows, cols;
+} models[] = {
+	{"m256-%d", GRID_SERIES, 16, 16},
+	{"m128-%d", GRID_SERIES, 16, 8},
+	{"m64-%d",  GRID_SERIES, 8,  8},
+	{"m40h%d",  GRID_40h,    8,  8},
+	{"a40h-%d", GRID_40h,    8,  8},
+	{NULL}
+};
+
+/**
+ * private
+ */
+
+static int message_length(grid_t *grid, uint8_t first) {
+	if( grid->proto == GRID_40h )
+		return 2;
+
+	switch( first & 0xF0 ) {
+	case PROTO_SERIES_LED_ON:
+	case PROTO_SERIES_LED_OFF:
+	case PROTO_SERIES_LED_ROW_8:
+	case PROTO_SERIES_LED_COL_8:
+		return 2;
+
+	case PROTO_SERIES_LED_ROW_16:
+	case PROTO_SERIES_LED_COL_16:
+		return 3;
+
+	case PROTO_SERIES_LED_FRAME:
+		return 9;
+	}
+
+	return 1;
+}
+
+static void set_led(grid_t *grid, uint x, uint y, int on) {
+	if( x >= grid->cols || y >= grid->rows )
+		return;
+
+	if( on )
+		grid->leds[y] |= 1 << x;
+	else
+		grid->leds[y] &= ~(1 << x);
+}
+
+static void set_col(grid_t *grid, uint col, uint count, uint16_t data) {
+	uint y;
+
+	for( y = 0; y < count; y++ )
+		set_led(grid, col, y, data & (1 << y));
+}
+
+static void set_row(grid_t *grid, uint row, uint from, uint count, uint16_t data) {
+	uint x;
+
+	for( x = 0; x < count; x++ )
+		set_led(grid, from + x, row, data & (1 << x));
+}
+
+static int handle_series(grid_t *grid, const uint8_t *buf) {
+	uint i;
+
+	switch( buf[0] & 0xF0 ) {
+	case PROTO_SERIES_LED_ON:
+	case PROTO_SERIES_LED_OFF:
+		set_led(grid, buf[1] >> 4, buf[1] & 0x0F,
+				(buf[0] & 0xF0) == PROTO_SERIES_LED_ON);
+		break;
+
+	case PROTO_SERIES_LED_ROW_8:
+		set_row(grid, buf[0] & 0x0F, 0, 8, buf[1]);
+		break;
+
+	case PROTO_SERIES_LED_COL_8:
+		set_col(grid, buf[0] & 0x0F, 8, buf[1]);
+		break;
+
+	case PROTO_SERIES_LED_ROW_16:
+		set_row(grid, buf[0] & 0x0F, 0, 16, buf[1] | (buf[2] << 8));
+		break;
+
+	case PROTO_SERIES_LED_COL_16:
+		set_col(grid, buf[0] & 0x0F, 16, buf[1] | (buf[2] << 8));
+		break;
+
+	case PROTO_SERIES_LED_FRAME:
+		/* quadrants go left to right, top to bottom */
+		for( i = 0; i < 8; i++ )
+			set_row(grid, ((buf[0] & 2) << 2) + i, (buf[0] & 1) << 3, 8, buf[i + 1]);
+		break;
+
+	case PROTO_SERIES_CLEAR:
+		for( i = 0; i < grid->rows; i++ )
+			set_row(grid, i, 0, 16, (buf[0] & PROTO_SERIES_CLEAR_ON) ? 0xFFFF : 0);
+		break;
+
+	case PROTO_SERIES_INTENSITY:
+		grid->intensity = buf[0] & 0x0F;
+		break;
+
+	case PROTO_SERIES_MODE:
+		grid->mode = buf[0] & 0x03;
+		break;
+
+	case PROTO_SERIES_AUX_PORT_ACTIVATE:
+	case PROTO_SERIES_AUX_PORT_DEACTIVATE:
+		break;
+
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static int handle_40h(grid_t *grid, const uint8_t *buf) {
+	switch( buf[0] & 0xF8 ) {
+	case PROTO_40h_LED_ON & 0xF8:
+		set_led(grid, buf[1] >> 4, buf[1] & 0x0F, buf[0] == PROTO_40h_LED_ON);
+		break;
+
+	case PROTO_40h_INTENSITY:
+		grid->intensity = buf[1];
+		break;
+
+	case PROTO_40h_LED_TEST:
+	case PROTO_40h_SHUTDOWN:
+		grid->mode = buf[1];
+		break;
+
+	case PROTO_40h_ADC_ENABLE:
+		break;
+
+	case PROTO_40h_LED_ROW:
+		set_row(grid, buf[0] & 0x07, 0, 8, buf[1]);
+		break;
+
+	case PROTO_40h_LED_COL:
+		set_col(grid, buf[0] & 0x07, 8, buf[1]);
+		break;
+
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * public
+ */
+
+/* picks the protocol and size from the serial.  returns -1 if it isn't
+   one we know. */
+int grid_init(grid_t *grid, const char *serial) {
+	int i, n;
+
+	memset(grid, 0, sizeof(*grid));
+	grid->intensity = 0xF;
+
+	for( i = 0; models[i].sermatch; i++ )
+		if( sscanf(serial, models[i].sermatch, &n) == 1 ) {
+			grid->proto = models[i].proto;
+			grid->rows  = models[i].rows;
+			grid->cols  = models[i].cols;
+			return 0;
+		}
+
+	return -1;
+}
+
+/* feeds in one byte from the host.  returns 1 when that finished a
+   message, 0 if there's more to come.  like the hardware, a lost byte
+   means everything after it gets framed wrong until things happen to
+   line up again. */
+int grid_receive(grid_t *grid, uint8_t byte) {
+	int ret;
+
+	grid->partial[grid->have++] = byte;
+
+	if( grid->have < message_length(grid, grid->partial[0]) )
+		return 0;
+
+	if( grid->proto == GRID_SERIES )
+		ret = handle_series(grid, grid->partial);
+	else
+		ret = handle_40h(grid, grid->partial);
+
+	if( ret )
+		grid->parse_errors++;
+	else
+		grid->msgs++;
+
+	grid->have = 0;
+	return 1;
+}
+
+/* presses are two bytes either way */
+void grid_encode_press(grid_t *grid, uint8_t *buf, uint x, uint y, int down) {
+	if( grid->proto == GRID_SERIES )
+		buf[0] = (down) ? PROTO_SERIES_BUTTON_DOWN : PROTO_SERIES_BUTTON_UP;
+	else
+		buf[0] = (down) ? PROTO_40h_BUTTON_DOWN : PROTO_40h_BUTTON_UP;
+
+	buf[1] = (x << 4) | y;
+}
+
+/* returns the (non-blocking) master end */
+int grid_open_pty(char **slave_name, int *slave) {
+	struct termios tio;
+	int fd;
+
+	if( (fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 )
+		return -1;
+
+	if( grantpt(fd) || unlockpt(fd) || !(*slave_name = ptsname(fd)) )
+		goto err;
+
+	/* keep our own end of the slave open, otherwise the master reads EIO
+	   in between the host closing and reopening the device */
+	if( (*slave = open(*slave_name, O_RDWR | O_NOCTTY)) < 0 )
+		goto err;
+
+	/* and make it raw straight away.  until the host opens it, anything
+	   we send would otherwise get echoed straight back at us. */
+	tcgetattr(*slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(*slave, TCSANOW, &tio);
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _BENCH_GRID_H
+#define _BENCH_GRID_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* the device end of a serial link, shared by the emulator and the
+   benchmarks that need to stand in for hardware */
+
+typedef enum {
+	GRID_SERIES,
+	GRID_40h
+} grid_proto_t;
+
+typedef struct grid grid_t;
+
+struct grid {
+	grid_proto_t proto;
+	int rows, cols;
+
+	/* bit x of row y, as the device sees it (i.e. before any rotation) */
+	uint16_t leds[16];
+	uint intensity, mode;
+
+	/* bytes from the host that haven't made a whole message yet */
+	uint8_t partial[9];
+	int have;
+
+	unsigned long msgs, parse_errors;
+};
+
+int grid_init(grid_t *grid, const char *serial);
+int grid_receive(grid_t *grid, uint8_t byte);
+void grid_encode_press(grid_t *grid, uint8_t *buf, uint x, uint y, int down);
+
+int grid_open_pty(char **slave_name, int *slave);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * lossy_proxy.c
+ * a UDP proxy that drops a percentage of the packets going through it in
+ * either direction.  handy for checking that an app running with
+ * MONOME_OSC_SYNC set converges with monomeserial after loss:
+ *
+ *   monomeserial -s 8080 -a 8001 &
+ *   lossy_proxy 9080 127.0.0.1 8080 8001 20 &
+ *   MONOME_OSC_SYNC=64 ./app osc.udp://127.0.0.1:9080/monome 8000
+ *
+ * where 8001 is the port the proxy relays presses and acks from, back on
+ * to the app at 8000.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <netdb.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+static int udp_socket(const char *port) {
+	struct addrinfo hints, *res;
+	int fd;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags    = AI_PASSIVE;
+
+	if( getaddrinfo(NULL, port, &hints, &res) )
+		return -1;
+
+	if( (fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) >= 0 &&
+		bind(fd, res->ai_addr, res->ai_addrlen) ) {
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+	return fd;
+}
+
+static int resolve(const char *host, const char *port, struct sockaddr_storage *addr,
+				   socklen_t *len) {
+	struct addrinfo hints, *res;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if( getaddrinfo(host, port, &hints, &res) )
+		return -1;
+
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	*len = res->ai_addrlen;
+
+	freeaddrinfo(res);
+	return 0;
+}
+
+static void relay(int from, int to, struct sockaddr_storage *dest, socklen_t dest_len,
+				  struct sockaddr_storage *src, socklen_t *src_len,
+				  int loss, unsigned long *counts) {
+	char buf[4096];
+	ssize_t len;
+
+	if( (len = recvfrom(from, buf, sizeof(buf), 0, (struct sockaddr *) src, src_len)) < 0 )
+		return;
+
+	counts[0]++;
+
+	if( rand() % 100 < loss ) {
+		counts[1]++;
+		return;
+	}
+
+	sendto(to, buf, len, 0, (struct sockaddr *) dest, dest_len);
+}
+
+int main(int argc, char *argv[]) {
+	struct sockaddr_storage target, app, peer;
+	socklen_t target_len, app_len, peer_len;
+	unsigned long fwd[2] = {0, 0}, back[2] = {0, 0};
+	int front, rear, loss;
+	fd_set rfds;
+
+	if( argc < 6 ) {
+		printf("usage: %s <listen port> <target host> <target port> "
+			   "<return port> <loss %%> [app host] [app port]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	loss = atoi(argv[5]);
+	srand(time(NULL));
+
+	if( (front = udp_socket(argv[1])) < 0 || (rear = udp_socket(argv[4])) < 0 ||
+		resolve(argv[2], argv[3], &target, &target_len) ||
+		resolve((argc > 6) ? argv[6] : "127.0.0.1", (argc > 7) ? argv[7] : "8000",
+				&app, &app_len) ) {
+		perror("lossy_proxy");
+		return EXIT_FAILURE;
+	}
+
+	printf("relaying :%s -> %s:%s and :%s -> app, dropping %d%%\n",
+		   argv[1], argv[2], argv[3], argv[4], loss);
+
+	do {
+		FD_ZERO(&rfds);
+		FD_SET(front, &rfds);
+		FD_SET(rear, &rfds);
+
+		if( select(((front > rear) ? front : rear) + 1, &rfds, NULL, NULL, NULL) < 0 )
+			break;
+
+		peer_len = sizeof(peer);
+
+		if( FD_ISSET(front, &rfds) )
+			relay(front, front, &target, target_len, &peer, &peer_len, loss, fwd);
+
+		peer_len = sizeof(peer);
+
+		if( FD_ISSET(rear, &rfds) )
+			relay(rear, rear, &app, app_len, &peer, &peer_len, loss, back);
+
+		if( !((fwd[0] + back[0]) % 10000) )
+			printf("app->device %lu (%lu dropped), device->app %lu (%lu dropped)\n",
+				   fwd[0], fwd[1], back[0], back[1]);
+	} while( 1 );
+
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * osc_transport.c
+ * pushes LED messages through the OSC protocol module as fast as it'll go
+ * over each transport, and reports how many made it to the other side.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/select.h>
+
+#include <lo/lo.h>
+#include <monome.h>
+
+#include "osc_stream.h"
+
+#define MESSAGES   100000
+#define BENCH_PORT "18080"
+
+typedef struct {
+	const char *name;
+	int proto;
+
+	const char *url;
+	const char *recv_port;
+	const char *send_port;
+
+	volatile long received;
+	volatile int done;
+	volatile int ready;
+} transport_t;
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int count_handler(const char *path, const char *types,
+						 lo_arg **argv, int argc,
+						 lo_message data, void *user_data) {
+	transport_t *t = user_data;
+
+	t->received++;
+	return 0;
+}
+
+static void count_packet(osc_stream_t *stream, void *packet, size_t len,
+						 void *user_data) {
+	transport_t *t = user_data;
+
+	t->received++;
+}
+
+static void *datagram_receiver(void *data) {
+	transport_t *t = data;
+	lo_server srv;
+
+	if( !(srv = lo_server_new_with_proto(t->recv_port, t->proto, NULL)) ) {
+		t->ready = -1;
+		return NULL;
+	}
+
+	lo_server_add_method(srv, NULL, NULL, count_handler, t);
+	t->ready = 1;
+
+	while( !t->done )
+		lo_server_recv_noblock(srv, 10);
+
+	lo_server_free(srv);
+	return NULL;
+}
+
+static void *stream_receiver(void *data) {
+	transport_t *t = data;
+	osc_stream_t stream;
+	struct timeval tv;
+	fd_set rfds;
+	int lfd;
+
+	if( (lfd = osc_stream_listen(t->recv_port)) < 0 ) {
+		t->ready = -1;
+		return NULL;
+	}
+
+	t->ready = 1;
+
+	if( osc_stream_accept(&stream, lfd) ) {
+		close(lfd);
+		return NULL;
+	}
+
+	while( !t->done ) {
+		FD_ZERO(&rfds);
+		FD_SET(stream.fd, &rfds);
+		tv.tv_sec  = 0;
+		tv.tv_usec = 10000;
+
+		if( select(stream.fd + 1, &rfds, NULL, NULL, &tv) > 0 &&
+			osc_stream_read(&stream, count_packet, t) )
+			break;
+	}
+
+	osc_stream_close(&stream);
+	close(lfd);
+	return NULL;
+}
+
+static void run(transport_t *t) {
+	pthread_t thread;
+	monome_t *monome;
+	double start, sent, end;
+	long last;
+	uint i;
+
+	pthread_create(&thread, NULL,
+				   (t->proto == LO_TCP) ? stream_receiver : datagram_receiver, t);
+
+	while( !t->ready )
+		usleep(1000);
+
+	if( t->ready < 0 || !(monome = monome_open(t->url, t->send_port)) ) {
+		fprintf(stderr, "osc_transport: couldn't set up %s\n", t->name);
+		t->done = 1;
+		pthread_join(thread, NULL);
+		return;
+	}
+
+	start = now();
+
+	for( i = 0; i < MESSAGES; i++ )
+		monome_led_on(monome, i & 0xF, (i >> 4) & 0xF);
+
+	sent = now();
+
+	/* let the receiver drain, stop once it's been idle for a bit */
+	do {
+		last = t->received;
+		usleep(50000);
+	} while( t->received != last && t->received < MESSAGES );
+
+	end = now();
+
+	t->done = 1;
+	monome_close(monome);
+	pthread_join(thread, NULL);
+
+	printf("osc_transport/%s/send_rate %.0f msg/s\n", t->name, MESSAGES / (sent - start));
+	printf("osc_transport/%s/recv_rate %.0f msg/s\n", t->name, t->received / (end - start));
+	printf("osc_transport/%s/lost %ld msg\n", t->name, MESSAGES - t->received);
+}
+
+int main(int argc, char *argv[]) {
+	char srv_path[64], app_path[64], unix_url[96];
+	uint i;
+
+	snprintf(srv_path, sizeof(srv_path), "/tmp/monome-bench-%d.sock", getpid());
+	snprintf(app_path, sizeof(app_path), "/tmp/monome-bench-%d-app.sock", getpid());
+	snprintf(unix_url, sizeof(unix_url), "osc.unix://%s#/bench", srv_path);
+
+	transport_t transports[] = {
+		{"udp",  LO_UDP,  "osc.udp://127.0.0.1:" BENCH_PORT "/bench", BENCH_PORT, NULL},
+		{"unix", LO_UNIX, unix_url, srv_path, app_path},
+		{"tcp",  LO_TCP,  "osc.tcp://127.0.0.1:" BENCH_PORT "/bench", BENCH_PORT, NULL}
+	};
+
+	for( i = 0; i < sizeof(transports) / sizeof(*transports); i++ )
+		run(&transports[i]);
+
+	unlink(srv_path);
+	unlink(app_path);
+
+	return 0;
+}
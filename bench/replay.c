@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * replay.c
+ * plays back a capture (see src/capture.c), for chasing a slowdown
+ * offline or as a regression or throughput test:
+ *
+ *   MONOME_CAPTURE=/tmp/session-%d.cap monomeserial ...
+ *   replay /tmp/session-1234.cap
+ *
+ * by default each device in the capture is recreated as a mem:// device,
+ * what it sent gets fed through libmonome's parsers, and what was sent to
+ * it goes through the emulator's decoder (grid.c), so the final state of
+ * its LEDs can be checked.  with -L, the first device is played out on a
+ * pty instead, for monomeserial or anything else to open, and what comes
+ * back is checked against what was captured.
+ *
+ * records are replayed at their original pace, or with -m as fast as
+ * they'll go.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <monome.h>
+
+#include "grid.h"
+
+#define MAX_STREAMS 64
+
+typedef struct {
+	char serial[64];
+	monome_t *monome;  /* the mem:// device replaying what it sent */
+	grid_t grid;       /* what it was sent, decoded */
+	int valid;
+} stream_t;
+
+static struct {
+	const uint8_t *data;
+	size_t size;
+	const monome_capture_header_t *header;
+
+	stream_t streams[MAX_STREAMS];
+
+	/* pty mode */
+	int fd;
+	uint pty_stream;
+	grid_t actual;
+
+	struct {
+		unsigned long records, bytes, events, osc_in, osc_out, skipped;
+	} counts;
+} replay;
+
+static uint64_t now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* walks the records.  returns NULL at the end, or where one's cut off
+   (the writer was killed partway through, say). */
+static const monome_capture_record_t *next_record(size_t *offset) {
+	const monome_capture_record_t *rec;
+
+	if( *offset + sizeof(*rec) > replay.size )
+		return NULL;
+
+	rec = (const monome_capture_record_t *) (replay.data + *offset);
+
+	if( *offset + sizeof(*rec) + MONOME_CAPTURE_PAD(rec->len) > replay.size )
+		return NULL;
+
+	*offset += sizeof(*rec) + MONOME_CAPTURE_PAD(rec->len);
+	return rec;
+}
+
+static int map_capture(const char *path) {
+	struct stat st;
+	int fd;
+
+	if( (fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) )
+		return -1;
+
+	replay.size = st.st_size;
+	replay.data = mmap(NULL, replay.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if( replay.data == MAP_FAILED )
+		return -1;
+
+	replay.header = (const monome_capture_header_t *) replay.data;
+
+	if( replay.size < sizeof(*replay.header) ||
+		memcmp(replay.header->magic, MONOME_CAPTURE_MAGIC, sizeof(MONOME_CAPTURE_MAGIC)) ||
+		replay.header->version != MONOME_CAPTURE_VERSION ||
+		replay.header->record_size != sizeof(monome_capture_record_t) ) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the serial of the first device in the capture, or NULL */
+static const char *first_serial(char *buf, size_t size) {
+	const monome_capture_record_t *rec;
+	size_t offset = sizeof(*replay.header);
+
+	while( (rec = next_record(&offset)) )
+		if( rec->kind == MONOME_CAPTURE_OPEN && rec->len < size ) {
+			memcpy(buf, rec + 1, rec->len);
+			buf[rec->len] = 0;
+			return buf;
+		}
+
+	return NULL;
+}
+
+/**
+ * playing it back
+ */
+
+static void open_stream(uint id, const char *serial, size_t len, int pty) {
+	stream_t *s = &replay.streams[id];
+	char dev[80];
+
+	if( len >= sizeof(s->serial) )
+		len = sizeof(s->serial) - 1;
+
+	memcpy(s->serial, serial, len);
+	s->serial[len] = 0;
+
+	if( grid_init(&s->grid, s->serial) ) {
+		fprintf(stderr, "replay: don't know what device %u (\"%s\") is, "
+				"skipping it\n", id, s->serial);
+		return;
+	}
+
+	s->valid = 1;
+
+	if( pty )
+		return;
+
+	snprintf(dev, sizeof(dev), "mem://%s", s->serial);
+
+	if( !(s->monome = monome_open(dev)) ) {
+		fprintf(stderr, "replay: couldn't open %s\n", dev);
+		s->valid = 0;
+	}
+}
+
+static void device_read(stream_t *s, const uint8_t *buf, size_t len) {
+	monome_event_t e;
+
+	if( !s->monome ) {
+		if( write(replay.fd, buf, len) != len )
+			replay.counts.skipped++;
+
+		return;
+	}
+
+	monome_mem_inject(s->monome, buf, len);
+
+	while( monome_event_next(s->monome, &e) )
+		replay.counts.events++;
+}
+
+static void device_write(stream_t *s, const uint8_t *buf, size_t len) {
+	uint8_t sink[256];
+	size_t i;
+
+	for( i = 0; i < len; i++ )
+		grid_receive(&s->grid, buf[i]);
+
+	/* the mem:// device doesn't get written to here, but keep its sink
+	   empty anyway in case it's ever asked to */
+	if( s->monome )
+		while( monome_mem_drain(s->monome, sink, sizeof(sink)) > 0 );
+}
+
+/* pty mode: whatever the host's sent so far */
+static void read_host() {
+	uint8_t buf[256];
+	ssize_t len, i;
+
+	while( (len = read(replay.fd, buf, sizeof(buf))) > 0 )
+		for( i = 0; i < len; i++ )
+			grid_receive(&replay.actual, buf[i]);
+}
+
+static void wait_until(uint64_t when) {
+	struct timeval tv;
+	uint64_t t;
+	fd_set rfds;
+
+	while( (t = now()) < when ) {
+		tv.tv_sec  = (when - t) / 1000000000;
+		tv.tv_usec = ((when - t) % 1000000000) / 1000;
+
+		if( replay.fd < 0 ) {
+			select(0, NULL, NULL, NULL, &tv);
+			continue;
+		}
+
+		FD_ZERO(&rfds);
+		FD_SET(replay.fd, &rfds);
+
+		if( select(replay.fd + 1, &rfds, NULL, NULL, &tv) > 0 )
+			read_host();
+	}
+}
+
+static void play(int max_speed, int pty) {
+	const monome_capture_record_t *rec;
+	const uint8_t *data;
+	uint64_t start = now();
+	size_t offset = sizeof(*replay.header);
+	stream_t *s;
+
+	while( (rec = next_record(&offset)) ) {
+		data = (const uint8_t *) (rec + 1);
+
+		if( !max_speed )
+			wait_until(start + rec->time);
+
+		replay.counts.records++;
+		replay.counts.bytes += rec->len;
+
+		switch( rec->kind ) {
+		case MONOME_CAPTURE_OSC_IN:
+			replay.counts.osc_in++;
+			continue;
+
+		case MONOME_CAPTURE_OSC_OUT:
+			replay.counts.osc_out++;
+			continue;
+		}
+
+		if( rec->stream >= MAX_STREAMS ) {
+			replay.counts.skipped++;
+			continue;
+		}
+
+		s = &replay.streams[rec->stream];
+
+		if( rec->kind == MONOME_CAPTURE_OPEN ) {
+			/* only the first device goes out on the pty */
+			if( !s->valid && (!pty || !replay.pty_stream) ) {
+				open_stream(rec->stream, (const char *) data, rec->len, pty);
+
+				if( pty && s->valid )
+					replay.pty_stream = rec->stream;
+			}
+
+			continue;
+		}
+
+		if( !s->valid || (pty && rec->stream != replay.pty_stream) ) {
+			replay.counts.skipped++;
+			continue;
+		}
+
+		if( rec->kind == MONOME_CAPTURE_READ )
+			device_read(s, data, rec->len);
+		else if( rec->kind == MONOME_CAPTURE_WRITE )
+			device_write(s, data, rec->len);
+	}
+
+	if( offset != replay.size )
+		fprintf(stderr, "replay: the capture's cut off, stopped at byte %zu of %zu\n",
+				offset, replay.size);
+}
+
+/**
+ * the results
+ */
+
+static void print_leds(const char *label, const grid_t *grid) {
+	int x, y;
+
+	printf("%s\n", label);
+
+	for( y = 0; y < grid->rows; y++ ) {
+		for( x = 0; x < grid->cols; x++ )
+			putchar((grid->leds[y] & (1 << x)) ? '#' : '.');
+
+		putchar('\n');
+	}
+}
+
+static int report(double elapsed, int pty) {
+	monome_stats_t stats;
+	uint64_t parse_errors = 0;
+	stream_t *s;
+	char label[96];
+	int i, ret = 0;
+
+	for( i = 0; i < MAX_STREAMS; i++ ) {
+		s = &replay.streams[i];
+
+		if( !s->valid )
+			continue;
+
+		if( s->monome ) {
+			monome_get_stats(s->monome, &stats);
+			parse_errors += stats.parse_errors;
+		}
+
+		snprintf(label, sizeof(label), "device %d (%s), as captured:", i, s->serial);
+		print_leds(label, &s->grid);
+
+		if( pty && i == replay.pty_stream ) {
+			print_leds("and as replayed:", &replay.actual);
+
+			if( memcmp(s->grid.leds, replay.actual.leds, sizeof(s->grid.leds)) ) {
+				printf("replay/mismatch 1\n");
+				ret = 1;
+			}
+		}
+	}
+
+	printf("replay/records %lu\n", replay.counts.records);
+	printf("replay/skipped %lu\n", replay.counts.skipped);
+	printf("replay/osc_in %lu msg\n", replay.counts.osc_in);
+	printf("replay/osc_out %lu msg\n", replay.counts.osc_out);
+	printf("replay/events %lu events\n", replay.counts.events);
+	printf("replay/parse_errors %llu events\n", (unsigned long long) parse_errors);
+	printf("replay/elapsed %.3f s\n", elapsed);
+	printf("replay/record_rate %.0f records/s\n", replay.counts.records / elapsed);
+	printf("replay/byte_rate %.0f B/s\n", replay.counts.bytes / elapsed);
+
+	return ret;
+}
+
+static void usage(const char *app) {
+	printf("usage: %s [options...] <capture>\n"
+		   "\n"
+		   "  -h, --help			display this information\n"
+		   "  -m, --max-speed		don't wait between records\n"
+		   "  -L, --link <path>		play the first device out on a pty,\n"
+		   "				with a symlink to it here\n"
+		   "\n", app);
+}
+
+int main(int argc, char *argv[]) {
+	const char *link = NULL, *serial;
+	int c, slave = -1, max_speed = 0, ret;
+	char *slave_name, buf[64];
+	uint64_t start;
+
+	struct option arguments[] = {
+		{"help",      no_argument,       0, 'h'},
+		{"max-speed", no_argument,       0, 'm'},
+		{"link",      required_argument, 0, 'L'},
+		{0, 0, 0, 0}
+	};
+
+	while( (c = getopt_long(argc, argv, "hmL:", arguments, NULL)) > 0 ) {
+		switch( c ) {
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+
+		case 'm':
+			max_speed = 1;
+			break;
+
+		case 'L':
+			link = optarg;
+			break;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if( optind >= argc ) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if( map_capture(argv[optind]) ) {
+		perror("replay: couldn't read the capture");
+		return EXIT_FAILURE;
+	}
+
+	replay.fd = -1;
+
+	if( link ) {
+		if( !(serial = first_serial(buf, sizeof(buf))) ||
+			grid_init(&replay.actual, serial) ) {
+			fprintf(stderr, "replay: there's no device in the capture to play\n");
+			return EXIT_FAILURE;
+		}
+
+		if( (replay.fd = grid_open_pty(&slave_name, &slave)) < 0 ) {
+			perror("replay: couldn't open a pty");
+			return EXIT_FAILURE;
+		}
+
+		unlink(link);
+
+		if( symlink(slave_name, link) ) {
+			perror("replay: couldn't make the link");
+			return EXIT_FAILURE;
+		}
+
+		printf("%s on %s, waiting for the host to send something\n"
+			   "export MONOME_SERIAL=%s=%s\n", serial, slave_name, link, serial);
+		fflush(stdout);
+
+		/* most hosts clear the grid as soon as they open it */
+		while( !replay.actual.msgs && !replay.actual.parse_errors ) {
+			usleep(10000);
+			read_host();
+		}
+	}
+
+	start = now();
+	play(max_speed, link != NULL);
+
+	/* give the host a moment to answer the last of it */
+	if( link )
+		wait_until(now() + 500000000ULL);
+
+	ret = report((now() - start) / 1e9, link != NULL);
+
+	if( link ) {
+		unlink(link);
+		close(slave);
+		close(replay.fd);
+	}
+
+	return (ret) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * soak.c
+ * opens and closes devices over and over, the way a daemon with a lot of
+ * hot-plug churn would, and watches whether the process grows while it
+ * does: resident memory, open file descriptors and mappings (which is
+ * where a protocol module dlopen()ed on every open shows up), as well as
+ * how long each open takes and whether that drifts.
+ *
+ * the first tenth of the run is warm-up and isn't counted against the
+ * growth figures.  exits non-zero if descriptors or mappings grew at all,
+ * or memory by more than RSS_SLACK.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <monome.h>
+
+#define DEFAULT_OPENS 100000
+#define CHECKPOINTS   10
+#define RSS_SLACK     (512 * 1024)
+
+#define OSC_PORT      "18092"
+
+typedef enum {
+	MEM,
+	PTY,
+	OSC,
+	PROBE  /* something that isn't a monome, so every open fails */
+} kind_t;
+
+typedef struct {
+	const char *name;
+	kind_t kind;
+	const char *serial;
+	char dev[64];
+	pid_t emulator;
+} target_t;
+
+typedef struct {
+	long rss;
+	int fds;
+	int maps;
+} usage_t;
+
+static uint64_t *samples;
+
+static uint64_t now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_samples(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * what the process is using
+ */
+
+static long get_rss() {
+	long pages = 0;
+	FILE *f;
+
+	if( !(f = fopen("/proc/self/statm", "r")) )
+		return -1;
+
+	if( fscanf(f, "%*d %ld", &pages) != 1 )
+		pages = -1;
+
+	fclose(f);
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+static int count_fds() {
+	struct dirent *d;
+	DIR *dir;
+	int n = 0;
+
+	if( !(dir = opendir("/proc/self/fd")) )
+		return -1;
+
+	while( (d = readdir(dir)) )
+		if( d->d_name[0] != '.' )
+			n++;
+
+	closedir(dir);
+
+	/* not counting the one opendir() has open */
+	return n - 1;
+}
+
+static int count_maps() {
+	FILE *f;
+	int c, n = 0;
+
+	if( !(f = fopen("/proc/self/maps", "r")) )
+		return -1;
+
+	while( (c = getc(f)) != EOF )
+		if( c == '\n' )
+			n++;
+
+	fclose(f);
+	return n;
+}
+
+static void get_usage(usage_t *u) {
+	u->rss  = get_rss();
+	u->fds  = count_fds();
+	u->maps = count_maps();
+}
+
+/**
+ * the emulator
+ */
+
+static int start_emulator(target_t *t) {
+	struct stat st;
+	int i;
+
+	snprintf(t->dev, sizeof(t->dev), "/tmp/monome-soak-%d-%s", getpid(), t->serial);
+
+	if( !(t->emulator = fork()) ) {
+		freopen("/dev/null", "w", stdout);
+		execl("./emulator", "emulator", "-b", "0", "-s", t->serial,
+			  "-L", t->dev, NULL);
+		_exit(1);
+	}
+
+	/* wait for it to make the link */
+	for( i = 0; i < 100; i++ ) {
+		if( !lstat(t->dev, &st) )
+			return 0;
+
+		usleep(10000);
+	}
+
+	return -1;
+}
+
+static void stop_emulator(target_t *t) {
+	if( t->emulator <= 0 )
+		return;
+
+	kill(t->emulator, SIGTERM);
+	waitpid(t->emulator, NULL, 0);
+}
+
+/**
+ * the soak
+ */
+
+static int soak(target_t *t, int opens) {
+	usage_t start, end, u;
+	monome_t *monome;
+	uint64_t first = 0, last = 0;
+	int i, tenth = opens / CHECKPOINTS, failed = 0;
+
+	for( i = 0; i < opens; i++ ) {
+		if( i == tenth )
+			get_usage(&start);
+
+		samples[i] = now();
+
+		if( (monome = monome_open(t->dev, OSC_PORT)) ) {
+			monome_led_on(monome, i & 7, (i >> 3) & 7);
+			monome_close(monome);
+		} else if( t->kind != PROBE ) {
+			printf("soak/%s couldn't open %s after %d opens\n", t->name, t->dev, i);
+			return 1;
+		}
+
+		samples[i] = now() - samples[i];
+
+		if( i < tenth )
+			first += samples[i];
+		else if( i >= opens - tenth )
+			last += samples[i];
+
+		if( i && !(i % tenth) ) {
+			get_usage(&u);
+			fprintf(stderr, "soak/%s %d opens, rss %ld KB, %d fds, %d maps\n",
+					t->name, i, u.rss / 1024, u.fds, u.maps);
+		}
+	}
+
+	get_usage(&end);
+
+	printf("soak/%s/opens %d opens\n", t->name, opens);
+	printf("soak/%s/rss_growth %ld KB\n", t->name, (end.rss - start.rss) / 1024);
+	printf("soak/%s/fd_growth %d fds\n", t->name, end.fds - start.fds);
+	printf("soak/%s/maps_growth %d maps\n", t->name, end.maps - start.maps);
+	printf("soak/%s/open_drift %.1f %%\n", t->name,
+		   (first) ? 100.0 * ((double) last - first) / first : 0.0);
+
+	qsort(samples, opens, sizeof(*samples), compare_samples);
+
+	printf("soak/%s/open_p50 %llu ns\n", t->name,
+		   (unsigned long long) samples[opens / 2]);
+	printf("soak/%s/open_p99 %llu ns\n", t->name,
+		   (unsigned long long) samples[opens - opens / 100 - 1]);
+	printf("soak/%s/open_max %llu ns\n", t->name,
+		   (unsigned long long) samples[opens - 1]);
+
+	if( end.fds > start.fds || end.maps > start.maps ||
+		end.rss - start.rss > RSS_SLACK ) {
+		printf("soak/%s grew while soaking\n", t->name);
+		failed = 1;
+	}
+
+	return failed;
+}
+
+static void usage(const char *app) {
+	printf("usage: %s [options...]\n"
+		   "\n"
+		   "  -h, --help			display this information\n"
+		   "\n"
+		   "  -n, --opens <count>		opens per device (default %d)\n"
+		   "\n", app, DEFAULT_OPENS);
+}
+
+int main(int argc, char *argv[]) {
+	char serials[256];
+	int i, c, opens = DEFAULT_OPENS, len = 0, failed = 0;
+
+	struct option arguments[] = {
+		{"help",  no_argument,       0, 'h'},
+		{"opens", required_argument, 0, 'n'},
+		{0, 0, 0, 0}
+	};
+
+	target_t targets[] = {
+		{"series",     MEM, "m256-000"},
+		{"osc",        OSC, NULL},
+		{"series_pty", PTY, "m256-001"},
+		{"40h_pty",    PTY, "m40h001"},
+		{"probe",      PROBE, NULL},
+		{NULL}
+	};
+
+	while( (c = getopt_long(argc, argv, "hn:", arguments, NULL)) > 0 ) {
+		switch( c ) {
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+
+		case 'n':
+			opens = atoi(optarg);
+			break;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if( opens < CHECKPOINTS ) {
+		fprintf(stderr, "soak: need at least %d opens\n", CHECKPOINTS);
+		return EXIT_FAILURE;
+	}
+
+	if( !(samples = calloc(opens, sizeof(*samples))) )
+		return EXIT_FAILURE;
+
+	/* touch it all now, or it fills in as RSS growth while we soak */
+	memset(samples, 0xff, opens * sizeof(*samples));
+
+	for( i = 0; targets[i].name; i++ ) {
+		switch( targets[i].kind ) {
+		case MEM:
+			snprintf(targets[i].dev, sizeof(targets[i].dev), "mem://%s", targets[i].serial);
+			break;
+
+		case OSC:
+			snprintf(targets[i].dev, sizeof(targets[i].dev),
+					 "osc.udp://127.0.0.1:%d/soak", atoi(OSC_PORT) + 1);
+			break;
+
+		case PROBE:
+			/* goes all the way through the platform's serial lookup */
+			strcpy(targets[i].dev, "/dev/null");
+			break;
+
+		case PTY:
+			if( start_emulator(&targets[i]) ) {
+				fprintf(stderr, "soak: couldn't start the emulator\n");
+				targets[i].dev[0] = 0;
+				break;
+			}
+
+			len += snprintf(serials + len, sizeof(serials) - len, "%s%s=%s",
+							(len) ? "," : "", targets[i].dev, targets[i].serial);
+			break;
+		}
+	}
+
+	setenv("MONOME_SERIAL", serials, 1);
+
+	for( i = 0; targets[i].name; i++ ) {
+		if( !targets[i].dev[0] )
+			continue;
+
+		/* the OSC module isn't built without liblo */
+		if( targets[i].kind == OSC ) {
+			monome_t *monome;
+
+			if( !(monome = monome_open(targets[i].dev, OSC_PORT)) ) {
+				fprintf(stderr, "soak: couldn't open %s, skipping it\n",
+						targets[i].dev);
+				continue;
+			}
+
+			monome_close(monome);
+		}
+
+		failed |= soak(&targets[i], opens);
+	}
+
+	for( i = 0; targets[i].name; i++ )
+		stop_emulator(&targets[i]);
+
+	free(samples);
+	return (failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * sync_check.c
+ * runs an osc_sync sender and receiver against each other through a
+ * pretend network that loses and reorders packets, and checks that the
+ * receiver ends up with the sender's grid.
+ *
+ * each side does with a message what the osc module and monomeserial do
+ * with it (see proto_osc_dispatch() and osc_sync_handler()): the sender
+ * sends on every change, again when a repeated ack says the receiver is
+ * behind, and a keyframe on a resync.  the receiver acks what it applies,
+ * asks for a resync when it's missing a delta's base, and repeats its
+ * ack every ACK_TICKS.
+ *
+ * every tick changes the grid once, and that's a frame.  after the
+ * frames, the grid stays put for SETTLE_TICKS (still over the same lossy
+ * network) and the two grids have to match by the end of it.  exits
+ * non-zero if they don't, if a scenario didn't get as far as exercising
+ * what it's there for, or if one that loses nothing needed a resync.
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "osc_sync.h"
+
+#define DEFAULT_FRAMES 20000
+#define SETTLE_TICKS   2000
+#define ACK_TICKS      10
+#define MAX_IN_FLIGHT  1024
+
+typedef enum {
+	KEY,
+	DELTA,
+	ACK,
+	RESYNC
+} kind_t;
+
+typedef struct {
+	kind_t kind;
+	uint32_t seq;
+	uint32_t base;
+	uint8_t data[OSC_SYNC_MAX_DELTA];
+	size_t len;
+	unsigned long due;
+} packet_t;
+
+typedef struct {
+	const char *name;
+	uint keyframe_interval;
+	uint loss;      /* percent, each way */
+	uint delay;     /* up to this many ticks, so anything over 1 reorders */
+	uint stall;     /* ticks that acks are held up for, halfway through */
+	int restart;    /* the receiver starts over a third of the way in */
+
+	/* what has to have happened by the end */
+	int want_resend;
+	int want_resync;
+	int want_expired;
+} scenario_t;
+
+static struct {
+	const scenario_t *sc;
+	osc_sync_t sender;
+	osc_sync_t receiver;
+
+	packet_t in_flight[MAX_IN_FLIGHT];
+	uint n;
+
+	unsigned long tick;
+	unsigned long frames;
+	uint64_t rng;
+
+	struct {
+		unsigned long sent;
+		unsigned long lost;
+		unsigned long resent;
+		unsigned long expired;
+	} stats;
+} sim;
+
+/**
+ * network
+ */
+
+static uint rnd(uint n) {
+	sim.rng ^= sim.rng << 13;
+	sim.rng ^= sim.rng >> 7;
+	sim.rng ^= sim.rng << 17;
+
+	return sim.rng % n;
+}
+
+static void send_packet(kind_t kind, uint32_t seq, uint32_t base,
+						const uint8_t *data, size_t len) {
+	unsigned long stall_start = sim.frames / 2;
+	packet_t *p;
+
+	sim.stats.sent++;
+
+	if( rnd(100) < sim.sc->loss || sim.n == MAX_IN_FLIGHT ) {
+		sim.stats.lost++;
+		return;
+	}
+
+	p = &sim.in_flight[sim.n++];
+
+	p->kind = kind;
+	p->seq  = seq;
+	p->base = base;
+	p->len  = len;
+	p->due  = sim.tick + 1 + rnd(sim.sc->delay);
+
+	if( len )
+		memcpy(p->data, data, len);
+
+	/* acks and resyncs sent during the stall all turn up at the end of
+	   it, by which time the frames they're about are long gone */
+	if( (kind == ACK || kind == RESYNC) && sim.tick >= stall_start &&
+		sim.tick < stall_start + sim.sc->stall )
+		p->due = stall_start + sim.sc->stall + rnd(sim.sc->delay);
+}
+
+/**
+ * sender (the osc module)
+ */
+
+static void sender_send() {
+	uint8_t buf[OSC_SYNC_MAX_DELTA];
+	uint32_t seq, base;
+	size_t len;
+
+	switch( osc_sync_next(&sim.sender, buf, &len, &seq, &base) ) {
+	case OSC_SYNC_KEY:
+		send_packet(KEY, seq, 0, buf, len);
+		break;
+
+	case OSC_SYNC_DELTA:
+		send_packet(DELTA, seq, base, buf, len);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void sender_receive(const packet_t *p) {
+	osc_sync_t *s = &sim.sender;
+
+	if( p->kind == RESYNC ) {
+		osc_sync_resync(s);
+		sender_send();
+		return;
+	}
+
+	if( osc_sync_ack(s, p->seq) )
+		return;
+
+	/* newer than what we've got as acknowledged, but we've sent so much
+	   since that we don't have it any more */
+	if( p->seq > s->base && p->seq <= s->seq )
+		sim.stats.expired++;
+
+	if( s->base != s->seq ) {
+		sim.stats.resent++;
+		sender_send();
+	}
+}
+
+static void sender_change() {
+	osc_sync_grid_t *g = &sim.sender.grid;
+	uint8_t data[8];
+	uint i;
+
+	for( i = 0; i < sizeof(data); i++ )
+		data[i] = rnd(256);
+
+	switch( rnd(8) ) {
+	case 0:
+		osc_sync_grid_row(g, rnd(16), 1 + rnd(2), data);
+		break;
+
+	case 1:
+		osc_sync_grid_col(g, rnd(16), 1 + rnd(2), data);
+		break;
+
+	case 2:
+		osc_sync_grid_frame(g, rnd(4), data);
+		break;
+
+	case 3:
+		/* not often, it makes for a lot of identical grids */
+		if( !rnd(16) )
+			osc_sync_grid_clear(g, rnd(2));
+		break;
+
+	default:
+		osc_sync_grid_led(g, rnd(16), rnd(16), rnd(2));
+		break;
+	}
+
+	sender_send();
+}
+
+/**
+ * receiver (monomeserial)
+ */
+
+static void receiver_receive(const packet_t *p) {
+	osc_sync_t *r = &sim.receiver;
+	int ret;
+
+	if( p->kind == KEY )
+		ret = osc_sync_apply_key(r, p->seq, p->data, p->len);
+	else
+		ret = osc_sync_apply_delta(r, p->seq, p->base, p->data, p->len);
+
+	if( ret > 0 )
+		send_packet(ACK, r->seq, 0, NULL, 0);
+	else if( ret < 0 )
+		send_packet(RESYNC, r->seq, 0, NULL, 0);
+}
+
+/**
+ * the run
+ */
+
+static void deliver() {
+	packet_t p;
+	uint i = 0;
+
+	while( i < sim.n ) {
+		if( sim.in_flight[i].due > sim.tick ) {
+			i++;
+			continue;
+		}
+
+		p = sim.in_flight[i];
+		sim.in_flight[i] = sim.in_flight[--sim.n];
+
+		if( p.kind == ACK || p.kind == RESYNC )
+			sender_receive(&p);
+		else
+			receiver_receive(&p);
+	}
+}
+
+static void step() {
+	sim.tick++;
+
+	if( !(sim.tick % ACK_TICKS) && sim.receiver.seq )
+		send_packet(ACK, sim.receiver.seq, 0, NULL, 0);
+
+	deliver();
+}
+
+static int run(const scenario_t *sc, unsigned long frames, uint64_t seed) {
+	unsigned long i;
+	int failed = 0;
+
+	memset(&sim, 0, sizeof(sim));
+	sim.sc     = sc;
+	sim.frames = frames;
+	sim.rng    = seed;
+
+	osc_sync_init(&sim.sender, sc->keyframe_interval);
+	osc_sync_init(&sim.receiver, 0);
+
+	for( i = 0; i < frames; i++ ) {
+		if( sc->restart && i == frames / 3 )
+			osc_sync_init(&sim.receiver, 0);
+
+		sender_change();
+		step();
+	}
+
+	for( i = 0; i < SETTLE_TICKS; i++ )
+		step();
+
+	printf("sync_check/%s/frames %lu frames\n", sc->name, frames);
+	printf("sync_check/%s/lost %lu of %lu packets\n", sc->name,
+		   sim.stats.lost, sim.stats.sent);
+	printf("sync_check/%s/deltas %lu updates\n", sc->name, sim.sender.stats.deltas);
+	printf("sync_check/%s/keyframes %lu updates\n", sc->name, sim.sender.stats.keyframes);
+	printf("sync_check/%s/resent %lu updates\n", sc->name, sim.stats.resent);
+	printf("sync_check/%s/expired %lu acks\n", sc->name, sim.stats.expired);
+	printf("sync_check/%s/resyncs %lu resyncs\n", sc->name, sim.sender.stats.resyncs);
+
+	if( memcmp(&sim.sender.grid, &sim.receiver.grid, sizeof(osc_sync_grid_t)) ) {
+		printf("sync_check/%s the receiver's grid doesn't match the sender's\n", sc->name);
+		failed = 1;
+	}
+
+	/* nothing got lost or forgotten, so there's nothing to resync over */
+	if( !sc->loss && !sc->stall && !sc->restart && sim.sender.stats.resyncs ) {
+		printf("sync_check/%s resynced without losing anything\n", sc->name);
+		failed = 1;
+	}
+
+	if( (sc->want_resend  && !sim.stats.resent) ||
+		(sc->want_resync  && !sim.sender.stats.resyncs) ||
+		(sc->want_expired && !sim.stats.expired) ) {
+		printf("sync_check/%s didn't get as far as what it's checking\n", sc->name);
+		failed = 1;
+	}
+
+	return failed;
+}
+
+static void usage(const char *app) {
+	printf("usage: %s [options...]\n"
+		   "\n"
+		   "  -h, --help			display this information\n"
+		   "\n"
+		   "  -n, --frames <count>		frames per scenario (default %d)\n"
+		   "  -s, --seed <seed>		seed for the losses and delays\n"
+		   "\n", app, DEFAULT_FRAMES);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long frames = DEFAULT_FRAMES;
+	uint64_t seed = 0x6d6f6e6f6d65ULL;
+	int i, c, failed = 0;
+
+	struct option arguments[] = {
+		{"help",   no_argument,       0, 'h'},
+		{"frames", required_argument, 0, 'n'},
+		{"seed",   required_argument, 0, 's'},
+		{0, 0, 0, 0}
+	};
+
+	/*  name            key  loss delay stall restart  resend resync expired */
+	scenario_t scenarios[] = {
+		{"clean",        16,   0,   1,    0,  0,        0,     0,     0},
+		{"lossy",        16,  10,   1,    0,  0,        1,     0,     0},
+		{"reordered",    16,   0,   8,    0,  0,        0,     0,     0},
+		{"lossy_reorder",16,  20,   8,    0,  0,        1,     0,     0},
+		{"keyframes",     0,  20,   8,    0,  0,        1,     0,     0},
+		{"ack_stall",    16,   5,   4,  200,  0,        1,     0,     1},
+		{"restart",      16,   5,   4,    0,  1,        1,     1,     0},
+		{NULL}
+	};
+
+	while( (c = getopt_long(argc, argv, "hn:s:", arguments, NULL)) > 0 ) {
+		switch( c ) {
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+
+		case 'n':
+			frames = strtoul(optarg, NULL, 10);
+			break;
+
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if( !frames || !seed ) {
+		fprintf(stderr, "sync_check: need some frames and a non-zero seed\n");
+		return EXIT_FAILURE;
+	}
+
+	for( i = 0; scenarios[i].name; i++ )
+		failed |= run(&scenarios[i], frames, seed + i);
+
+	return (failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -74,6 +74,17 @@ cdef extern from "monome.h":
 	ctypedef char * const_char_p "const char *"
 	const_char_p monome_get_serial(monome_t *monome)
 	const_char_p monome_get_devpath(monome_t *monome)
+
+	ctypedef struct monome_device_info_t:
+		char serial[32]
+		char devpath[128]
+		const_char_p model
+		const_char_p proto
+		int rows
+		int cols
+
+	monome_t *monome_open_serial(char *serial, ...)
+	int monome_enumerate(monome_device_info_t *devices, int max)
 	int monome_get_rows(monome_t *monome)
 	int monome_get_cols(monome_t *monome)
 
@@ -83,6 +94,7 @@ cdef extern from "monome.h":
 	int monome_unregister_handler(monome_t *monome,
 			monome_event_type_t event_type)
 	void monome_event_loop(monome_t *monome)
+	void monome_set_busy_poll(monome_t *monome, uint idle_usec)
 	int monome_event_next(monome_t *monome, monome_event_t *event_buf)
 	int monome_event_handle_next(monome_t *monome)
 	int monome_get_fd(monome_t *monome)
@@ -96,6 +108,7 @@ cdef extern from "monome.h":
 	int monome_led_col(monome_t *monome, uint col, size_t count, uint8_t *data)
 	int monome_led_row(monome_t *monome, uint row, size_t count, uint8_t *data)
 	int monome_led_frame(monome_t *monome, uint quadrant, uint8_t *frame_data)
+	int monome_led_map(monome_t *monome, uint cols, uint rows, uint8_t *map_data)
 
 all = [
 	# constants
@@ -114,6 +127,10 @@ all = [
 	"CABLE_RIGHT",
 	"CABLE_TOP",
 
+	# functions
+
+	"enumerate_devices",
+
 	# classes
 
 	"MonomeEvent",
@@ -165,6 +182,29 @@ def _bitmap_data(data):
 			raise TypeError("'%s' object is neither iterable nor integer." % type(data).__name__)
 
 
+def enumerate_devices():
+	cdef monome_device_info_t devices[64]
+	cdef int i, n
+
+	n = monome_enumerate(devices, 64)
+
+	if n < 0:
+		raise IOError("Could not enumerate devices")
+
+	found = []
+
+	for i from 0 <= i < min(n, 64):
+		found.append({
+			"serial": devices[i].serial,
+			"devpath": devices[i].devpath,
+			"model": devices[i].model,
+			"protocol": devices[i].proto,
+			"rows": devices[i].rows,
+			"cols": devices[i].cols})
+
+	return found
+
+
 cdef class MonomeEvent(object):
 	pass
 
@@ -229,14 +269,19 @@ cdef class Monome(object):
 		"right": CABLE_RIGHT,
 		"top": CABLE_TOP}
 
-	def __init__(self, device, port=None, clear=True):
+	def __init__(self, device=None, port=None, clear=True, serial=None):
 		cdef char *portstr
 		cdef const_char_p ser
 
-		if device[:3] == "osc" and not port:
+		if not device and not serial:
+			raise TypeError("Need a device or a serial to open.")
+
+		if device and device[:3] == "osc" and not port:
 			raise TypeError("OSC protocol requires a server port.")
 
-		if port:
+		if serial:
+			self.monome = monome_open_serial(serial)
+		elif port:
 			port = str(port)
 			portstr = port
 
@@ -321,6 +366,9 @@ cdef class Monome(object):
 	def event_loop(self):
 		monome_event_loop(self.monome)
 
+	def set_busy_poll(self, uint idle_usec):
+		monome_set_busy_poll(self.monome, idle_usec)
+
 	def handle_next_event(self):
 		if monome_event_handle_next(self.monome):
 			return True
@@ -376,3 +424,30 @@ cdef class Monome(object):
 			pass 
 
 		monome_led_frame(self.monome, quadrant, r)
+
+	def led_map(self, rows, uint columns=16):
+		cdef uint8_t m[32]
+		cdef uint16_t d
+		cdef uint i, n, stride
+
+		stride = (columns + 7) / 8
+		rowiter = iter(rows)
+
+		for i from 0 <= i < 32:
+			m[i] = 0
+
+		n = 0
+
+		try:
+			while n < 16:
+				d = _bitmap_data(rowiter.next())
+				m[n * stride] = (<uint8_t *> &d)[0]
+
+				if stride > 1:
+					m[n * stride + 1] = (<uint8_t *> &d)[1]
+
+				n += 1
+		except StopIteration:
+			pass
+
+		monome_led_map(self.monome, columns, n, m)
@@ -69,9 +69,141 @@ typedef enum {
 	MONOME_CABLE_TOP     = 3
 } monome_cable_t;
 	
+/* command types, for indexing monome_stats_t.cmd */
+
+typedef enum {
+	MONOME_CMD_CLEAR     = 0,
+	MONOME_CMD_INTENSITY = 1,
+	MONOME_CMD_MODE      = 2,
+	MONOME_CMD_LED_ON    = 3,
+	MONOME_CMD_LED_OFF   = 4,
+	MONOME_CMD_LED_COL   = 5,
+	MONOME_CMD_LED_ROW   = 6,
+	MONOME_CMD_LED_FRAME = 7,
+	MONOME_CMD_LED_MAP   = 8,
+	MONOME_CMD_COUNT
+} monome_cmd_t;
+
+/* bucket i of a latency histogram counts samples under 2^i microseconds
+   (and at least 2^(i-1)), the last one catches everything longer */
+#define MONOME_STATS_BUCKETS 24
+
+/* log levels */
+
+typedef enum {
+	MONOME_LOG_DEBUG     = 0,
+	MONOME_LOG_INFO      = 1,
+	MONOME_LOG_WARNING   = 2,
+	MONOME_LOG_ERROR     = 3
+} monome_log_level_t;
+
+#define MONOME_LOG_ARGS    4
+#define MONOME_LOG_STRINGS 64
+
+/* capture records, see capture.c */
+
+typedef enum {
+	MONOME_CAPTURE_OPEN    = 0, /* first sight of a device, data is its serial */
+	MONOME_CAPTURE_READ    = 1, /* bytes from a device */
+	MONOME_CAPTURE_WRITE   = 2, /* bytes to a device */
+	MONOME_CAPTURE_OSC_IN  = 3, /* an OSC message received */
+	MONOME_CAPTURE_OSC_OUT = 4  /* an OSC message sent */
+} monome_capture_kind_t;
+
+#define MONOME_CAPTURE_MAGIC   "monocap"
+#define MONOME_CAPTURE_VERSION 1
+
+/* records are 8-byte aligned, the data after each one is padded out */
+#define MONOME_CAPTURE_PAD(len) (((len) + 7) & ~7)
+
+/* flags for monome_open_many */
+#define MONOME_OPEN_CLEAR  0x1  /* clear each device once it's open */
+
+/* sizes of the strings in monome_device_info_t, including the nul */
+#define MONOME_SERIAL_MAX  32
+#define MONOME_DEVPATH_MAX 128
+
 typedef struct monome_event monome_event_t;
+typedef struct monome_device_info monome_device_info_t;
+typedef struct monome_open_request monome_open_request_t;
+typedef struct monome_stats monome_stats_t;
+typedef struct monome_log_entry monome_log_entry_t;
+typedef struct monome_capture_header monome_capture_header_t;
+typedef struct monome_capture_record monome_capture_record_t;
 typedef struct monome monome_t; /* opaque data type */
 
+struct monome_stats {
+	struct {
+		uint64_t msgs;
+		uint64_t bytes;
+	} cmd[MONOME_CMD_COUNT];
+
+	uint64_t writes;          /* write() calls */
+	uint64_t short_writes;
+	uint64_t eagain;
+	uint64_t write_wait_usec; /* blocked in select() and tcdrain() */
+
+	uint64_t events;          /* complete messages read from the device */
+	uint64_t parse_errors;
+
+	uint64_t write_latency[MONOME_STATS_BUCKETS];
+	uint64_t dispatch_latency[MONOME_STATS_BUCKETS];
+};
+
+/* one message, as it was logged.  fmt is the caller's format string,
+   args and strings are its arguments in order (see log.c). */
+struct monome_log_entry {
+	uint64_t time;            /* nanoseconds, CLOCK_MONOTONIC */
+	monome_log_level_t level;
+	int code;                 /* an errno, or 0 */
+	const char *fmt;
+
+	int64_t args[MONOME_LOG_ARGS];
+	char strings[MONOME_LOG_STRINGS];
+
+	uint suppressed;          /* identical ones dropped before this */
+};
+
+/* a capture file is one of these, then records until the end */
+struct monome_capture_header {
+	char magic[8];            /* MONOME_CAPTURE_MAGIC */
+	uint32_t version;
+	uint32_t record_size;     /* sizeof(monome_capture_record_t) */
+	uint64_t started;         /* nanoseconds, CLOCK_REALTIME */
+	uint64_t base;            /* nanoseconds, CLOCK_MONOTONIC */
+};
+
+struct monome_capture_record {
+	uint64_t time;            /* nanoseconds since the header's base */
+	uint32_t len;             /* of the data that follows, before padding */
+	uint16_t stream;          /* which device, 0 for OSC */
+	uint8_t kind;             /* a monome_capture_kind_t */
+	uint8_t reserved;
+};
+
+/* an attached grid, as monome_enumerate finds it */
+struct monome_device_info {
+	char serial[MONOME_SERIAL_MAX];
+	char devpath[MONOME_DEVPATH_MAX];
+	const char *model;        /* "monome 256" and so on */
+	const char *proto;        /* which protocol module drives it */
+	int rows;
+	int cols;
+};
+
+/* one device for monome_open_many.  dev, and port for OSC devices (it can
+   be NULL otherwise), go in.  monome comes back, or NULL and an errno in
+   error if it couldn't be opened. */
+struct monome_open_request {
+	const char *dev;
+	const char *port;
+	monome_t *monome;
+	int error;
+};
+
+typedef void (*monome_log_drain_t)
+	(const monome_log_entry_t *entry, void *data);
+
 typedef void (*monome_event_callback_t)
 	(const monome_event_t *event, void *data);
 
@@ -83,6 +215,10 @@ struct monome_event {
 };
 
 monome_t *monome_open(const char *monome_device, ...);
+monome_t *monome_open_serial(const char *serial, ...);
+int monome_enumerate(monome_device_info_t *devices, int max);
+int monome_open_many(monome_open_request_t *requests, int count,
+                     int threads, int flags);
 void monome_close(monome_t *monome);
 
 void monome_set_orientation(monome_t *monome, monome_cable_t cable);
@@ -90,6 +226,7 @@ monome_cable_t monome_get_orientation(monome_t *monome);
 
 const char *monome_get_serial(monome_t *monome);
 const char *monome_get_devpath(monome_t *monome);
+const char *monome_get_proto(monome_t *monome);
 int monome_get_rows(monome_t *monome);
 int monome_get_cols(monome_t *monome);
 
@@ -100,8 +237,38 @@ int monome_unregister_handler(monome_t *monome,
 int monome_event_next(monome_t *monome, monome_event_t *event_buf);
 int monome_event_handle_next(monome_t *monome);
 void monome_event_loop(monome_t *monome);
+void monome_set_busy_poll(monome_t *monome, uint idle_usec);
 int monome_get_fd(monome_t *monome);
 
+void monome_get_stats(monome_t *monome, monome_stats_t *stats);
+void monome_reset_stats(monome_t *monome);
+
+/* mem:// devices have no fd, see loopback.c */
+ssize_t monome_mem_inject(monome_t *monome, const uint8_t *buf, size_t len);
+ssize_t monome_mem_drain(monome_t *monome, uint8_t *buf, size_t len);
+
+/* tracing is process-wide rather than per device, see trace.c */
+int monome_trace_start(size_t events);
+void monome_trace_stop();
+int monome_trace_dump(const char *path);
+void monome_trace_thread(const char *name);
+uint64_t monome_trace_begin();
+void monome_trace_end(const char *name, uint64_t begin, int64_t arg);
+
+void monome_log(monome_log_level_t level, int code, const char *fmt, ...);
+size_t monome_log_format(const monome_log_entry_t *entry, char *buf,
+						 size_t len);
+void monome_log_set_drain(monome_log_drain_t drain, void *data);
+int monome_log_flush();
+int monome_log_start_thread();
+
+/* capture is process-wide too, see capture.c */
+int monome_capture_start(const char *path);
+void monome_capture_stop();
+int monome_capture_active();
+void monome_capture(monome_capture_kind_t kind, uint stream,
+					const void *buf, size_t len);
+
 int monome_clear(monome_t *monome, monome_clear_status_t status);
 int monome_intensity(monome_t *monome, uint brightness);
 int monome_mode(monome_t *monome, monome_mode_t mode);
@@ -114,6 +281,8 @@ int monome_led_row(monome_t *monome, uint row, size_t count,
 				   const uint8_t *row_data);
 int monome_led_frame(monome_t *monome, uint quadrant,
 					 const uint8_t *frame_data);
+int monome_led_map(monome_t *monome, uint cols, uint rows,
+				   const uint8_t *map_data);
 
 #ifdef __cplusplus
 } /* extern "C" */
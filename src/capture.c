@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "capture.h"
+#include "stats.h"
+
+/* every byte that goes to or comes from a device (and whatever OSC
+   monomeserial hands us), timestamped, so a session can be replayed
+   later (see bench/replay.c).
+
+   the file is a monome_capture_header_t and then records, appended and
+   never rewritten.  everything is 8-byte aligned and in the machine's
+   own byte order, so a reader can mmap the lot and walk it.
+
+   records get copied into one of two buffers under a lock.  when it
+   fills up it's handed to a writer thread and the other one takes over,
+   so whoever's capturing (often monomeserial's realtime device thread)
+   never waits on the disk.  if the writer still hasn't finished with
+   the other buffer by then, records are dropped and counted instead.
+   what's left gets written out when capture stops, and at exit.
+
+   set MONOME_CAPTURE to a path (a %d or %p in it becomes the pid) to
+   capture from the first monome_open() on. */
+
+#define CAPTURE_BUFFER 65536
+
+int monome_capturing;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t wake; /* there's a full buffer for the writer */
+	pthread_cond_t idle; /* and it's done with it */
+	int fd;
+
+	/* bumped on every start, so devices know to announce themselves
+	   again in the new file */
+	uint generation;
+	uint64_t base;
+
+	uint8_t *buf;
+	size_t used;
+
+	/* with the writer, NULL once it's been written */
+	uint8_t *full;
+	size_t full_used;
+
+	int writer;
+	unsigned long dropped;
+
+	uint8_t bufs[2][CAPTURE_BUFFER];
+} cap = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+		 PTHREAD_COND_INITIALIZER, -1, 0, 0, NULL};
+
+static pthread_once_t env_once = PTHREAD_ONCE_INIT;
+
+/**
+ * private
+ */
+
+static int write_all(int fd, const void *data, size_t len) {
+	const uint8_t *buf = data;
+	ssize_t ret;
+
+	for( ; len; buf += ret, len -= ret )
+		if( (ret = write(fd, buf, len)) < 0 ) {
+			if( errno == EINTR ) {
+				ret = 0;
+				continue;
+			}
+
+			return -1;
+		}
+
+	return 0;
+}
+
+static void *writer_thread(void *arg) {
+	uint8_t *buf;
+	size_t len;
+	int fd;
+
+	pthread_mutex_lock(&cap.lock);
+
+	for( ;; ) {
+		while( !cap.full )
+			pthread_cond_wait(&cap.wake, &cap.lock);
+
+		buf = cap.full;
+		len = cap.full_used;
+		fd  = cap.fd;
+
+		pthread_mutex_unlock(&cap.lock);
+
+		if( fd >= 0 && write_all(fd, buf, len) )
+			perror("libmonome: couldn't write capture");
+
+		pthread_mutex_lock(&cap.lock);
+
+		cap.full = NULL;
+		pthread_cond_broadcast(&cap.idle);
+	}
+
+	return NULL;
+}
+
+/* call with the lock held.  this one does wait for the disk, it's only
+   for starting, stopping and exiting. */
+static void flush() {
+	while( cap.full )
+		pthread_cond_wait(&cap.idle, &cap.lock);
+
+	if( cap.fd >= 0 && cap.used && write_all(cap.fd, cap.buf, cap.used) )
+		perror("libmonome: couldn't write capture");
+
+	cap.used = 0;
+
+	if( cap.dropped ) {
+		fprintf(stderr, "libmonome: capture dropped %lu records, "
+				"the disk couldn't keep up\n", cap.dropped);
+		cap.dropped = 0;
+	}
+}
+
+static void flush_at_exit() {
+	pthread_mutex_lock(&cap.lock);
+	flush();
+	pthread_mutex_unlock(&cap.lock);
+}
+
+/* the path with every %d or %p swapped for the pid, and nothing else
+   about it interpreted */
+static char *expand_path(const char *env) {
+	char pid[16], *path, *p;
+	size_t len, count;
+	const char *c;
+
+	len = snprintf(pid, sizeof(pid), "%d", getpid());
+
+	for( c = env, count = 0; *c; c++ )
+		if( c[0] == '%' && (c[1] == 'd' || c[1] == 'p') )
+			count++;
+
+	if( !(path = malloc(strlen(env) + count * len + 1)) )
+		return NULL;
+
+	for( c = env, p = path; *c; c++ )
+		if( c[0] == '%' && (c[1] == 'd' || c[1] == 'p') ) {
+			p = stpcpy(p, pid);
+			c++;
+		} else
+			*p++ = *c;
+
+	*p = '\0';
+	return path;
+}
+
+static void start_from_env() {
+	char *path, *env;
+
+	if( !(env = getenv("MONOME_CAPTURE")) || !*env )
+		return;
+
+	if( !(path = expand_path(env)) )
+		return;
+
+	if( monome_capture_start(path) )
+		fprintf(stderr, "libmonome: couldn't start capturing to %s\n", path);
+
+	free(path);
+}
+
+/**
+ * internal
+ */
+
+void monome_capture_from_env() {
+	pthread_once(&env_once, start_from_env);
+}
+
+void monome_capture_device(monome_t *monome, monome_capture_kind_t kind,
+						   const uint8_t *buf, size_t len) {
+	uint generation = __atomic_load_n(&cap.generation, __ATOMIC_RELAXED);
+	const char *serial;
+
+	if( monome->capture_gen != generation ) {
+		monome->capture_gen = generation;
+		serial = (monome->serial) ? monome->serial : "";
+
+		monome_capture(MONOME_CAPTURE_OPEN, monome->stream, serial, strlen(serial));
+	}
+
+	monome_capture(kind, monome->stream, buf, len);
+}
+
+/**
+ * public
+ */
+
+int monome_capture_start(const char *path) {
+	monome_capture_header_t header;
+	static int registered = 0;
+	struct timespec ts;
+	pthread_t thread;
+	int fd;
+
+	if( (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0 )
+		return -1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MONOME_CAPTURE_MAGIC, sizeof(MONOME_CAPTURE_MAGIC));
+
+	header.version     = MONOME_CAPTURE_VERSION;
+	header.record_size = sizeof(monome_capture_record_t);
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	header.started     = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	header.base        = stats_now_ns();
+
+	pthread_mutex_lock(&cap.lock);
+
+	if( !cap.writer ) {
+		if( pthread_create(&thread, NULL, writer_thread, NULL) ) {
+			pthread_mutex_unlock(&cap.lock);
+			close(fd);
+			return -1;
+		}
+
+		pthread_detach(thread);
+		cap.writer = 1;
+		cap.buf    = cap.bufs[0];
+	}
+
+	flush();
+
+	if( cap.fd >= 0 )
+		close(cap.fd);
+
+	cap.fd   = fd;
+	cap.base = header.base;
+	cap.generation++;
+
+	if( write_all(fd, &header, sizeof(header)) ) {
+		close(fd);
+		cap.fd = -1;
+		pthread_mutex_unlock(&cap.lock);
+		return -1;
+	}
+
+	if( !registered++ )
+		atexit(flush_at_exit);
+
+	__atomic_store_n(&monome_capturing, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&cap.lock);
+
+	return 0;
+}
+
+void monome_capture_stop() {
+	__atomic_store_n(&monome_capturing, 0, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&cap.lock);
+
+	flush();
+
+	if( cap.fd >= 0 )
+		close(cap.fd);
+
+	cap.fd = -1;
+	pthread_mutex_unlock(&cap.lock);
+}
+
+int monome_capture_active() {
+	monome_capture_from_env();
+	return __atomic_load_n(&monome_capturing, __ATOMIC_RELAXED);
+}
+
+/* stream 0 is for OSC, devices are numbered from 1 as they're opened */
+void monome_capture(monome_capture_kind_t kind, uint stream,
+					const void *buf, size_t len) {
+	monome_capture_record_t rec;
+	size_t size = sizeof(rec) + MONOME_CAPTURE_PAD(len);
+
+	if( !__atomic_load_n(&monome_capturing, __ATOMIC_RELAXED) )
+		return;
+
+	rec.len      = len;
+	rec.stream   = stream;
+	rec.kind     = kind;
+	rec.reserved = 0;
+
+	pthread_mutex_lock(&cap.lock);
+
+	if( cap.fd < 0 )
+		goto out;
+
+	rec.time = stats_now_ns() - cap.base;
+
+	if( size > CAPTURE_BUFFER ) {
+		cap.dropped++;
+		goto out;
+	}
+
+	if( cap.used + size > CAPTURE_BUFFER ) {
+		/* the writer's still busy with the last one */
+		if( cap.full ) {
+			cap.dropped++;
+			goto out;
+		}
+
+		cap.full      = cap.buf;
+		cap.full_used = cap.used;
+		pthread_cond_signal(&cap.wake);
+
+		cap.buf  = (cap.buf == cap.bufs[0]) ? cap.bufs[1] : cap.bufs[0];
+		cap.used = 0;
+	}
+
+	memcpy(cap.buf + cap.used, &rec, sizeof(rec));
+	memcpy(cap.buf + cap.used + sizeof(rec), buf, len);
+	memset(cap.buf + cap.used + sizeof(rec) + len, 0, size - sizeof(rec) - len);
+	cap.used += size;
+
+out:
+	pthread_mutex_unlock(&cap.lock);
+}
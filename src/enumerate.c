@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* what's plugged in, and what each thing is.
+
+   the index is every grid the last scan found, by serial, along with the
+   inode and device number of its tty.  replugging gets a new node, so a
+   stat() is enough to tell whether an entry still holds, and only a miss
+   (or a stale entry) costs a scan. */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "enumerate.h"
+#include "platform.h"
+
+#define MAX_INDEXED 64
+
+typedef struct {
+	char serial[MONOME_SERIAL_MAX];
+	char devpath[MONOME_DEVPATH_MAX];
+	monome_devmap_t *m;
+
+	ino_t ino;
+	dev_t rdev;
+} index_entry_t;
+
+typedef struct {
+	const char *dev;
+	char *serial;
+} env_match_t;
+
+static monome_devmap_t mapping[] = {
+	{"m256-%d", "series", {16, 16}, "monome 256"},
+	{"m128-%d", "series", {16, 8},  "monome 128"},
+	{"m64-%d",  "series", {8, 8},   "monome 64" },
+	{"m40h%d",  "40h",    {8, 8},   "monome 40h"},
+	{"a40h-%d", "40h",    {8, 8},   "arduinome" },
+	{NULL}
+};
+
+static index_entry_t devices[MAX_INDEXED];
+static int ndevices;
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * private
+ */
+
+/* MONOME_SERIAL=path=serial[,path=serial...] stands in for asking the
+   platform, which only knows how to find the serial of a real FTDI
+   device.  it's how the emulator in bench/ passes for a monome. */
+static void env_devices(monome_platform_found_t found, void *data) {
+	char devpath[MONOME_DEVPATH_MAX], serial[MONOME_SERIAL_MAX];
+	const char *env, *p, *eq, *end;
+	size_t len;
+
+	if( !(env = getenv("MONOME_SERIAL")) )
+		return;
+
+	for( p = env; p; p = (end) ? end + 1 : NULL ) {
+		end = strchr(p, ',');
+
+		if( !(eq = strchr(p, '=')) || (end && eq > end) )
+			continue;
+
+		len = ((end) ? end : eq + strlen(eq)) - eq - 1;
+
+		if( eq - p >= sizeof(devpath) || len >= sizeof(serial) )
+			continue;
+
+		memcpy(devpath, p, eq - p);
+		devpath[eq - p] = 0;
+		memcpy(serial, eq + 1, len);
+		serial[len] = 0;
+
+		found(devpath, serial, data);
+	}
+}
+
+static void match_env(const char *devpath, const char *serial, void *data) {
+	env_match_t *match = data;
+
+	if( !match->serial && !strcmp(devpath, match->dev) )
+		match->serial = strdup(serial);
+}
+
+static void index_device(const char *devpath, const char *serial, void *data) {
+	index_entry_t *e = &devices[ndevices];
+	monome_devmap_t *m;
+	struct stat st;
+	int i;
+
+	if( ndevices >= MAX_INDEXED || !(m = monome_map_serial(serial)) ||
+		strlen(serial) >= sizeof(e->serial) ||
+		strlen(devpath) >= sizeof(e->devpath) ||
+		stat(devpath, &st) )
+		return;
+
+	/* the environment gets first say over a path */
+	for( i = 0; i < ndevices; i++ )
+		if( !strcmp(devices[i].devpath, devpath) )
+			return;
+
+	strcpy(e->serial, serial);
+	strcpy(e->devpath, devpath);
+	e->m    = m;
+	e->ino  = st.st_ino;
+	e->rdev = st.st_rdev;
+
+	ndevices++;
+}
+
+/* call with index_lock held */
+static int rescan() {
+	ndevices = 0;
+
+	env_devices(index_device, NULL);
+	return monome_platform_enumerate(index_device, NULL);
+}
+
+static index_entry_t *find(const char *serial) {
+	struct stat st;
+	int i;
+
+	for( i = 0; i < ndevices; i++ )
+		if( !strcmp(devices[i].serial, serial) ) {
+			if( stat(devices[i].devpath, &st) ||
+				st.st_ino != devices[i].ino || st.st_rdev != devices[i].rdev )
+				return NULL;
+
+			return &devices[i];
+		}
+
+	return NULL;
+}
+
+/**
+ * internal
+ */
+
+monome_devmap_t *monome_map_serial(const char *serial) {
+	monome_devmap_t *m;
+	int serialnum;
+
+	for( m = mapping; m->sermatch; m++ )
+		if( sscanf(serial, m->sermatch, &serialnum) )
+			return m;
+
+	return NULL;
+}
+
+char *monome_get_dev_serial(const char *dev) {
+	env_match_t match = {dev, NULL};
+
+	env_devices(match_env, &match);
+
+	if( match.serial )
+		return match.serial;
+
+	return monome_platform_get_dev_serial(dev);
+}
+
+int monome_index_lookup(const char *serial, char *devpath, size_t len,
+                        monome_devmap_t **m) {
+	index_entry_t *e;
+	int ret = -1;
+
+	pthread_mutex_lock(&index_lock);
+
+	if( !(e = find(serial)) ) {
+		rescan();
+		e = find(serial);
+	}
+
+	if( e && strlen(e->devpath) < len ) {
+		strcpy(devpath, e->devpath);
+		*m  = e->m;
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&index_lock);
+	return ret;
+}
+
+void monome_index_forget(const char *serial) {
+	int i;
+
+	pthread_mutex_lock(&index_lock);
+
+	for( i = 0; i < ndevices; i++ )
+		if( !strcmp(devices[i].serial, serial) ) {
+			devices[i] = devices[--ndevices];
+			break;
+		}
+
+	pthread_mutex_unlock(&index_lock);
+}
+
+/**
+ * public
+ */
+
+/* fills in up to max of them, and returns how many grids there are (or
+   -1 if the platform couldn't look), same as snprintf does. */
+int monome_enumerate(monome_device_info_t *info, int max) {
+	int i, n;
+
+	pthread_mutex_lock(&index_lock);
+
+	if( rescan() ) {
+		pthread_mutex_unlock(&index_lock);
+		return -1;
+	}
+
+	for( i = 0; i < ndevices && i < max; i++ ) {
+		strcpy(info[i].serial, devices[i].serial);
+		strcpy(info[i].devpath, devices[i].devpath);
+
+		info[i].model = devices[i].m->friendly;
+		info[i].proto = devices[i].m->proto;
+		info[i].rows  = devices[i].m->dimensions.rows;
+		info[i].cols  = devices[i].m->dimensions.cols;
+	}
+
+	n = ndevices;
+	pthread_mutex_unlock(&index_lock);
+
+	return n;
+}
@@ -32,6 +32,7 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -40,8 +41,14 @@
 
 #include <monome.h>
 #include "internal.h"
+#include "capture.h"
+#include "enumerate.h"
+#include "loopback.h"
 #include "platform.h"
+#include "probes.h"
 #include "rotation.h"
+#include "stats.h"
+#include "trace.h"
 
 #ifndef LIBSUFFIX
 #define LIBSUFFIX ".so"
@@ -51,44 +58,83 @@
 #define LIBDIR "/usr/lib"
 #endif
 
-#define DEFAULT_MODEL    MONOME_DEVICE_40h
 #define DEFAULT_PROTOCOL "40h"
 
-static monome_devmap_t mapping[] = {
-	{"m256-%d", "series", {16, 16}, "monome 256"},
-	{"m128-%d", "series", {16, 8},  "monome 128"},
-	{"m64-%d",  "series", {8, 8},   "monome 64" },
-	{"m40h%d",  "40h",    {8, 8},   "monome 40h"},
-	{"a40h-%d", "40h",    {8, 8},   "arduinome" },
-	{NULL}
-};
+/* numbers devices for captures, 0 is OSC */
+static uint next_stream;
+
+/* protocol modules stay loaded once something has used them, rather
+   than being dlopen()ed (and never dlclose()d) on every monome_open. */
+#define MAX_PROTOCOL_MODULES 8
+
+typedef monome_t *(*monome_protocol_new_t)();
+
+static struct {
+	char name[32];
+	monome_protocol_new_t protocol_new;
+} modules[MAX_PROTOCOL_MODULES];
+
+static int nmodules;
+static pthread_mutex_t modules_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * private
  */
 
-static monome_devmap_t *map_serial_to_device(const char *serial) {
-	monome_devmap_t *m;
-	int serialnum;
+static const char *cmd_names[MONOME_CMD_COUNT] = {
+	"clear", "intensity", "mode", "led_on", "led_off",
+	"led_col", "led_row", "led_frame", "led_map"
+};
 
-	for( m = mapping; m->sermatch; m++ )
-		if( sscanf(serial, m->sermatch, &serialnum) )
-			return m;
+/* counts the command and tags any bytes written until the next one.
+   returns when it started, for end_cmd. */
+static uint64_t begin_cmd(monome_t *monome, monome_cmd_t cmd) {
+	monome->cmd = cmd;
+	stats_add(&monome->stats.cmd[cmd].msgs, 1);
 
-	return NULL;
+	return monome_trace_begin();
 }
 
-/**
- * public
- */
+static int end_cmd(monome_t *monome, uint64_t begin, int ret) {
+	monome_trace_end(cmd_names[monome->cmd], begin, ret);
+	return ret;
+}
 
-monome_t *monome_init(const char *proto) {
+/* dispatch latency runs from when we started reading the event to when
+   its handler returns */
+static int dispatch(monome_t *monome, monome_event_t *e, uint64_t start) {
+	monome_callback_t *handler = &monome->handlers[e->event_type];
+	uint64_t called, end;
+
+	if( !handler->cb )
+		return 0;
+
+	called = stats_now_ns();
+
+	PROBE3(dispatch_entry, e->event_type, e->x, e->y);
+	handler->cb(e, handler->data);
+	PROBE3(dispatch_return, e->event_type, e->x, e->y);
+
+	end = stats_now_ns();
+
+	stats_record(monome->stats.dispatch_latency, (end - start) / 1000);
+	trace_span("callback", called, end, e->event_type);
+
+	return 1;
+}
+
+static monome_protocol_new_t load_protocol(const char *proto) {
 	void *protocol_lib;
-	monome_t *(*monome_protocol_new)();
-	monome_t *monome;
+	monome_protocol_new_t monome_protocol_new;
+	const char *dir;
 	char *buf;
-	
-	if( asprintf(&buf, "%s/monome/protocol_%s%s", LIBDIR, proto, LIBSUFFIX) < 0 )
+
+	/* so something that hasn't been installed yet (the benchmarks, say)
+	   can use the modules out of the build tree */
+	if( !(dir = getenv("MONOME_PROTOCOL_DIR")) )
+		dir = LIBDIR "/monome";
+
+	if( asprintf(&buf, "%s/protocol_%s%s", dir, proto, LIBSUFFIX) < 0 )
 		return NULL;
 
 	protocol_lib = dlopen(buf, RTLD_NOW);
@@ -106,36 +152,132 @@ monome_t *monome_init(const char *proto) {
 		fprintf(stderr, "couldn't initialize monome protocol module. dlopen said:\n\t%s\n\n"
 				"please make sure you're using a valid protocol library!\n"
 				"if this is a protocol library you wrote, make sure you're providing a \e[1mmonome_protocol_new\e[0m function.\n", dlerror());
+		dlclose(protocol_lib);
 		return NULL;
 	}
-	
-	monome = (*monome_protocol_new)();
-	
-	if( !monome )
+
+	return monome_protocol_new;
+}
+
+static monome_protocol_new_t get_protocol(const char *proto) {
+	monome_protocol_new_t protocol_new = NULL;
+	int i;
+
+	pthread_mutex_lock(&modules_lock);
+
+	for( i = 0; i < nmodules; i++ )
+		if( !strcmp(modules[i].name, proto) ) {
+			protocol_new = modules[i].protocol_new;
+			goto out;
+		}
+
+	if( !(protocol_new = load_protocol(proto)) )
+		goto out;
+
+	/* if the table's full it just doesn't get remembered, dlopen() hands
+	   back the same handle next time anyway */
+	if( nmodules < MAX_PROTOCOL_MODULES && strlen(proto) < sizeof(modules[0].name) ) {
+		strcpy(modules[nmodules].name, proto);
+		modules[nmodules++].protocol_new = protocol_new;
+	}
+
+out:
+	pthread_mutex_unlock(&modules_lock);
+	return protocol_new;
+}
+
+/**
+ * public
+ */
+
+monome_t *monome_init(const char *proto) {
+	monome_protocol_new_t monome_protocol_new;
+
+	if( !(monome_protocol_new = get_protocol(proto)) )
 		return NULL;
 
+	return (*monome_protocol_new)();
+}
+
+/* takes serial, which is NULL for OSC devices (the module fills it in
+   itself), and m, which is NULL if we don't know what the device is */
+static monome_t *open_device(const char *dev, char *serial, monome_devmap_t *m,
+                             const char *proto, va_list args) {
+	monome_t *monome;
+
+	monome_capture_from_env();
+
+	if( !(monome = monome_init(proto)) )
+		goto err_init;
+
+	if( monome->open(monome, dev, args) )
+		goto err_open;
+
+	/* if we have a physical device, make sure we've got the device and
+	   serial in the structure.  the OSC device will have this populated
+	   by now.
+	 
+	   TODO: make the OSC protocol get this stuff over the network */
+	if( m ) {
+		monome->rows = m->dimensions.rows;
+		monome->cols = m->dimensions.cols;
+	}
+
+	if( serial )
+		monome->serial = serial;
+
+	if( !(monome->device = strdup(dev)) )
+		goto err_device;
+
+	monome->proto = proto;
+
+	monome->orientation = MONOME_CABLE_LEFT;
+	monome->stream = __atomic_add_fetch(&next_stream, 1, __ATOMIC_RELAXED);
+
 	return monome;
+
+err_device:
+	monome->close(monome);
+
+err_open:
+	monome->free(monome);
+
+err_init:
+	if( serial ) free(serial);
+	return NULL;
 }
 
 monome_t *monome_open(const char *dev, ...) {
 	monome_t *monome;
-	monome_devmap_t *m;
+	monome_devmap_t *m = NULL;
 
 	va_list arguments;
-	char *serial, *proto;
-	int error;
+	char *serial = NULL;
+	const char *proto;
 
 	assert(dev);
 
 	/* first let's figure out which protocol to use */
-	if( *dev == '/' ) {
+	if( IS_MEM_DEVICE(dev) ) {
+		/* an in-memory device, named by the serial it's pretending to
+		   have.  it has to be one we know the size of. */
+		if( !(serial = monome_mem_get_serial(dev)) )
+			return NULL;
+
+		if( !(m = monome_map_serial(serial)) ) {
+			free(serial);
+			return NULL;
+		}
+
+		proto = m->proto;
+	} else if( *dev == '/' ) {
 		/* assume that the device is a tty...let's probe and see what device
 		   we're dealing with */
 
-		if( !(serial = monome_platform_get_dev_serial(dev)) )
+		if( !(serial = monome_get_dev_serial(dev)) )
 			return NULL;
 
-		if( (m = map_serial_to_device(serial)) )
+		if( (m = monome_map_serial(serial)) )
 			proto = m->proto;
 		else
 			proto = DEFAULT_PROTOCOL;
@@ -146,39 +288,39 @@ monome_t *monome_open(const char *dev, ...) {
 		   to think about. */
 		proto = "osc";
 
-	if( !(monome = monome_init(proto)) )
-		goto err_init;
-
 	va_start(arguments, dev);
-	error = monome->open(monome, dev, arguments);
+	monome = open_device(dev, serial, m, proto, arguments);
 	va_end(arguments);
 
-	if( error )
-		goto err_open;
+	return monome;
+}
 
-	/* if we have a physical device, make sure we've got the device and
-	   serial in the structure.  the OSC device will have this populated
-	   by now.
-	 
-	   TODO: make the OSC protocol get this stuff over the network */
-	if( *dev == '/' ) {
-		monome->rows   = m->dimensions.rows;
-		monome->cols   = m->dimensions.cols;
-		monome->serial = serial;
-	}
+/* opens whatever grid has this serial, wherever it's plugged in.  the
+   index in enumerate.c knows where that is without asking the platform,
+   unless the device has moved since it last looked. */
+monome_t *monome_open_serial(const char *serial, ...) {
+	char devpath[MONOME_DEVPATH_MAX], *copy;
+	monome_devmap_t *m;
+	monome_t *monome;
+	va_list arguments;
 
-	if( !(monome->device = strdup(dev)) )
-		goto err_open;
+	assert(serial);
 
-	monome->orientation = MONOME_CABLE_LEFT;
-	return monome;
+	if( monome_index_lookup(serial, devpath, sizeof(devpath), &m) )
+		return NULL;
 
-err_open:
-	monome->free(monome);
+	if( !(copy = strdup(serial)) )
+		return NULL;
 
-err_init:
-	if( serial ) free(serial);
-	return NULL;
+	va_start(arguments, serial);
+	monome = open_device(devpath, copy, m, m->proto, arguments);
+	va_end(arguments);
+
+	/* so the next try looks again */
+	if( !monome )
+		monome_index_forget(serial);
+
+	return monome;
 }
 
 void monome_close(monome_t *monome) {
@@ -203,6 +345,11 @@ const char *monome_get_devpath(monome_t *monome) {
 	return monome->device;
 }
 
+/* "series", "40h" or "osc", whichever module ended up driving it */
+const char *monome_get_proto(monome_t *monome) {
+	return monome->proto;
+}
+
 int monome_get_rows(monome_t *monome) {
 	if( ORIENTATION(monome).flags & ROW_COL_SWAP )
 		return monome->cols;
@@ -245,89 +392,173 @@ int monome_unregister_handler(monome_t *monome,
 }
 
 int monome_event_next(monome_t *monome, monome_event_t *e) {
+	uint64_t begin = monome_trace_begin();
+
 	e->monome = monome;
 
 	if( !monome->next_event(monome, e) )
 		return 0;
+
+	stats_add(&monome->stats.events, 1);
+	monome_trace_end("read", begin, e->event_type);
+
 	return 1;
 }
 
 int monome_event_handle_next(monome_t *monome) {
-	monome_callback_t *handler;
+	uint64_t start = stats_now_ns();
 	monome_event_t e;
 
 	if( !monome_event_next(monome, &e) )
 		return 0;
 
-	handler = &monome->handlers[e.event_type];
-
-	if( !handler->cb )
-		return 0;
-
-	handler->cb(&e, handler->data);
-	return 1;
+	return dispatch(monome, &e, start);
 }
 
 void monome_event_loop(monome_t *monome) {
-	monome_callback_t *handler;
 	monome_event_t e;
+	uint64_t start, last = 0;
 
 	fd_set fds;
 
-	e.monome = monome;
-
 	do {
+		/* in busy-poll mode, keep trying non-blocking reads until nothing
+		   has come in for a while.  it costs a core, but a press gets
+		   handled the moment it arrives instead of whenever the scheduler
+		   gets around to waking us up. */
+		if( monome->busy_poll ) {
+			start = stats_now_ns();
+
+			if( monome_event_next(monome, &e) ) {
+				last = start;
+				dispatch(monome, &e, start);
+				continue;
+			}
+
+			if( start - last < monome->busy_poll * 1000ULL )
+				continue;
+		}
+
 		FD_ZERO(&fds);
 		FD_SET(monome->fd, &fds);
 
+		start = monome_trace_begin();
+
 		if( select(monome->fd + 1, &fds, NULL, NULL, NULL) < 0 ) {
-			perror("libmonome: error in select()");
+			monome_log(MONOME_LOG_ERROR, errno, "libmonome: error in select()");
 			break;
 		}
 
-		if( !monome->next_event(monome, &e) )
-			continue;
+		monome_trace_end("select", start, monome->fd);
 
-		handler = &monome->handlers[e.event_type];
-		if( !handler->cb )
-			continue;
+		last = start = stats_now_ns();
 
-		handler->cb(&e, handler->data);
+		if( monome_event_next(monome, &e) )
+			dispatch(monome, &e, start);
 	} while( 1 );
 }
 
+/* 0 turns busy polling off (the default) */
+void monome_set_busy_poll(monome_t *monome, uint idle_usec) {
+	monome->busy_poll = idle_usec;
+}
+
 int monome_get_fd(monome_t *monome) {
 	return monome->fd;
 }
 
+/* a snapshot, each counter read on its own.  cheap enough to call as
+   often as you like, but don't expect the counters to add up exactly
+   if the device is busy while you're reading them. */
+void monome_get_stats(monome_t *monome, monome_stats_t *stats) {
+	uint64_t *src = (uint64_t *) &monome->stats, *dst = (uint64_t *) stats;
+	uint i;
+
+	for( i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++ )
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+void monome_reset_stats(monome_t *monome) {
+	uint64_t *c = (uint64_t *) &monome->stats;
+	uint i;
+
+	for( i = 0; i < sizeof(monome->stats) / sizeof(uint64_t); i++ )
+		__atomic_store_n(&c[i], 0, __ATOMIC_RELAXED);
+}
+
 int monome_clear(monome_t *monome, monome_clear_status_t status) {
-	return monome->clear(monome, status);
+	uint64_t begin = begin_cmd(monome, MONOME_CMD_CLEAR);
+	return end_cmd(monome, begin, monome->clear(monome, status));
 }
 
 int monome_intensity(monome_t *monome, uint brightness) {
-	return monome->intensity(monome, brightness);
+	uint64_t begin = begin_cmd(monome, MONOME_CMD_INTENSITY);
+	return end_cmd(monome, begin, monome->intensity(monome, brightness));
 }
 
 int monome_mode(monome_t *monome, monome_mode_t mode) {
-	return monome->mode(monome, mode);
+	uint64_t begin = begin_cmd(monome, MONOME_CMD_MODE);
+	return end_cmd(monome, begin, monome->mode(monome, mode));
 }
 
 int monome_led_on(monome_t *monome, uint x, uint y) {
-	return monome->led_on(monome, x, y);
+	uint64_t begin = begin_cmd(monome, MONOME_CMD_LED_ON);
+	return end_cmd(monome, begin, monome->led_on(monome, x, y));
 }
 
 int monome_led_off(monome_t *monome, uint x, uint y) {
-	return monome->led_off(monome, x, y);
+	uint64_t begin = begin_cmd(monome, MONOME_CMD_LED_OFF);
+	return end_cmd(monome, begin, monome->led_off(monome, x, y));
 }
 
 int monome_led_col(monome_t *monome, uint col, size_t count, const uint8_t *data) {
-	return monome->led_col(monome, col, count, data);
+	uint64_t begin = begin_cmd(monome, MONOME_CMD_LED_COL);
+	return end_cmd(monome, begin, monome->led_col(monome, col, count, data));
 }
 
 int monome_led_row(monome_t *monome, uint row, size_t count, const uint8_t *data) {
-	return monome->led_row(monome, row, count, data);
+	uint64_t begin = begin_cmd(monome, MONOME_CMD_LED_ROW);
+	return end_cmd(monome, begin, monome->led_row(monome, row, count, data));
 }
 
 int monome_led_frame(monome_t *monome, uint quadrant, const uint8_t *frame_data) {
-	return monome->led_frame(monome, quadrant, frame_data);
+	uint64_t begin = begin_cmd(monome, MONOME_CMD_LED_FRAME);
+	return end_cmd(monome, begin, monome->led_frame(monome, quadrant, frame_data));
+}
+
+/* map_data is a packed bitmap of the whole grid, starting at the top left:
+   one row after another, (cols + 7) / 8 bytes to a row, least significant
+   bit first (the same layout as led_row).
+
+   protocols that can't do this in one message get it as one frame per
+   quadrant, so any LEDs in a touched quadrant that fall outside of
+   cols x rows get switched off. */
+int monome_led_map(monome_t *monome, uint cols, uint rows, const uint8_t *data) {
+	uint8_t frame[8], mask;
+	uint stride, x, y, i;
+	uint64_t begin;
+	int ret = 0;
+
+	if( cols > 16 || rows > 16 )
+		return -1;
+
+	begin = begin_cmd(monome, MONOME_CMD_LED_MAP);
+
+	if( monome->led_map )
+		return end_cmd(monome, begin, monome->led_map(monome, cols, rows, data));
+
+	stride = (cols + 7) / 8;
+
+	for( y = 0; y < rows; y += 8 )
+		for( x = 0; x < cols; x += 8 ) {
+			mask = (cols - x < 8) ? (1 << (cols - x)) - 1 : 0xFF;
+
+			for( i = 0; i < 8; i++ )
+				frame[i] = (y + i < rows) ? data[(y + i) * stride + x / 8] & mask : 0;
+
+			if( monome->led_frame(monome, (y / 8) * 2 + x / 8, frame) < 0 )
+				ret = -1;
+		}
+
+	return end_cmd(monome, begin, ret);
 }
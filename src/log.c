@@ -0,0 +1,462 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "stats.h"
+
+/* logging that's safe to do from the middle of device I/O.
+
+   a message is its format string plus its arguments, captured as they
+   are (ints, and strings copied into the entry), and pushed onto a
+   fixed-size ring without taking a lock.  formatting and the actual
+   output happen later, from monome_log_flush() or the drain thread.  if
+   the ring is full the message is counted and dropped rather than
+   waiting for room.
+
+   nobody has to set any of this up, though.  if nobody sets a drain,
+   the first message starts the drain thread, which writes to stderr
+   every LOG_DRAIN_SLEEP, and whatever's left goes out at exit.  so the
+   thread that logs never writes anything itself.
+
+   any one format string gets through at most once a second, the rest
+   are counted and the next one that makes it says how many there were.
+   a device that's fallen off the bus will fail every write, and there's
+   no use hearing about each of them. */
+
+#define LOG_RING_SIZE   256 /* power of two */
+#define LOG_SITES       64  /* power of two */
+#define LOG_RATE_WINDOW 1000000000ULL /* nanoseconds */
+#define LOG_DRAIN_SLEEP 50000000      /* nanoseconds */
+
+typedef struct {
+	uint64_t seq;
+	monome_log_entry_t entry;
+} log_slot_t;
+
+typedef struct {
+	const char *fmt;
+	uint64_t last;
+	uint suppressed;
+} log_site_t;
+
+static struct {
+	log_slot_t slots[LOG_RING_SIZE];
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t tail __attribute__((aligned(64)));
+	uint64_t dropped;
+	int draining;
+	pthread_once_t ring_once;
+
+	int own_flush;
+	pthread_once_t thread_once;
+	int thread_err;
+
+	monome_log_drain_t drain;
+	void *data;
+
+	log_site_t sites[LOG_SITES];
+} logbuf = {
+	.ring_once   = PTHREAD_ONCE_INIT,
+	.thread_once = PTHREAD_ONCE_INIT
+};
+
+/**
+ * private
+ */
+
+/* the next conversion in fmt, or NULL if there isn't one.  only %d, %u,
+   %x, %s and %% are understood. */
+static const char *next_spec(const char *fmt, char *conv) {
+	while( (fmt = strchr(fmt, '%')) ) {
+		if( fmt[1] == '%' ) {
+			fmt += 2;
+			continue;
+		}
+
+		*conv = fmt[1];
+		return fmt;
+	}
+
+	return NULL;
+}
+
+static log_site_t *find_site(const char *fmt) {
+	uint i, h = ((uintptr_t) fmt >> 4) & (LOG_SITES - 1);
+	const char *expected;
+	log_site_t *site;
+
+	for( i = 0; i < LOG_SITES; i++ ) {
+		site = &logbuf.sites[(h + i) & (LOG_SITES - 1)];
+		expected = NULL;
+
+		if( __atomic_load_n(&site->fmt, __ATOMIC_ACQUIRE) == fmt ||
+			__atomic_compare_exchange_n(&site->fmt, &expected, fmt, 0,
+										__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+			expected == fmt )
+			return site;
+	}
+
+	return NULL;
+}
+
+/* returns 0 if this one should be dropped, otherwise sets *suppressed to
+   how many were dropped since the last one that went through. */
+static int rate_limit(const char *fmt, uint64_t now, uint *suppressed) {
+	log_site_t *site;
+	uint64_t last;
+
+	/* all the slots are taken, let everything through */
+	if( !(site = find_site(fmt)) ) {
+		*suppressed = 0;
+		return 1;
+	}
+
+	last = __atomic_load_n(&site->last, __ATOMIC_RELAXED);
+
+	if( (last && now - last < LOG_RATE_WINDOW) ||
+		!__atomic_compare_exchange_n(&site->last, &last, now, 0,
+									 __ATOMIC_RELAXED, __ATOMIC_RELAXED) ) {
+		__atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	*suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+	return 1;
+}
+
+static void capture(monome_log_entry_t *e, const char *fmt, va_list args) {
+	size_t used = 0, len;
+	const char *s;
+	uint nargs = 0;
+	char conv;
+
+	while( (fmt = next_spec(fmt, &conv)) ) {
+		fmt += 2;
+
+		switch( conv ) {
+		case 'd':
+			if( nargs < MONOME_LOG_ARGS )
+				e->args[nargs++] = va_arg(args, int);
+			else
+				(void) va_arg(args, int);
+			break;
+
+		case 'u':
+		case 'x':
+			if( nargs < MONOME_LOG_ARGS )
+				e->args[nargs++] = va_arg(args, uint);
+			else
+				(void) va_arg(args, uint);
+			break;
+
+		case 's':
+			if( !(s = va_arg(args, const char *)) )
+				s = "(null)";
+
+			/* truncated to fit, but always terminated */
+			if( used < sizeof(e->strings) ) {
+				len = strnlen(s, sizeof(e->strings) - used - 1);
+				memcpy(e->strings + used, s, len);
+				e->strings[used + len] = '\0';
+				used += len + 1;
+			}
+
+			break;
+		}
+	}
+}
+
+/* multiple producers, so each slot has a sequence number saying whose
+   turn it is.  slot i is free for the producer at position i when its
+   seq is i, and ready for the consumer when it's i + 1. */
+static void flush_at_exit() {
+	monome_log_flush();
+}
+
+static void ring_setup() {
+	uint i;
+
+	for( i = 0; i < LOG_RING_SIZE; i++ )
+		logbuf.slots[i].seq = i;
+
+	atexit(flush_at_exit);
+}
+
+static void ring_init() {
+	pthread_once(&logbuf.ring_once, ring_setup);
+}
+
+static monome_log_entry_t *ring_claim(uint64_t *pos) {
+	log_slot_t *slot;
+	int64_t diff;
+
+	*pos = __atomic_load_n(&logbuf.tail, __ATOMIC_RELAXED);
+
+	for( ;; ) {
+		slot = &logbuf.slots[*pos & (LOG_RING_SIZE - 1)];
+		diff = (int64_t) __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - *pos;
+
+		if( !diff ) {
+			if( __atomic_compare_exchange_n(&logbuf.tail, pos, *pos + 1, 1,
+											__ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+				return &slot->entry;
+		} else if( diff < 0 )
+			return NULL; /* full */
+		else
+			*pos = __atomic_load_n(&logbuf.tail, __ATOMIC_RELAXED);
+	}
+}
+
+static void ring_publish(uint64_t pos) {
+	__atomic_store_n(&logbuf.slots[pos & (LOG_RING_SIZE - 1)].seq, pos + 1,
+					 __ATOMIC_RELEASE);
+}
+
+static void write_stderr(const monome_log_entry_t *e, void *data) {
+	char buf[256];
+	size_t len;
+
+	len = monome_log_format(e, buf, sizeof(buf) - 1);
+	buf[len++] = '\n';
+
+	if( write(STDERR_FILENO, buf, len) < 0 )
+		return;
+}
+
+static void deliver(const monome_log_entry_t *e) {
+	if( logbuf.drain )
+		logbuf.drain(e, logbuf.data);
+	else
+		write_stderr(e, NULL);
+}
+
+static void *drain_thread(void *data) {
+	struct timespec ts = {0, LOG_DRAIN_SLEEP};
+
+	for( ;; ) {
+		monome_log_flush();
+		nanosleep(&ts, NULL);
+	}
+
+	return NULL;
+}
+
+/* this can end up being called from a realtime thread, so don't let the
+   drain thread inherit its priority. */
+static void start_drain_thread() {
+	struct sched_param param = {0};
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	pthread_attr_setschedparam(&attr, &param);
+
+	logbuf.thread_err = !!pthread_create(&thread, &attr, drain_thread, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+/**
+ * public
+ */
+
+void monome_log(monome_log_level_t level, int code, const char *fmt, ...) {
+	monome_log_entry_t *e;
+	uint64_t now = stats_now_ns(), pos;
+	uint suppressed;
+	va_list args;
+
+	if( !rate_limit(fmt, now, &suppressed) )
+		return;
+
+	ring_init();
+
+	if( !__atomic_load_n(&logbuf.own_flush, __ATOMIC_ACQUIRE) )
+		pthread_once(&logbuf.thread_once, start_drain_thread);
+
+	if( !(e = ring_claim(&pos)) ) {
+		__atomic_fetch_add(&logbuf.dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	memset(e, 0, sizeof(*e));
+
+	e->time       = now;
+	e->level      = level;
+	e->code       = code;
+	e->fmt        = fmt;
+	e->suppressed = suppressed;
+
+	va_start(args, fmt);
+	capture(e, fmt, args);
+	va_end(args);
+
+	ring_publish(pos);
+}
+
+/* formats an entry the way the stderr fallback prints it, which is the
+   same as printf would have (plus the errno message, if there is one),
+   without the newline.  returns the length, like snprintf but never more than
+   len - 1. */
+size_t monome_log_format(const monome_log_entry_t *e, char *buf, size_t len) {
+	const char *fmt = e->fmt, *spec, *s = e->strings;
+	size_t used = 0;
+	uint nargs = 0;
+	char conv;
+	int n;
+
+#define APPEND(...) do { \
+		n = snprintf(buf + used, len - used, __VA_ARGS__); \
+		if( n > 0 ) used += ((size_t) n < len - used) ? (size_t) n : len - used - 1; \
+	} while( 0 )
+
+	if( !len )
+		return 0;
+
+	buf[0] = '\0';
+
+	while( (spec = next_spec(fmt, &conv)) ) {
+		APPEND("%.*s", (int) (spec - fmt), fmt);
+		fmt = spec + 2;
+
+		switch( conv ) {
+		case 'd':
+			APPEND("%lld", (long long) ((nargs < MONOME_LOG_ARGS) ? e->args[nargs++] : 0));
+			break;
+
+		case 'u':
+			APPEND("%llu", (unsigned long long) ((nargs < MONOME_LOG_ARGS) ? e->args[nargs++] : 0));
+			break;
+
+		case 'x':
+			APPEND("%llx", (unsigned long long) ((nargs < MONOME_LOG_ARGS) ? e->args[nargs++] : 0));
+			break;
+
+		case 's':
+			APPEND("%s", s);
+			s += strlen(s) + 1;
+
+			if( s >= e->strings + sizeof(e->strings) )
+				s = "";
+			break;
+		}
+	}
+
+	APPEND("%s", fmt);
+
+	if( e->code )
+		APPEND(": %s", strerror(e->code));
+
+	if( e->suppressed )
+		APPEND(" (and %u more like it)", e->suppressed);
+
+#undef APPEND
+
+	return used;
+}
+
+/* messages go to drain (or stderr, if it's NULL) from
+   monome_log_flush(), and it's up to the caller to call that (or start
+   the thread).  set it before anything gets logged, or the drain thread
+   will already be running. */
+void monome_log_set_drain(monome_log_drain_t drain, void *data) {
+	ring_init();
+
+	logbuf.drain = drain;
+	logbuf.data  = data;
+
+	__atomic_store_n(&logbuf.own_flush, 1, __ATOMIC_RELEASE);
+}
+
+/* hands everything in the ring to the drain.  only one thread gets to do
+   this at a time, anyone else just returns.  returns how many messages
+   went out. */
+int monome_log_flush() {
+	monome_log_entry_t e;
+	log_slot_t *slot;
+	uint64_t dropped;
+	int n = 0;
+
+	if( __atomic_exchange_n(&logbuf.draining, 1, __ATOMIC_ACQUIRE) )
+		return 0;
+
+	for( ;; ) {
+		slot = &logbuf.slots[logbuf.head & (LOG_RING_SIZE - 1)];
+
+		if( __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != logbuf.head + 1 )
+			break;
+
+		e = slot->entry;
+		__atomic_store_n(&slot->seq, logbuf.head + LOG_RING_SIZE, __ATOMIC_RELEASE);
+		logbuf.head++;
+
+		deliver(&e);
+		n++;
+	}
+
+	if( (dropped = __atomic_exchange_n(&logbuf.dropped, 0, __ATOMIC_RELAXED)) ) {
+		memset(&e, 0, sizeof(e));
+
+		e.time    = stats_now_ns();
+		e.level   = MONOME_LOG_WARNING;
+		e.fmt     = "libmonome: log ring overflowed, %u messages lost";
+		e.args[0] = dropped;
+
+		deliver(&e);
+		n++;
+	}
+
+	__atomic_store_n(&logbuf.draining, 0, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* flushes the ring every so often from a thread of its own.  the first
+   message starts this anyway, unless there's a drain set, but starting
+   it early means it isn't started from whichever thread logs first.
+   there's only ever one. */
+int monome_log_start_thread() {
+	ring_init();
+	pthread_once(&logbuf.thread_once, start_drain_thread);
+
+	return (logbuf.thread_err) ? -1 : 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <monome.h>
+#include "internal.h"
+#include "loopback.h"
+#include "stats.h"
+
+/* mem:// devices.  instead of a serial port there's a pair of buffers:
+   whatever the protocol module writes lands in the sink, and whatever
+   gets injected is what it reads back.  everything above the platform
+   layer (the real protocol encoders and parsers, rotation, stats) runs
+   exactly as it would for a tty, so this is what to benchmark the
+   library against.
+
+   the device is named by the serial it pretends to have, which picks
+   the protocol and size the same way a real one does: mem://m128-001 is
+   a series 128, mem://m40h001 a 40h.  plain mem:// is a 256.
+
+   there's no file descriptor, so there's nothing to select() on.  drive
+   it with monome_event_next()/monome_event_handle_next() instead of
+   monome_event_loop().  nothing here is thread-safe. */
+
+#define MEM_SINK_SIZE  65536 /* both powers of two */
+#define MEM_INPUT_SIZE 4096
+
+struct monome_mem {
+	/* when the sink fills up the oldest bytes get overwritten, so a
+	   benchmark can write forever without draining */
+	uint8_t sink[MEM_SINK_SIZE];
+	uint64_t sink_head, sink_tail;
+
+	uint8_t input[MEM_INPUT_SIZE];
+	uint64_t input_head, input_tail;
+};
+
+/**
+ * private
+ */
+
+static size_t ring_copy_out(uint8_t *dst, const uint8_t *ring, size_t size,
+							uint64_t from, size_t len) {
+	size_t off = from & (size - 1), first = size - off;
+
+	if( first > len )
+		first = len;
+
+	memcpy(dst, ring + off, first);
+	memcpy(dst + first, ring, len - first);
+
+	return len;
+}
+
+static void ring_copy_in(uint8_t *ring, size_t size, uint64_t to,
+						 const uint8_t *src, size_t len) {
+	size_t off = to & (size - 1), first = size - off;
+
+	if( first > len )
+		first = len;
+
+	memcpy(ring + off, src, first);
+	memcpy(ring, src + first, len - first);
+}
+
+/**
+ * platform
+ */
+
+char *monome_mem_get_serial(const char *dev) {
+	dev += sizeof(MONOME_MEM_PREFIX) - 1;
+	return strdup((*dev) ? dev : MONOME_MEM_DEFAULT);
+}
+
+int monome_mem_open(monome_t *monome, const char *dev) {
+	if( !(monome->mem = calloc(1, sizeof(monome_mem_t))) )
+		return 1;
+
+	monome->fd = -1;
+	return 0;
+}
+
+int monome_mem_close(monome_t *monome) {
+	free(monome->mem);
+	monome->mem = NULL;
+
+	return 0;
+}
+
+ssize_t monome_mem_write(monome_t *monome, const uint8_t *buf, ssize_t bufsize) {
+	monome_mem_t *mem = monome->mem;
+	size_t len = bufsize;
+
+	if( len > MEM_SINK_SIZE ) {
+		buf += len - MEM_SINK_SIZE;
+		len  = MEM_SINK_SIZE;
+	}
+
+	ring_copy_in(mem->sink, MEM_SINK_SIZE, mem->sink_tail, buf, len);
+	mem->sink_tail += len;
+
+	if( mem->sink_tail - mem->sink_head > MEM_SINK_SIZE )
+		mem->sink_head = mem->sink_tail - MEM_SINK_SIZE;
+
+	stats_add(&monome->stats.writes, 1);
+	stats_add(&monome->stats.cmd[monome->cmd].bytes, bufsize);
+
+	return bufsize;
+}
+
+/* all or nothing, the same as a tty read that's waited for the rest of
+   the message */
+ssize_t monome_mem_read(monome_t *monome, uint8_t *buf, ssize_t count) {
+	monome_mem_t *mem = monome->mem;
+
+	if( mem->input_tail - mem->input_head < (uint64_t) count ) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	ring_copy_out(buf, mem->input, MEM_INPUT_SIZE, mem->input_head, count);
+	mem->input_head += count;
+
+	return count;
+}
+
+/**
+ * public
+ */
+
+/* queues up bytes for the device to "send".  returns how many fitted, or
+   -1 if this isn't a mem:// device. */
+ssize_t monome_mem_inject(monome_t *monome, const uint8_t *buf, size_t len) {
+	monome_mem_t *mem = monome->mem;
+	size_t room;
+
+	if( !mem )
+		return -1;
+
+	room = MEM_INPUT_SIZE - (mem->input_tail - mem->input_head);
+
+	if( len > room )
+		len = room;
+
+	ring_copy_in(mem->input, MEM_INPUT_SIZE, mem->input_tail, buf, len);
+	mem->input_tail += len;
+
+	return len;
+}
+
+/* takes up to len of the oldest bytes the device has been sent.  returns
+   how many, or -1 if this isn't a mem:// device. */
+ssize_t monome_mem_drain(monome_t *monome, uint8_t *buf, size_t len) {
+	monome_mem_t *mem = monome->mem;
+	size_t avail;
+
+	if( !mem )
+		return -1;
+
+	avail = mem->sink_tail - mem->sink_head;
+
+	if( len > avail )
+		len = avail;
+
+	ring_copy_out(buf, mem->sink, MEM_SINK_SIZE, mem->sink_head, len);
+	mem->sink_head += len;
+
+	return len;
+}
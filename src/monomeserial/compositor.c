@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <monome.h>
+
+#include "monomeserial.h"
+
+/**
+ * private
+ */
+
+static void composite(ms_device_t *dev, osc_sync_grid_t *out) {
+	const ms_layer_t *layer;
+	uint16_t fb, mask;
+	int i, y;
+
+	*out = dev->layers[dev->focus].sync.grid;
+
+	for( i = 0; i < dev->nlayers; i++ ) {
+		layer = &dev->layers[i];
+
+		if( layer->mode == MS_LAYER_APP )
+			continue;
+
+		for( y = 0; y < 16; y++ ) {
+			fb   = layer->sync.grid.rows[y];
+			mask = layer->region.rows[y];
+
+			switch( layer->mode ) {
+			case MS_LAYER_SPLIT:
+				out->rows[y] = (out->rows[y] & ~mask) | (fb & mask);
+				break;
+
+			case MS_LAYER_OR:
+				out->rows[y] |= fb & mask;
+				break;
+
+			case MS_LAYER_XOR:
+				out->rows[y] ^= fb & mask;
+				break;
+
+			case MS_LAYER_MASK:
+				out->rows[y] &= fb | ~mask;
+				break;
+
+			default:
+				break;
+			}
+		}
+	}
+}
+
+/* a single changed LED is a led_on/off, anything more is a frame per
+   quadrant that changed.  returns the number of changed LEDs and sets
+   *quads to a bitmask of the quadrants that differ, or (in the single
+   LED case) *x and *y to the one that does. */
+static uint diff_grids(monome_t *monome, const osc_sync_grid_t *old,
+					   const osc_sync_grid_t *new, uint *quads, uint *x, uint *y) {
+	uint changed, q, qx, qy, i;
+	uint16_t diff;
+	int rows, cols;
+
+	for( i = changed = *x = *y = 0; i < 16; i++ )
+		if( (diff = old->rows[i] ^ new->rows[i]) ) {
+			changed += __builtin_popcount(diff);
+			*x = __builtin_ctz(diff);
+			*y = i;
+		}
+
+	*quads = 0;
+
+	if( changed < 2 )
+		return changed;
+
+	rows = monome_get_rows(monome);
+	cols = monome_get_cols(monome);
+
+	for( q = 0; q < 4; q++ ) {
+		qx = (q & 1) * 8;
+		qy = (q & 2) * 4;
+
+		if( qx >= cols || qy >= rows )
+			continue;
+
+		for( i = 0, diff = 0; i < 8; i++ )
+			diff |= ((old->rows[qy + i] ^ new->rows[qy + i]) >> qx) & 0xFF;
+
+		if( diff )
+			*quads |= 1 << q;
+	}
+
+	return changed;
+}
+
+static void push_quadrants(monome_t *monome, const osc_sync_grid_t *grid,
+						   uint quads) {
+	uint8_t frame[8];
+	uint q, x, y, i;
+
+	for( q = 0; q < 4; q++ ) {
+		if( !(quads & (1 << q)) )
+			continue;
+
+		x = (q & 1) * 8;
+		y = (q & 2) * 4;
+
+		for( i = 0; i < 8; i++ )
+			frame[i] = grid->rows[y + i] >> x;
+
+		monome_led_frame(monome, q, frame);
+	}
+}
+
+/* network thread */
+static void publish(ms_device_t *dev, const osc_sync_grid_t *grid) {
+	uint seq = dev->target.seq;
+	int i;
+
+	__atomic_store_n(&dev->target.seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	for( i = 0; i < 16; i++ )
+		__atomic_store_n(&dev->target.grid.rows[i], grid->rows[i],
+						 __ATOMIC_RELAXED);
+
+	__atomic_store_n(&dev->target.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* device thread */
+static void fetch(ms_device_t *dev, osc_sync_grid_t *grid) {
+	uint before, after;
+	int i;
+
+	do {
+		before = __atomic_load_n(&dev->target.seq, __ATOMIC_ACQUIRE);
+
+		for( i = 0; i < 16; i++ )
+			grid->rows[i] = __atomic_load_n(&dev->target.grid.rows[i],
+											__ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&dev->target.seq, __ATOMIC_RELAXED);
+	} while( before != after || before & 1 );
+}
+
+/* device thread.  sends the device whatever it's missing of the newest
+   composited grid, as long as the link has room for it.  if not, try
+   again once it will. */
+static void flush(ms_device_t *dev) {
+	ms_link_t *link = &dev->link;
+	osc_sync_grid_t next;
+	uint changed, quads, x, y, updates, bytes;
+	uint64_t wait;
+
+	/* nowhere for it to go, it'll all be repainted when the device's back */
+	if( !dev->monome )
+		return;
+
+	fetch(dev, &next);
+
+	changed = diff_grids(dev->monome, &dev->shown, &next, &quads, &x, &y);
+	updates = (changed == 1) ? 1 : __builtin_popcount(quads);
+
+	bytes   = (changed == 1) ? link->led_bytes : updates * link->frame_bytes;
+
+	link->pending = 0;
+	__atomic_store_n(&link->backlog, 0, __ATOMIC_RELAXED);
+
+	if( !updates )
+		return;
+
+	if( (wait = ms_link_spend(link, bytes)) ) {
+		link->pending = 1;
+		__atomic_store_n(&link->backlog, bytes, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&link->stats.deferred, 1, __ATOMIC_RELAXED);
+
+		ms_timer_arm(&link->timer, wait);
+		return;
+	}
+
+	if( changed == 1 ) {
+		if( next.rows[y] & (1 << x) )
+			monome_led_on(dev->monome, x, y);
+		else
+			monome_led_off(dev->monome, x, y);
+	} else
+		push_quadrants(dev->monome, &next, quads);
+
+	__atomic_fetch_add(&link->stats.updates, updates, __ATOMIC_RELAXED);
+	dev->shown = next;
+}
+
+static void flush_cb(ms_timer_t *timer) {
+	uint64_t begin = monome_trace_begin();
+	ms_device_t *dev = timer->data;
+
+	flush(dev);
+	monome_trace_end("deferred flush", begin, dev - state.devices);
+}
+
+/**
+ * public
+ */
+
+int ms_layer_mode_from_str(const char *str) {
+	if( !strcmp(str, "app") )
+		return MS_LAYER_APP;
+	else if( !strcmp(str, "split") )
+		return MS_LAYER_SPLIT;
+	else if( !strcmp(str, "or") )
+		return MS_LAYER_OR;
+	else if( !strcmp(str, "xor") )
+		return MS_LAYER_XOR;
+	else if( !strcmp(str, "mask") )
+		return MS_LAYER_MASK;
+
+	return -1;
+}
+
+void ms_layer_set_region(ms_layer_t *layer, int x, int y, int w, int h) {
+	uint16_t row;
+	int i;
+
+	if( x < 0 ) { w += x; x = 0; }
+	if( y < 0 ) { h += y; y = 0; }
+	if( x + w > 16 ) w = 16 - x;
+	if( y + h > 16 ) h = 16 - y;
+
+	row = (w > 0) ? ((1 << w) - 1) << x : 0;
+
+	for( i = 0; i < 16; i++ )
+		layer->region.rows[i] = (h > 0 && i >= y && i < y + h) ? row : 0;
+}
+
+/* presses go to the topmost split covering the button, otherwise to
+   whichever app has focus.  overlays are display only. */
+ms_layer_t *ms_device_layer_at(ms_device_t *dev, uint x, uint y) {
+	ms_layer_t *layer;
+	int i;
+
+	if( x < 16 && y < 16 )
+		for( i = dev->nlayers - 1; i >= 0; i-- ) {
+			layer = &dev->layers[i];
+
+			if( layer->mode == MS_LAYER_SPLIT &&
+				layer->region.rows[y] & (1 << x) )
+				return layer;
+		}
+
+	return &dev->layers[dev->focus];
+}
+
+int ms_device_focus(ms_device_t *dev, int idx) {
+	if( idx < 0 || idx >= dev->nlayers ||
+		dev->layers[idx].mode != MS_LAYER_APP )
+		return -1;
+
+	if( dev->focus != idx ) {
+		dev->focus = idx;
+		ms_device_refresh(dev);
+	}
+
+	return 0;
+}
+
+int ms_device_output_init(ms_device_t *dev, uint baud, const char *proto) {
+	ms_link_init(&dev->link, baud, proto);
+	return ms_timer_add(&state.device_loop, &dev->link.timer, flush_cb, dev);
+}
+
+/* network thread, called after every change to a layer.  recomposites
+   and hands the result to the device thread if it's any different. */
+void ms_device_refresh(ms_device_t *dev) {
+	uint64_t begin = monome_trace_begin();
+	osc_sync_grid_t next;
+
+	dev->link.stats.commands++;
+	composite(dev, &next);
+	monome_trace_end("composite", begin, dev - state.devices);
+
+	if( !memcmp(&next, &dev->composited, sizeof(next)) ) {
+		dev->link.stats.coalesced++;
+		return;
+	}
+
+	dev->composited = next;
+	publish(dev, &next);
+	ms_pipeline_grid(dev);
+}
+
+/* device thread, when there's a new grid.  if an update is already
+   waiting on the link, it'll pick this one up when it goes. */
+void ms_device_output(ms_device_t *dev) {
+	uint64_t begin;
+
+	__atomic_store_n(&dev->notified, 0, __ATOMIC_SEQ_CST);
+
+	if( dev->link.pending )
+		return;
+
+	begin = monome_trace_begin();
+	flush(dev);
+	monome_trace_end("flush", begin, dev - state.devices);
+}
+
+/* device thread, once the device has been cleared.  whatever's lit in the
+   composited grid goes out at once, as frames, and the link has been idle
+   for as long as the device was gone so there's credit for all of it. */
+void ms_device_repaint(ms_device_t *dev) {
+	memset(&dev->shown, 0, sizeof(dev->shown));
+	flush(dev);
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/select.h>
+#endif
+
+#include "monomeserial.h"
+
+/* each thread has a loop of its own, watching whatever file descriptors it
+   owns.  on linux that's epoll, so a wakeup costs the same whether we're
+   serving one grid or sixteen. */
+
+uint64_t ms_now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int ms_timer_add(ms_event_loop_t *loop, ms_timer_t *timer,
+				 ms_timer_cb_t cb, void *data) {
+	int i;
+
+	timer->deadline = 0;
+	timer->cb       = cb;
+	timer->data     = data;
+
+	for( i = 0; i < MAX_TIMERS; i++ )
+		if( !loop->timers[i] ) {
+			loop->timers[i] = timer;
+			return 0;
+		}
+
+	return -1;
+}
+
+void ms_timer_del(ms_event_loop_t *loop, ms_timer_t *timer) {
+	int i;
+
+	for( i = 0; i < MAX_TIMERS; i++ )
+		if( loop->timers[i] == timer )
+			loop->timers[i] = NULL;
+
+	timer->deadline = 0;
+}
+
+void ms_timer_arm(ms_timer_t *timer, uint64_t delay) {
+	timer->deadline = ms_now() + delay;
+}
+
+/* milliseconds until the next timer is due, rounded up so we never wake
+   early, or -1 if nothing's armed */
+static int next_timeout(ms_event_loop_t *loop) {
+	uint64_t now, next;
+	ms_timer_t *t;
+	int i;
+
+	for( i = 0, next = 0; i < MAX_TIMERS; i++ )
+		if( (t = loop->timers[i]) && t->deadline &&
+			(!next || t->deadline < next) )
+			next = t->deadline;
+
+	if( !next )
+		return -1;
+
+	now = ms_now();
+	return (next > now) ? (next - now + 999) / 1000 : 0;
+}
+
+/* in busy-poll mode we don't sleep at all until we've been idle for a
+   while, the kernel call itself is the spin. */
+static int wait_timeout(ms_event_loop_t *loop) {
+	if( loop->busy_poll && ms_now() - loop->last_active < loop->busy_poll )
+		return 0;
+
+	return next_timeout(loop);
+}
+
+static void run_timers(ms_event_loop_t *loop) {
+	uint64_t now = ms_now();
+	ms_timer_t *t;
+	int i;
+
+	for( i = 0; i < MAX_TIMERS; i++ )
+		if( (t = loop->timers[i]) && t->deadline && t->deadline <= now ) {
+			t->deadline = 0;
+			t->cb(t);
+		}
+}
+
+static void dispatch(ms_watch_t *watch) {
+	/* a callback earlier in the same batch may have torn this one down */
+	if( watch->fd >= 0 )
+		watch->cb(watch);
+}
+
+#ifdef __linux__
+
+int ms_event_loop_init(ms_event_loop_t *loop) {
+	memset(loop, 0, sizeof(*loop));
+
+	if( (loop->epoll_fd = epoll_create(MAX_WATCHES)) < 0 ) {
+		perror("monomeserial: couldn't create epoll instance");
+		return 1;
+	}
+
+	return 0;
+}
+
+int ms_watch_add(ms_event_loop_t *loop, ms_watch_t *watch, int fd,
+				 ms_watch_cb_t cb, void *data) {
+	struct epoll_event ev;
+
+	watch->fd       = fd;
+	watch->writable = 0;
+	watch->cb       = cb;
+	watch->data     = data;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = EPOLLIN;
+	ev.data.ptr = watch;
+
+	return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void ms_watch_want_write(ms_event_loop_t *loop, ms_watch_t *watch, int on) {
+	struct epoll_event ev;
+
+	if( watch->fd < 0 || watch->writable == on )
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = EPOLLIN | ((on) ? EPOLLOUT : 0);
+	ev.data.ptr = watch;
+
+	if( !epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, watch->fd, &ev) )
+		watch->writable = on;
+}
+
+void ms_watch_del(ms_event_loop_t *loop, ms_watch_t *watch) {
+	struct epoll_event ev; /* kernels before 2.6.9 insist on one */
+
+	if( watch->fd < 0 )
+		return;
+
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, watch->fd, &ev);
+	watch->fd = -1;
+}
+
+void ms_event_loop_run(ms_event_loop_t *loop) {
+	struct epoll_event events[MAX_WATCHES];
+	int i, n;
+
+	do {
+		if( (n = epoll_wait(loop->epoll_fd, events, MAX_WATCHES,
+							wait_timeout(loop))) < 0 ) {
+			if( errno == EINTR )
+				continue;
+
+			perror("monomeserial: error in epoll_wait()");
+			return;
+		}
+
+		if( n && loop->busy_poll )
+			loop->last_active = ms_now();
+
+		for( i = 0; i < n; i++ )
+			dispatch(events[i].data.ptr);
+
+		run_timers(loop);
+	} while( 1 );
+}
+
+#else /* __linux__ */
+
+int ms_event_loop_init(ms_event_loop_t *loop) {
+	memset(loop, 0, sizeof(*loop));
+	return 0;
+}
+
+int ms_watch_add(ms_event_loop_t *loop, ms_watch_t *watch, int fd,
+				 ms_watch_cb_t cb, void *data) {
+	int i;
+
+	for( i = 0; i < MAX_WATCHES; i++ )
+		if( !loop->watches[i] ) {
+			watch->fd       = fd;
+			watch->writable = 0;
+			watch->cb       = cb;
+			watch->data     = data;
+
+			loop->watches[i] = watch;
+			return 0;
+		}
+
+	return -1;
+}
+
+void ms_watch_del(ms_event_loop_t *loop, ms_watch_t *watch) {
+	int i;
+
+	for( i = 0; i < MAX_WATCHES; i++ )
+		if( loop->watches[i] == watch )
+			loop->watches[i] = NULL;
+
+	watch->fd = -1;
+}
+
+void ms_watch_want_write(ms_event_loop_t *loop, ms_watch_t *watch, int on) {
+	watch->writable = on;
+}
+
+void ms_event_loop_run(ms_event_loop_t *loop) {
+	ms_watch_t *ready[MAX_WATCHES], *w;
+	struct timeval tv;
+	int i, n, max_fd, timeout;
+	fd_set rfds, wfds;
+
+	do {
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		max_fd = 0;
+
+		for( i = 0; i < MAX_WATCHES; i++ ) {
+			if( !(w = loop->watches[i]) )
+				continue;
+
+			FD_SET(w->fd, &rfds);
+
+			if( w->writable )
+				FD_SET(w->fd, &wfds);
+
+			if( w->fd >= max_fd )
+				max_fd = w->fd + 1;
+		}
+
+		if( (timeout = wait_timeout(loop)) >= 0 ) {
+			tv.tv_sec  = timeout / 1000;
+			tv.tv_usec = (timeout % 1000) * 1000;
+		}
+
+		if( (n = select(max_fd, &rfds, &wfds, NULL,
+						(timeout >= 0) ? &tv : NULL)) < 0 ) {
+			if( errno == EINTR )
+				continue;
+
+			perror("monomeserial: error in select()");
+			return;
+		}
+
+		if( n && loop->busy_poll )
+			loop->last_active = ms_now();
+
+		/* collect first, since callbacks can add and remove watches */
+		for( i = n = 0; i < MAX_WATCHES; i++ )
+			if( (w = loop->watches[i]) &&
+				(FD_ISSET(w->fd, &rfds) || FD_ISSET(w->fd, &wfds)) )
+				ready[n++] = w;
+
+		for( i = 0; i < n; i++ )
+			dispatch(ready[i]);
+
+		run_timers(loop);
+	} while( 1 );
+}
+
+#endif /* __linux__ */
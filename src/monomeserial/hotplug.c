@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <monome.h>
+
+#include "monomeserial.h"
+
+/* when a grid is unplugged (or its usb adapter resets) the serial port
+   hangs up.  rather than spin on that, or give up on the device, it gets
+   closed and put aside with what it'd need to look the same again: its
+   orientation and intensity.  anything held down on it gets let go of.
+   otherwise the network thread doesn't notice, layers carry on being
+   drawn into and composited as usual.
+
+   whenever something turns up that might be it, it's reopened by serial
+   (or by path if it never said what its serial was), cleared, and
+   whatever's composited goes out in one burst, as long as it's the same
+   size as before.  on linux inotify on the directory it was found in
+   says when that's worth trying, a timer covers everything else.  this
+   is all on the device thread. */
+
+/**
+ * private
+ */
+
+static ms_timer_t retry_timer;
+static int nlost;
+
+#ifdef __linux__
+static int inotify_fd = -1;
+static ms_watch_t inotify_watch;
+#endif
+
+static void monome_handle_press(const monome_event_t *e, void *data) {
+	ms_pipeline_press(data, e);
+}
+
+static int hung_up(ms_device_t *dev) {
+	struct pollfd pfd = {dev->watch.fd, POLLIN, 0};
+
+	if( poll(&pfd, 1, 0) < 0 )
+		return 0;
+
+	return !!(pfd.revents & (POLLHUP | POLLERR | POLLNVAL));
+}
+
+/* anything still held when the device goes away will never see its
+   release, so send one for it now.  applications would otherwise think
+   it's down until someone presses and lets go of it again. */
+static void release_held(ms_device_t *dev) {
+	monome_event_t e = {dev->monome, MONOME_BUTTON_UP};
+
+	dev->wakeup = ms_now();
+
+	for( e.y = 0; e.y < 16; e.y++ )
+		for( e.x = 0; e.x < 16; e.x++ )
+			if( dev->held[e.y] & (1 << e.x) )
+				ms_pipeline_press(dev, &e);
+}
+
+static const char *device_name(ms_device_t *dev) {
+	return (dev->serial[0]) ? dev->serial : dev->devpath;
+}
+
+static void lost(ms_device_t *dev) {
+	dev->orientation = monome_get_orientation(dev->monome);
+	ms_device_detach(dev);
+
+	monome_log(MONOME_LOG_WARNING, 0,
+			   "monomeserial: lost %s, waiting for it to come back",
+			   device_name(dev));
+
+	if( !nlost++ )
+		ms_timer_arm(&retry_timer, HOTPLUG_RETRY_INTERVAL);
+}
+
+static int reconnect(ms_device_t *dev) {
+	uint64_t begin = monome_trace_begin();
+	monome_t *monome;
+
+	if( dev->serial[0] )
+		monome = monome_open_serial(dev->serial, NULL);
+	else
+		monome = monome_open(dev->devpath, NULL);
+
+	if( !monome )
+		return -1;
+
+	/* the layers and the composited grid are laid out for what was there
+	   before.  someone else's grid with the same serial, or a different
+	   model on the same port, would get a mangled picture and presses in
+	   the wrong places.  this is before the orientation's put back, same
+	   as when it was first opened. */
+	if( monome_get_rows(monome) != dev->rows ||
+		monome_get_cols(monome) != dev->cols ) {
+		/* it'll be tried again every retry, once is enough to say so */
+		if( !dev->mismatched++ )
+			monome_log(MONOME_LOG_WARNING, 0,
+					   "monomeserial: %s came back as %dx%d instead of "
+					   "%dx%d, not using it", device_name(dev),
+					   monome_get_cols(monome), monome_get_rows(monome),
+					   dev->cols, dev->rows);
+
+		monome_close(monome);
+		return -1;
+	}
+
+	if( ms_device_attach(dev, monome) ) {
+		monome_close(monome);
+		return -1;
+	}
+
+	dev->mismatched = 0;
+
+	/* orientation first, everything after it gets rotated */
+	monome_set_orientation(monome, dev->orientation);
+	monome_clear(monome, MONOME_CLEAR_OFF);
+
+	if( dev->intensity >= 0 )
+		monome_intensity(monome, dev->intensity);
+
+	ms_device_repaint(dev);
+	monome_trace_end("reconnect", begin, dev - state.devices);
+
+	monome_log(MONOME_LOG_INFO, 0, "monomeserial: %s is back at %s",
+			   device_name(dev), monome_get_devpath(monome));
+
+	return 0;
+}
+
+static void retry() {
+	int i;
+
+	for( i = 0; i < state.ndevices && nlost; i++ )
+		if( !state.devices[i].monome && !reconnect(&state.devices[i]) )
+			nlost--;
+
+	if( nlost )
+		ms_timer_arm(&retry_timer, HOTPLUG_RETRY_INTERVAL);
+	else
+		retry_timer.deadline = 0;
+}
+
+static void retry_cb(ms_timer_t *timer) {
+	retry();
+}
+
+static void device_cb(ms_watch_t *watch) {
+	ms_device_t *dev = watch->data;
+
+	dev->wakeup = ms_now();
+
+	/* nothing came of it.  usually half a message, but it might be that
+	   there's nothing left to read from. */
+	if( !monome_event_handle_next(dev->monome) && hung_up(dev) )
+		lost(dev);
+}
+
+#ifdef __linux__
+
+static void inotify_cb(ms_watch_t *watch) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	/* which file it was doesn't matter much, anything new is worth a
+	   look if something's missing */
+	while( read(inotify_fd, buf, sizeof(buf)) > 0 )
+		;
+
+	if( nlost )
+		retry();
+}
+
+static int watch_dir(const char *path) {
+	char dir[MONOME_DEVPATH_MAX], *slash;
+
+	if( inotify_fd < 0 )
+		return 0;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+
+	if( !(slash = strrchr(dir, '/')) )
+		snprintf(dir, sizeof(dir), ".");
+	else if( slash == dir )
+		slash[1] = 0;
+	else
+		*slash = 0;
+
+	/* the same directory twice just gets the same watch back */
+	if( inotify_add_watch(inotify_fd, dir,
+						  IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0 ) {
+		perror("monomeserial: couldn't watch for devices coming back");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int init_inotify() {
+	if( (inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+		ms_watch_add(&state.device_loop, &inotify_watch, inotify_fd,
+					 inotify_cb, NULL) ) {
+		perror("monomeserial: couldn't set up inotify");
+
+		if( inotify_fd >= 0 )
+			close(inotify_fd);
+
+		inotify_fd = -1;
+	}
+
+	/* the retry timer still works without it, just slower */
+	return 0;
+}
+
+#else /* __linux__ */
+
+static int watch_dir(const char *path) {
+	return 0;
+}
+
+static int init_inotify() {
+	return 0;
+}
+
+#endif
+
+/**
+ * public
+ */
+
+int ms_hotplug_init() {
+	if( ms_timer_add(&state.device_loop, &retry_timer, retry_cb, NULL) )
+		return -1;
+
+	return init_inotify();
+}
+
+/* hands monome to dev, and starts reading from it.  the first time,
+   that's also where it gets remembered as being from. */
+int ms_device_attach(ms_device_t *dev, monome_t *monome) {
+	const char *serial;
+
+	if( ms_watch_add(&state.device_loop, &dev->watch, monome_get_fd(monome),
+					 device_cb, dev) ) {
+		perror("monomeserial: couldn't watch device");
+		return -1;
+	}
+
+	dev->monome = monome;
+
+	monome_register_handler(monome, MONOME_BUTTON_DOWN,
+							monome_handle_press, dev);
+	monome_register_handler(monome, MONOME_BUTTON_UP,
+							monome_handle_press, dev);
+
+	if( dev->devpath[0] )
+		return 0;
+
+	if( (serial = monome_get_serial(monome)) )
+		snprintf(dev->serial, sizeof(dev->serial), "%s", serial);
+
+	snprintf(dev->devpath, sizeof(dev->devpath), "%s",
+			 monome_get_devpath(monome));
+
+	dev->rows      = monome_get_rows(monome);
+	dev->cols      = monome_get_cols(monome);
+	dev->intensity = -1;
+
+	watch_dir(dev->devpath);
+	return 0;
+}
+
+void ms_device_detach(ms_device_t *dev) {
+	if( !dev->monome )
+		return;
+
+	release_held(dev);
+
+	ms_watch_del(&state.device_loop, &dev->watch);
+	monome_close(dev->monome);
+	dev->monome = NULL;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "monomeserial.h"
+
+/* log2 buckets: bucket 0 is under a microsecond, bucket n is from
+   2^(n-1) up to 2^n microseconds.  percentiles come out as the top of
+   the bucket they land in, which is as precise as we need for telling
+   20us from 2ms. */
+
+void ms_latency_record(ms_latency_t *lat, uint64_t usec) {
+	uint b = (usec) ? 64 - __builtin_clzll(usec) : 0;
+
+	if( b >= MS_LATENCY_BUCKETS )
+		b = MS_LATENCY_BUCKETS - 1;
+
+	lat->buckets[b]++;
+	lat->count++;
+
+	if( usec > lat->max )
+		lat->max = usec;
+}
+
+uint64_t ms_latency_percentile(const ms_latency_t *lat, uint percent) {
+	unsigned long want, seen;
+	uint b;
+
+	if( !lat->count )
+		return 0;
+
+	want = (lat->count * percent + 99) / 100;
+
+	for( b = 0, seen = 0; b < MS_LATENCY_BUCKETS; b++ )
+		if( (seen += lat->buckets[b]) >= want )
+			break;
+
+	return (b) ? (uint64_t) 1 << b : 1;
+}
+
+void ms_latency_report(const ms_latency_t *lat, const char *what) {
+	if( !lat->count )
+		return;
+
+	printf("%s: %lu, p50 <%lluus, p99 <%lluus, max %lluus\n", what,
+		   lat->count,
+		   (unsigned long long) ms_latency_percentile(lat, 50),
+		   (unsigned long long) ms_latency_percentile(lat, 99),
+		   (unsigned long long) lat->max);
+	fflush(stdout);
+}
+
+void ms_latency_reset(ms_latency_t *lat) {
+	memset(lat, 0, sizeof(*lat));
+}
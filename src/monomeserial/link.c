@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "monomeserial.h"
+
+/* 8N1, so a start and a stop bit around every byte */
+#define BITS_PER_BYTE 10
+
+void ms_link_init(ms_link_t *link, uint baud, const char *proto) {
+	memset(link, 0, sizeof(*link));
+
+	link->byte_time = (BITS_PER_BYTE * 1000000 + baud - 1) / baud;
+	link->led_bytes = 2;
+
+	/* the 40h has no frame message, it gets sent as eight rows */
+	if( !strcmp(proto, "40h") )
+		link->frame_bytes = 16;
+	else
+		link->frame_bytes = 9;
+
+	/* enough to repaint the whole grid in one go */
+	link->burst  = 4 * link->frame_bytes * link->byte_time;
+	link->credit = link->burst;
+	link->last   = ms_now();
+}
+
+/* takes the wire time for that many bytes if there's enough of it and
+   returns 0, otherwise returns how many microseconds until there is. */
+uint64_t ms_link_spend(ms_link_t *link, uint bytes) {
+	int64_t cost = (int64_t) bytes * link->byte_time;
+	uint64_t now = ms_now();
+
+	link->credit += now - link->last;
+	link->last    = now;
+
+	if( link->credit > link->burst )
+		link->credit = link->burst;
+
+	if( link->credit < cost )
+		return cost - link->credit;
+
+	link->credit -= cost;
+	__atomic_fetch_add(&link->stats.bytes, bytes, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+void ms_link_report(ms_link_t *link, const char *name) {
+	printf("/%s: %lu commands -> %lu updates", name,
+		   link->stats.commands, link->stats.updates);
+
+	if( link->stats.updates )
+		printf(" (%.1f:1)", (double) link->stats.commands / link->stats.updates);
+
+	printf(", %lu bytes, %lu deferred\n",
+		   link->stats.bytes, link->stats.deferred);
+	fflush(stdout);
+}
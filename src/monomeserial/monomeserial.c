@@ -0,0 +1,717 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <getopt.h>
+#include <glob.h>
+#include <lo/lo.h>
+
+#include <monome.h>
+#include "monomeserial.h"
+
+#define DEFAULT_MONOME_DEVICE   "/dev/ttyUSB0"
+
+#ifdef __APPLE__
+#define SERIAL_DEVICE_GLOB      "/dev/tty.usbserial-*"
+#else
+#define SERIAL_DEVICE_GLOB      "/dev/ttyUSB*"
+#endif
+
+typedef struct {
+	char *device;
+	char *prefix;
+	char *aport;
+} device_spec_t;
+
+typedef struct {
+	int device;
+	char *spec;
+} layer_spec_t;
+
+ms_state_t state;
+
+static layer_spec_t layer_specs[MAX_DEVICES * MAX_LAYERS];
+static int nlayer_specs;
+
+static uint link_baud = DEFAULT_LINK_BAUD;
+
+static ms_timer_t report_timer;
+static uint report_interval;
+
+/* serialises /<prefix>/<what> with nargs zeroed ints, which callers
+   patch in place at the end of the buffer */
+static int build_template(ms_layer_t *layer, const char *what, int nargs,
+						  uint8_t *buf, size_t size, size_t *len) {
+	lo_message msg;
+	char *path;
+	int i, ret;
+
+	if( !(msg = lo_message_new()) )
+		return -1;
+
+	for( i = 0; i < nargs; i++ )
+		lo_message_add_int32(msg, 0);
+
+	asprintf(&path, "/%s/%s", layer->prefix, what);
+
+	ret  = -1;
+	*len = lo_message_length(msg, path);
+
+	if( *len <= size && lo_message_serialise(msg, path, buf, len) )
+		ret = 0;
+
+	lo_message_free(msg);
+	free(path);
+
+	return ret;
+}
+
+static int build_templates(ms_layer_t *layer) {
+	return build_template(layer, "press", 3, layer->press_msg,
+						  sizeof(layer->press_msg), &layer->press_len) ||
+		build_template(layer, "sync/ack", 1, layer->ack_msg,
+					   sizeof(layer->ack_msg), &layer->ack_len) ||
+		build_template(layer, "sync/resync", 1, layer->resync_msg,
+					   sizeof(layer->resync_msg), &layer->resync_len);
+}
+
+static void report_cb(ms_timer_t *timer) {
+	int i;
+
+	for( i = 0; i < state.ndevices; i++ )
+		ms_link_report(&state.devices[i].link, state.devices[i].layers[0].prefix);
+
+	ms_latency_report(&state.press_latency, "press latency");
+	ms_latency_reset(&state.press_latency);
+
+	ms_timer_arm(timer, (uint64_t) report_interval * 1000000);
+}
+
+static void usage(const char *app) {
+	printf("usage: %s [options...] [prefix]\n"
+		   "\n"
+		   "  -h, --help			display this information\n"
+		   "\n"
+		   "  -d, --device <spec>		a monome serial device, as\n"
+		   "				device[:prefix[:application-port]]\n"
+		   "				(may be given more than once)\n"
+		   "  -A, --all			open every serial device found\n"
+		   "  -l, --layer <spec>		another client on the last device, as\n"
+		   "				prefix[:mode[:x,y,w,h[:application-port]]]\n"
+		   "				where mode is \"app\", \"split\", \"or\",\n"
+		   "				\"xor\", or \"mask\"\n"
+		   "  -p, --protocol <protocol>	ignored, each device's protocol is\n"
+		   "				worked out when it's opened\n"
+		   "  -b, --baud <rate>		pace output to the serial link's speed\n"
+		   "				(default %d)\n"
+		   "\n"
+		   "  -s, --server-port <port>	what port to listen on\n"
+		   "  -a, --application-port <port>	what port to talk to\n"
+		   "  -o, --application-host <host> the host your application is on\n"
+		   "  -t, --transport <transport>	one of \"udp\", \"tcp\", or \"unix\"\n"
+		   "				(for unix, the ports are socket paths)\n"
+		   "  -S, --subscriber <host:port>	also send presses here "
+		       "(may be given more than once)\n"
+		   "\n"
+		   "  -r, --orientation <direction>	one of "
+		       "\"left\", \"right\", \"bottom\", or \"top\"\n"
+		   "\n"
+		   "  -R, --report <seconds>	print how many commands were coalesced\n"
+		   "				into how many updates every so often\n"
+		   "\n"
+		   "  -D, --device-cpu <cpu>	pin the serial I/O thread to a cpu\n"
+		   "  -N, --network-cpu <cpu>	pin the OSC thread to a cpu\n"
+		   "\n"
+		   "  -T, --realtime[=priority]	run with SCHED_FIFO (default priority %d)\n"
+		   "				and locked memory\n"
+		   "  -C, --cpus <list>		with --realtime, keep to these cpus "
+		       "(e.g. 0,2-3)\n"
+		   "  -B, --busy-poll[=usec]	spin instead of sleeping, until idle for\n"
+		   "				this long (default %d), costs a core\n"
+		   "				per thread\n"
+		   "\n"
+		   "  -x, --trace[=events]		record a timeline of the last so many\n"
+		   "				events (default %d), written out as\n"
+		   "				Chrome trace JSON on SIGUSR2\n"
+		   "\n", app, DEFAULT_LINK_BAUD, DEFAULT_RT_PRIORITY, DEFAULT_BUSY_POLL,
+		   DEFAULT_TRACE_EVENTS);
+}
+
+static int is_numstr(const char *s) {
+	while((48 <= *s) && (*s++ <= 57)); /* 48 is ASCII '0', 57 is '9' */
+
+	/* if the character we stopped on isn't a null,
+	   we didn't make it through the string */
+	if( *s )
+		return 0; /* oh well :( */
+	return 1;
+}
+
+/* device[:prefix[:application-port]], split in place */
+static int add_device_spec(device_spec_t *specs, int nspecs, char *arg) {
+	char *c;
+
+	if( nspecs >= MAX_DEVICES ) {
+		printf("warning: only %d devices are supported, ignoring \"%s\"\n",
+			   MAX_DEVICES, arg);
+		return nspecs;
+	}
+
+	specs[nspecs].device = arg;
+	specs[nspecs].prefix = NULL;
+	specs[nspecs].aport  = NULL;
+
+	if( (c = strchr(arg, ':')) ) {
+		*c++ = '\0';
+		specs[nspecs].prefix = (*c) ? c : NULL;
+
+		if( (c = strchr(c, ':')) ) {
+			*c++ = '\0';
+			specs[nspecs].aport = (*c) ? c : NULL;
+		}
+	}
+
+	return nspecs + 1;
+}
+
+static int add_all_devices(device_spec_t *specs, int nspecs) {
+	static glob_t gb;
+	size_t i;
+
+	/* the paths stay referenced by the specs, so the glob lives as long
+	   as the process does. */
+	if( glob(SERIAL_DEVICE_GLOB, 0, NULL, &gb) )
+		return nspecs;
+
+	for( i = 0; i < gb.gl_pathc; i++ )
+		nspecs = add_device_spec(specs, nspecs, gb.gl_pathv[i]);
+
+	return nspecs;
+}
+
+/* host:port, or just a port on the default application host */
+static int add_subscriber(char *arg) {
+	char *host, *port, *c;
+
+	host = DEFAULT_OSC_APP_HOST;
+	port = arg;
+
+	if( state.transport != LO_UNIX && (c = strrchr(arg, ':')) ) {
+		*c   = '\0';
+		host = arg;
+		port = c + 1;
+	}
+
+	if( ms_transport_resolve(&state.subscribers[state.nsubscribers],
+							 host, port) ) {
+		printf("warning: couldn't resolve subscriber %s:%s\n", host, port);
+		return -1;
+	}
+
+	state.nsubscribers++;
+	return 0;
+}
+
+static int open_layer(ms_device_t *dev, char *prefix, ms_layer_mode_t mode,
+					  int x, int y, int w, int h,
+					  const char *ahost, const char *aport) {
+	ms_layer_t *layer;
+
+	if( dev->nlayers >= MAX_LAYERS ) {
+		printf("warning: only %d layers per device, ignoring /%s\n",
+			   MAX_LAYERS, prefix);
+		goto err;
+	}
+
+	layer = &dev->layers[dev->nlayers];
+
+	layer->dev    = dev;
+	layer->prefix = prefix;
+	layer->mode   = mode;
+	ms_layer_set_region(layer, x, y, w, h);
+
+	if( build_templates(layer) ) {
+		printf("prefix /%s is too long\n", prefix);
+		goto err;
+	}
+
+	osc_sync_init(&layer->sync, 0);
+	layer->outgoing = ms_transport_app_address(ahost, aport);
+
+	if( ms_transport_resolve(&layer->app_dest, ahost, aport) )
+		printf("warning: couldn't resolve application address %s:%s, "
+			   "presses will only go to subscribers\n", ahost, aport);
+
+	ms_register_osc_methods(layer);
+
+	dev->nlayers++;
+	return 0;
+
+err:
+	free(prefix);
+	return 1;
+}
+
+static void close_layer(ms_layer_t *layer) {
+	ms_unregister_osc_methods(layer);
+
+	lo_address_free(layer->outgoing);
+	free(layer->prefix);
+}
+
+/* prefix[:mode[:x,y,w,h[:application-port]]], split in place */
+static int add_layer(ms_device_t *dev, char *spec,
+					 const char *ahost, const char *aport) {
+	char *mode, *region, *c;
+	int m, x, y, w, h;
+
+	mode = region = NULL;
+
+	if( (c = strchr(spec, ':')) ) {
+		*c++ = '\0';
+		mode = c;
+
+		if( (c = strchr(c, ':')) ) {
+			*c++ = '\0';
+			region = c;
+
+			if( (c = strchr(c, ':')) ) {
+				*c++ = '\0';
+
+				if( *c && (state.transport == LO_UNIX || is_numstr(c)) )
+					aport = c;
+				else
+					printf("warning: \"%s\" is not a valid application port.\n",
+						   c);
+			}
+		}
+	}
+
+	m = MS_LAYER_APP;
+
+	if( mode && *mode && (m = ms_layer_mode_from_str(mode)) < 0 ) {
+		printf("warning: \"%s\" is not a valid layer mode.\n", mode);
+		return 1;
+	}
+
+	x = y = 0;
+	w = h = 16;
+
+	if( region && *region &&
+		sscanf(region, "%d,%d,%d,%d", &x, &y, &w, &h) != 4 ) {
+		printf("warning: \"%s\" is not a valid region.\n", region);
+		return 1;
+	}
+
+	return open_layer(dev, strdup(spec), m, x, y, w, h, ahost, aport);
+}
+
+/* takes over monome, which is closed again if anything goes wrong */
+static int open_device(ms_device_t *dev, monome_t *monome, device_spec_t *spec,
+					   int spec_idx, int idx, const char *ahost,
+					   const char *aport) {
+	char *prefix;
+	int i;
+
+	memset(dev, 0, sizeof(*dev));
+
+	if( spec->prefix )
+		prefix = strdup(spec->prefix);
+	else if( !idx )
+		prefix = strdup(DEFAULT_OSC_PREFIX);
+	else
+		asprintf(&prefix, "%s%d", DEFAULT_OSC_PREFIX, idx);
+
+	if( spec->aport )
+		aport = spec->aport;
+
+	/* the first layer is the device's own prefix, and has focus */
+	if( open_layer(dev, prefix, MS_LAYER_APP, 0, 0, 16, 16, ahost, aport) )
+		goto err_layer;
+
+	if( ms_device_output_init(dev, link_baud, monome_get_proto(monome)) ) {
+		printf("monomeserial: couldn't set up output for %s\n", spec->device);
+		goto err;
+	}
+
+	if( ms_device_attach(dev, monome) )
+		goto err_watch;
+
+	for( i = 0; i < nlayer_specs; i++ )
+		if( layer_specs[i].device == spec_idx )
+			add_layer(dev, layer_specs[i].spec, ahost, aport);
+
+	return 0;
+
+err_watch:
+	ms_timer_del(&state.device_loop, &dev->link.timer);
+err:
+	close_layer(&dev->layers[0]);
+err_layer:
+	monome_close(monome);
+	return 1;
+}
+
+static void close_device(ms_device_t *dev) {
+	int i;
+
+	ms_timer_del(&state.device_loop, &dev->link.timer);
+
+	for( i = 0; i < dev->nlayers; i++ )
+		close_layer(&dev->layers[i]);
+
+	ms_device_detach(dev);
+}
+
+int main(int argc, char *argv[]) {
+	device_spec_t specs[MAX_DEVICES];
+	monome_open_request_t requests[MAX_DEVICES];
+	char *subscribers[MAX_SUBSCRIBERS];
+	char c, *sport, *aport, *ahost;
+	monome_cable_t orientation = MONOME_CABLE_LEFT;
+	ms_device_t *dev;
+	int i, j, nspecs, nsubscribers, device_cpu, network_cpu;
+	uint busy_poll = 0;
+	uint trace = 0;
+
+	state.transport = LO_UDP;
+
+	struct option arguments[] = {
+		{"help",             no_argument,       0, 'h'},
+
+		{"device",           required_argument, 0, 'd'},
+		{"all",              no_argument,       0, 'A'},
+		{"layer",            required_argument, 0, 'l'},
+		{"protocol",         required_argument, 0, 'p'},
+		{"baud",             required_argument, 0, 'b'},
+
+		{"server-port",      required_argument, 0, 's'},
+		{"application-port", required_argument, 0, 'a'},
+		{"application-host", required_argument, 0, 'o'},
+		{"transport",        required_argument, 0, 't'},
+		{"subscriber",       required_argument, 0, 'S'},
+
+		{"orientation",      required_argument, 0, 'r'},
+		{"report",           required_argument, 0, 'R'},
+
+		{"device-cpu",       required_argument, 0, 'D'},
+		{"network-cpu",      required_argument, 0, 'N'},
+		{"realtime",         optional_argument, 0, 'T'},
+		{"cpus",             required_argument, 0, 'C'},
+		{"busy-poll",        optional_argument, 0, 'B'},
+		{"trace",            optional_argument, 0, 'x'},
+		{0, 0, 0, 0}
+	};
+
+	nspecs = nsubscribers = 0;
+	device_cpu = network_cpu = -1;
+	state.realtime.priority = DEFAULT_RT_PRIORITY;
+	sport  = NULL;
+	aport  = NULL;
+	ahost  = DEFAULT_OSC_APP_HOST;
+
+	while( (c = getopt_long(argc, argv, "hd:Al:p:b:s:a:o:t:S:r:R:D:N:T::C:B::x::",
+							arguments, &i)) > 0 ) {
+		switch( c ) {
+		case 'h':
+			usage(argv[0]);
+			return 1;
+
+		case 'd':
+			nspecs = add_device_spec(specs, nspecs, optarg);
+			break;
+
+		case 'A':
+			nspecs = add_all_devices(specs, nspecs);
+			break;
+
+		case 'l':
+			/* layers given before any device go on the first one */
+			if( nlayer_specs < MAX_DEVICES * MAX_LAYERS ) {
+				layer_specs[nlayer_specs].device = (nspecs) ? nspecs - 1 : 0;
+				layer_specs[nlayer_specs].spec   = optarg;
+				nlayer_specs++;
+			}
+
+			break;
+
+		case 'p':
+			/* each device's protocol is whatever it was opened with */
+			break;
+
+		case 'b':
+			if( !is_numstr(optarg) || !(link_baud = atoi(optarg)) ) {
+				printf("warning: \"%s\" is not a valid baud rate.\n", optarg);
+				link_baud = DEFAULT_LINK_BAUD;
+			}
+
+			break;
+
+		case 'D':
+		case 'N':
+			if( !is_numstr(optarg) ) {
+				printf("warning: \"%s\" is not a valid cpu.\n", optarg);
+				break;
+			}
+
+			if( c == 'D' )
+				device_cpu = atoi(optarg);
+			else
+				network_cpu = atoi(optarg);
+
+			break;
+
+		case 'T':
+			state.realtime.enabled = 1;
+
+			if( optarg && is_numstr(optarg) )
+				state.realtime.priority = atoi(optarg);
+			else if( optarg )
+				printf("warning: \"%s\" is not a valid priority.\n", optarg);
+
+			break;
+
+		case 'C':
+			state.realtime.cpus = optarg;
+			break;
+
+		case 'B':
+			busy_poll = DEFAULT_BUSY_POLL;
+
+			if( optarg && is_numstr(optarg) )
+				busy_poll = atoi(optarg);
+			else if( optarg )
+				printf("warning: \"%s\" is not a valid idle time.\n", optarg);
+
+			break;
+
+		case 'x':
+			trace = DEFAULT_TRACE_EVENTS;
+
+			if( optarg && is_numstr(optarg) && atoi(optarg) > 0 &&
+				atoi(optarg) <= MAX_TRACE_EVENTS )
+				trace = atoi(optarg);
+			else if( optarg )
+				printf("warning: \"%s\" is not a valid trace size.\n", optarg);
+
+			break;
+
+		case 'R':
+			if( !is_numstr(optarg) )
+				printf("warning: \"%s\" is not a valid report interval.\n",
+					   optarg);
+			else
+				report_interval = atoi(optarg);
+
+			break;
+
+		case 's':
+			sport = optarg;
+			break;
+
+		case 'a':
+			aport = optarg;
+			break;
+
+		case 'o':
+			ahost = optarg;
+			break;
+
+		case 't':
+			if( !strcmp(optarg, "unix") )
+				state.transport = LO_UNIX;
+			else if( !strcmp(optarg, "tcp") )
+				state.transport = LO_TCP;
+			else if( !strcmp(optarg, "udp") )
+				state.transport = LO_UDP;
+			else
+				printf("warning: \"%s\" is not a valid transport.\n",
+					   optarg);
+
+			break;
+
+		case 'S':
+			if( nsubscribers < MAX_SUBSCRIBERS )
+				subscribers[nsubscribers++] = optarg;
+			else
+				printf("warning: only %d subscribers are supported, "
+					   "ignoring \"%s\"\n", MAX_SUBSCRIBERS, optarg);
+
+			break;
+
+		case 'r':
+			switch(*optarg) {
+			case 'l': orientation = MONOME_CABLE_LEFT;   break;
+			case 'b': orientation = MONOME_CABLE_BOTTOM; break;
+			case 'r': orientation = MONOME_CABLE_RIGHT;  break;
+			case 't': orientation = MONOME_CABLE_TOP;    break;
+			}
+			break;
+		}
+	}
+
+	if( state.transport == LO_UNIX ) {
+		/* ports are socket paths, anything goes */
+		if( !sport ) sport = DEFAULT_OSC_UNIX_SERVER_PATH;
+		if( !aport ) aport = DEFAULT_OSC_UNIX_APP_PATH;
+	} else {
+		if( sport && !is_numstr(sport) ) {
+			printf("warning: \"%s\" is not a valid server port.\n", sport);
+			sport = NULL;
+		}
+
+		if( aport && !is_numstr(aport) ) {
+			printf("warning: \"%s\" is not a valid application port.\n",
+				   aport);
+			aport = NULL;
+		}
+
+		for( i = 0; i < nspecs; i++ )
+			if( specs[i].aport && !is_numstr(specs[i].aport) ) {
+				printf("warning: \"%s\" is not a valid application port.\n",
+					   specs[i].aport);
+				specs[i].aport = NULL;
+			}
+
+		if( !sport ) sport = DEFAULT_OSC_SERVER_PORT;
+		if( !aport ) aport = DEFAULT_OSC_APP_PORT;
+	}
+
+	if( !nspecs )
+		nspecs = add_device_spec(specs, 0, DEFAULT_MONOME_DEVICE);
+
+	/* a bare prefix on the command line names the first device */
+	if( optind < argc && !specs[0].prefix )
+		specs[0].prefix = argv[optind];
+
+	if( ms_event_loop_init(&state.device_loop) ||
+		ms_event_loop_init(&state.network_loop) ||
+		ms_pipeline_init() || ms_hotplug_init() ||
+		ms_transport_open(sport) )
+		return EXIT_FAILURE;
+
+	state.device_loop.busy_poll  = busy_poll;
+	state.network_loop.busy_poll = busy_poll;
+
+	/* the server has to be up first, subscriber addresses have to match
+	   the family of its socket. */
+	for( i = 0; i < nsubscribers; i++ )
+		add_subscriber(subscribers[i]);
+
+	/* every device gets opened and cleared at once, it's the slowest
+	   part of starting up with more than one. */
+	for( i = 0; i < nspecs; i++ ) {
+		requests[i].dev  = specs[i].device;
+		requests[i].port = NULL;
+	}
+
+	monome_open_many(requests, nspecs, 0, MONOME_OPEN_CLEAR);
+
+	for( i = 0; i < nspecs; i++ ) {
+		dev = &state.devices[state.ndevices];
+
+		if( !requests[i].monome ) {
+			printf("failed to open %s: %s\n", specs[i].device,
+				   strerror(requests[i].error));
+			continue;
+		}
+
+		if( open_device(dev, requests[i].monome, &specs[i], i,
+						state.ndevices, ahost, aport) )
+			continue;
+
+		monome_set_orientation(dev->monome, orientation);
+		state.ndevices++;
+	}
+
+	if( !state.ndevices )
+		return EXIT_FAILURE;
+
+	ms_register_sys_methods();
+
+	if( ms_sync_ack_start() )
+		printf("warning: couldn't start the sync ack timer\n");
+
+	if( trace && monome_trace_start(trace) )
+		printf("warning: couldn't allocate the trace buffer\n");
+
+	if( report_interval &&
+		!ms_timer_add(&state.network_loop, &report_timer, report_cb, NULL) )
+		ms_timer_arm(&report_timer, (uint64_t) report_interval * 1000000);
+
+	printf("monomeserial version %s, yay!\n\n", VERSION);
+
+	for( i = 0; i < state.ndevices; i++ ) {
+		dev = &state.devices[i];
+
+		printf("initialized device %s at %s, which is %dx%d\n",
+			   dev->serial, dev->devpath, dev->rows, dev->cols);
+		printf("running with prefix /%s", dev->layers[0].prefix);
+
+		for( j = 1; j < dev->nlayers; j++ )
+			printf(", /%s", dev->layers[j].prefix);
+
+		printf("\n\n");
+	}
+
+	/* everything logged from the device and network threads gets
+	   written out from here, so neither of them ever waits on stderr.
+	   it's started before anything goes realtime or gets pinned, so it
+	   stays an ordinary thread and doesn't compete with them. */
+	if( monome_log_start_thread() )
+		printf("warning: couldn't start the log thread\n");
+
+	/* before the device thread starts, so it inherits the cpu set */
+	ms_realtime_process(&state.realtime);
+
+	monome_trace_thread("network");
+	ms_realtime_thread(&state.realtime, "network");
+
+	/* a couple of hundred milliseconds of sleeping, so it's done before
+	   the device thread starts handing us presses */
+	ms_realtime_selftest(&state.realtime);
+
+	if( ms_pipeline_start(device_cpu, network_cpu) )
+		return EXIT_FAILURE;
+
+	ms_event_loop_run(&state.network_loop);
+	monome_log_flush();
+
+	for( i = 0; i < state.ndevices; i++ )
+		close_device(&state.devices[i]);
+
+	lo_server_free(state.server);
+	return EXIT_SUCCESS;
+}
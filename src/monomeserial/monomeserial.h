@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MONOMESERIAL_H
+#define _MONOMESERIAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <lo/lo.h>
+#include <monome.h>
+
+#include "../proto/osc_stream.h"
+#include "../proto/osc_sync.h"
+
+#define DEFAULT_OSC_PREFIX      "monome"
+#define DEFAULT_OSC_SERVER_PORT "8080"
+#define DEFAULT_OSC_APP_PORT    "8000"
+#define DEFAULT_OSC_APP_HOST    "127.0.0.1"
+
+#define DEFAULT_OSC_UNIX_SERVER_PATH "/tmp/monomeserial.sock"
+#define DEFAULT_OSC_UNIX_APP_PATH    "/tmp/monomeserial-app.sock"
+
+#define DEFAULT_LINK_BAUD       115200
+#define DEFAULT_RT_PRIORITY     40
+#define DEFAULT_BUSY_POLL       100000 /* microseconds */
+#define DEFAULT_TRACE_EVENTS    65536
+#define MAX_TRACE_EVENTS        (1 << 20) /* about 48MB of ring */
+#define DEFAULT_TRACE_PATH      "/tmp/monomeserial-%d.json" /* pid */
+
+#define MAX_DEVICES             16
+#define MAX_STREAM_CLIENTS      8
+#define MAX_SUBSCRIBERS         8
+#define MAX_LAYERS              8
+#define MAX_STATS_WATCHERS      4
+
+#define MAX_WATCHES (MAX_DEVICES + MAX_STREAM_CLIENTS + 8)
+#define MAX_TIMERS  (MAX_DEVICES + MAX_STATS_WATCHERS + 8)
+
+#define MS_LATENCY_BUCKETS      32
+
+/* how often the /sys message rates are worked out */
+#define SYS_RATE_INTERVAL       1000000 /* microseconds */
+
+/* how often a device that's gone away is looked for, if nothing says
+   it's worth looking sooner */
+#define HOTPLUG_RETRY_INTERVAL  250000 /* microseconds */
+
+/* how often a layer that's receiving delta sync repeats its last ack, so
+   a sender whose last update got lost finds out */
+#define SYNC_ACK_INTERVAL       500000 /* microseconds */
+
+/* both must be powers of two */
+#define PRESS_QUEUE_SIZE        1024
+#define DEVICE_QUEUE_SIZE       256
+
+/* room for "/<prefix>/press" plus its type tags and three ints */
+#define PRESS_MSG_MAX           128
+
+/* incoming LED messages that get matched without liblo, per layer: /led,
+   /led_row and /led_col with one or two bytes, /frame with and without a
+   quadrant, and /map */
+#define LED_TEMPLATES           8
+
+#ifdef DEBUG
+#define DPRINTF(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DPRINTF(...) ((void) 0)
+#endif
+
+typedef struct ms_watch ms_watch_t;
+typedef struct ms_timer ms_timer_t;
+typedef struct ms_event_loop ms_event_loop_t;
+typedef struct ms_msg ms_msg_t;
+typedef struct ms_queue ms_queue_t;
+typedef struct ms_latency ms_latency_t;
+typedef struct ms_dest ms_dest_t;
+typedef struct ms_template ms_template_t;
+typedef struct ms_link ms_link_t;
+typedef struct ms_layer ms_layer_t;
+typedef struct ms_device ms_device_t;
+typedef struct ms_realtime ms_realtime_t;
+typedef struct ms_stats_watcher ms_stats_watcher_t;
+typedef struct ms_sys ms_sys_t;
+typedef struct ms_state ms_state_t;
+
+typedef void (*ms_watch_cb_t)(ms_watch_t *watch);
+typedef void (*ms_timer_cb_t)(ms_timer_t *timer);
+
+/* how a layer's framebuffer goes into what's shown on the device.
+   APP layers are full-grid applications, only the focused one is
+   visible.  the rest are drawn over it in order, limited to their
+   region: SPLIT replaces what's underneath, OR and XOR combine with it,
+   and MASK only lets through what's lit in the layer. */
+typedef enum {
+	MS_LAYER_APP,
+	MS_LAYER_SPLIT,
+	MS_LAYER_OR,
+	MS_LAYER_XOR,
+	MS_LAYER_MASK
+} ms_layer_mode_t;
+
+/* anything with a file descriptor that the event loop should wake up for.
+   that's when it's readable, and also when it's writable if asked. */
+struct ms_watch {
+	int fd;
+	int writable;
+	ms_watch_cb_t cb;
+	void *data;
+};
+
+/* a one-shot timeout, run from the event loop */
+struct ms_timer {
+	uint64_t deadline; /* microseconds, 0 if not armed */
+	ms_timer_cb_t cb;
+	void *data;
+};
+
+struct ms_event_loop {
+#ifdef __linux__
+	int epoll_fd;
+#else
+	ms_watch_t *watches[MAX_WATCHES];
+#endif
+	ms_timer_t *timers[MAX_TIMERS];
+
+	/* if set, spin without sleeping until nothing has happened for this
+	   many microseconds, then go back to blocking */
+	uint64_t busy_poll;
+	uint64_t last_active;
+};
+
+/* what goes between the device thread and the network thread */
+typedef enum {
+	MS_MSG_PRESS,     /* device -> network, a = x, b = y, c = event type */
+	MS_MSG_GRID,      /* network -> device, a new composited grid */
+	MS_MSG_INTENSITY  /* network -> device, a = brightness */
+} ms_msg_type_t;
+
+struct ms_msg {
+	uint8_t type;
+	uint8_t device;
+	uint8_t a, b, c;
+
+	uint64_t stamp;  /* when the device thread woke up for a press */
+};
+
+struct ms_latency {
+	unsigned long buckets[MS_LATENCY_BUCKETS];
+	unsigned long count;
+	uint64_t max;
+};
+
+/* single producer, single consumer ring.  the producer only ever writes
+   tail and the consumer only ever writes head, so neither needs a lock.
+   the consumer sleeps in its event loop on the read end of a pipe, which
+   the producer only writes to if it hasn't already since the consumer
+   last woke up. */
+struct ms_queue {
+	ms_msg_t *msgs;
+	uint mask;
+
+	uint head __attribute__((aligned(64)));
+	uint tail __attribute__((aligned(64)));
+	int signalled __attribute__((aligned(64)));
+
+	unsigned long dropped;
+
+	int pipe[2];
+	ms_watch_t watch;
+};
+
+/* the serialised path and type tags of an incoming message, which
+   everything up to its arguments has to match byte for byte */
+struct ms_template {
+	uint8_t head[PRESS_MSG_MAX];
+	size_t len;
+};
+
+/* a resolved datagram destination, ready to hand to sendmmsg() */
+struct ms_dest {
+	struct sockaddr_storage addr;
+	socklen_t len;
+};
+
+/* one client of a device.  every layer has its own prefix, application
+   address and bit-packed framebuffer (which is the grid in its sync
+   state, so delta sync and plain led messages land in the same place). */
+struct ms_layer {
+	ms_device_t *dev;
+	char *prefix;
+
+	ms_layer_mode_t mode;
+	osc_sync_grid_t region;
+
+	lo_address outgoing;
+	ms_dest_t app_dest;
+	osc_sync_t sync;
+
+	/* a serialised /<prefix>/press message, the three int arguments are
+	   the last 12 bytes and get patched in place for every event. */
+	uint8_t press_msg[PRESS_MSG_MAX];
+	size_t press_len;
+
+	/* /<prefix>/sync/ack and /sync/resync, sequence number last */
+	uint8_t ack_msg[PRESS_MSG_MAX];
+	uint8_t resync_msg[PRESS_MSG_MAX];
+	size_t ack_len;
+	size_t resync_len;
+
+	/* LED messages to this layer, see osc_methods.c */
+	ms_template_t led_in[LED_TEMPLATES];
+};
+
+/* the serial link to a device, as a token bucket of wire time.  updates
+   are only sent when there's credit for them, if there isn't the device
+   is left pending and whatever the composited state is by the time
+   there's room goes out instead. */
+struct ms_link {
+	uint byte_time;   /* microseconds one byte takes on the wire */
+	uint led_bytes;
+	uint frame_bytes;
+
+	int64_t credit;   /* microseconds of wire time we can spend */
+	int64_t burst;
+	uint64_t last;
+
+	int pending;
+	uint backlog;     /* bytes of it, as of when it was held back */
+	ms_timer_t timer;
+
+	/* updates, bytes and deferred belong to the device thread and the
+	   rest to the network thread.  /sys reads all of them from the
+	   network thread, hence the atomics on the device thread's side. */
+	struct {
+		unsigned long commands; /* drawing commands from applications */
+		unsigned long updates;  /* led and frame messages to the device */
+		unsigned long bytes;
+		unsigned long deferred;
+		unsigned long coalesced; /* commands that didn't need an update */
+	} stats;
+};
+
+struct ms_device {
+	monome_t *monome;
+
+	ms_layer_t layers[MAX_LAYERS];
+	int nlayers;
+	int focus;
+
+	/* the composited grid as the network thread last saw it, and as it's
+	   handed over to the device thread.  there's only one writer, so a
+	   sequence count is all the locking the handover needs. */
+	osc_sync_grid_t composited;
+	struct {
+		uint seq;
+		osc_sync_grid_t grid;
+	} target;
+	int notified;
+
+	/* the composited grid as last pushed to the device */
+	osc_sync_grid_t shown;
+
+	/* which layer each held button went down on (plus one, 0 if it isn't
+	   held), so the release goes to the same place even if focus changed
+	   in between */
+	uint8_t held_by[16][16];
+
+	/* device thread, a bit per button that's down on the device itself */
+	uint16_t held[16];
+
+	ms_link_t link;
+	ms_watch_t watch;
+	uint64_t wakeup;
+
+	unsigned long presses; /* forwarded to applications */
+
+	/* as it was first opened, so it can be found again if it goes away
+	   (monome is NULL until it's back, see hotplug.c).  these don't
+	   change after that, the network thread reads them for /sys. */
+	char serial[MONOME_SERIAL_MAX];
+	char devpath[MONOME_DEVPATH_MAX];
+	int rows, cols;
+
+	/* device thread, what to put back when it comes back */
+	monome_cable_t orientation;
+	int intensity; /* -1 if nobody's set one */
+	int mismatched; /* times it came back the wrong size */
+};
+
+struct ms_realtime {
+	int enabled;
+	int priority;   /* SCHED_FIFO */
+	const char *cpus;
+};
+
+/* someone who asked for /sys/stats every so often.  addr is NULL over
+   TCP, where everything goes to every connected client anyway. */
+struct ms_stats_watcher {
+	int active;
+	lo_address addr;
+	uint64_t interval;
+	ms_timer_t timer;
+};
+
+struct ms_sys {
+	/* totals as of the last rate sample */
+	unsigned long in, out;
+	float in_rate, out_rate;
+	ms_timer_t rate_timer;
+
+	ms_stats_watcher_t watchers[MAX_STATS_WATCHERS];
+};
+
+struct ms_state {
+	ms_device_t devices[MAX_DEVICES];
+	int ndevices;
+
+	/* the device thread owns the monome_t's and their links, the network
+	   thread (which is the main thread) owns everything else. */
+	ms_event_loop_t device_loop;
+	ms_event_loop_t network_loop;
+
+	ms_queue_t to_device;
+	ms_queue_t to_network;
+
+	ms_realtime_t realtime;
+
+	/* from the device thread waking up to the press going out */
+	ms_latency_t press_latency;
+
+	ms_sys_t sys;
+
+	lo_server server;
+	ms_watch_t server_watch;
+
+	int transport;
+	ms_watch_t stream_watch;
+
+	osc_stream_t streams[MAX_STREAM_CLIENTS];
+	ms_watch_t stream_watches[MAX_STREAM_CLIENTS];
+
+	ms_dest_t subscribers[MAX_SUBSCRIBERS];
+	int nsubscribers;
+};
+
+extern ms_state_t state;
+
+/* event_loop.c */
+int ms_event_loop_init(ms_event_loop_t *loop);
+int ms_watch_add(ms_event_loop_t *loop, ms_watch_t *watch, int fd,
+				 ms_watch_cb_t cb, void *data);
+void ms_watch_del(ms_event_loop_t *loop, ms_watch_t *watch);
+void ms_watch_want_write(ms_event_loop_t *loop, ms_watch_t *watch, int on);
+void ms_event_loop_run(ms_event_loop_t *loop);
+
+uint64_t ms_now();
+int ms_timer_add(ms_event_loop_t *loop, ms_timer_t *timer,
+				 ms_timer_cb_t cb, void *data);
+void ms_timer_del(ms_event_loop_t *loop, ms_timer_t *timer);
+void ms_timer_arm(ms_timer_t *timer, uint64_t delay);
+
+/* queue.c */
+int ms_queue_init(ms_queue_t *q, uint size);
+int ms_queue_push(ms_queue_t *q, const ms_msg_t *msg);
+int ms_queue_pop(ms_queue_t *q, ms_msg_t *msg);
+void ms_queue_rearm(ms_queue_t *q);
+
+/* pipeline.c */
+int ms_pipeline_init();
+int ms_pipeline_start(int device_cpu, int network_cpu);
+void ms_pipeline_press(ms_device_t *dev, const monome_event_t *e);
+void ms_pipeline_grid(ms_device_t *dev);
+void ms_pipeline_intensity(ms_device_t *dev, uint brightness);
+
+/* transport.c */
+int ms_transport_open(const char *sport);
+lo_address ms_transport_app_address(const char *ahost, const char *aport);
+int ms_transport_resolve(ms_dest_t *dest, const char *host, const char *port);
+void ms_send_to_app(ms_layer_t *layer, const char *path, lo_message msg);
+void ms_send_raw_to_app(ms_layer_t *layer, const void *buf, size_t len);
+void ms_send_reply(lo_address to, const char *path, lo_message msg);
+void ms_fan_out(ms_layer_t *layer, const void *buf, size_t len);
+
+/* link.c */
+void ms_link_init(ms_link_t *link, uint baud, const char *proto);
+uint64_t ms_link_spend(ms_link_t *link, uint bytes);
+void ms_link_report(ms_link_t *link, const char *name);
+
+/* compositor.c */
+int ms_layer_mode_from_str(const char *str);
+void ms_layer_set_region(ms_layer_t *layer, int x, int y, int w, int h);
+ms_layer_t *ms_device_layer_at(ms_device_t *dev, uint x, uint y);
+int ms_device_focus(ms_device_t *dev, int idx);
+int ms_device_output_init(ms_device_t *dev, uint baud, const char *proto);
+void ms_device_refresh(ms_device_t *dev);
+void ms_device_output(ms_device_t *dev);
+void ms_device_repaint(ms_device_t *dev);
+
+/* hotplug.c */
+int ms_hotplug_init();
+int ms_device_attach(ms_device_t *dev, monome_t *monome);
+void ms_device_detach(ms_device_t *dev);
+
+/* latency.c */
+void ms_latency_record(ms_latency_t *lat, uint64_t usec);
+uint64_t ms_latency_percentile(const ms_latency_t *lat, uint percent);
+void ms_latency_report(const ms_latency_t *lat, const char *what);
+void ms_latency_reset(ms_latency_t *lat);
+
+/* realtime.c */
+void ms_realtime_process(const ms_realtime_t *rt);
+void ms_realtime_thread(const ms_realtime_t *rt, const char *name);
+void ms_realtime_selftest(const ms_realtime_t *rt);
+
+/* osc_methods.c */
+void ms_register_osc_methods(ms_layer_t *layer);
+void ms_unregister_osc_methods(ms_layer_t *layer);
+int ms_osc_dispatch_led(const uint8_t *buf, size_t len);
+int ms_sync_ack_start();
+
+/* sys.c */
+void ms_register_sys_methods();
+int ms_sys_trace_dump();
+
+#endif /* defined _MONOMESERIAL_H */
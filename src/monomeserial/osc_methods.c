@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include <lo/lo.h>
+#include <monome.h>
+
+#include "monomeserial.h"
+
+static ms_timer_t sync_ack_timer;
+
+static int osc_clear_handler(const char *path, const char *types,
+							 lo_arg **argv, int argc,
+							 lo_message data, void *user_data) {
+	ms_layer_t *layer = user_data;
+	int mode = (argc) ? argv[0]->i : 0;
+
+	osc_sync_grid_clear(&layer->sync.grid, mode);
+	ms_device_refresh(layer->dev);
+
+	return 0;
+}
+
+static int osc_intensity_handler(const char *path, const char *types,
+								 lo_arg **argv, int argc,
+								 lo_message data, void *user_data) {
+	ms_layer_t *layer = user_data;
+	int intensity = (argc) ? argv[0]->i : 0xF;
+
+	/* there's only one brightness, whoever asks last gets it */
+	ms_pipeline_intensity(layer->dev, intensity);
+	return 0;
+}
+
+/* the LED messages themselves, shared by liblo's handlers below and the
+   templates further down */
+
+static int layer_led(ms_layer_t *layer, int x, int y, int on) {
+	if( x > 15 || x < 0 || y > 15 || y < 0 || on > 1 || on < 0 )
+		return -1;
+
+	osc_sync_grid_led(&layer->sync.grid, x, y, on);
+	ms_device_refresh(layer->dev);
+
+	return 0;
+}
+
+static int layer_led_col_row(ms_layer_t *layer, int col, int idx,
+							 int count, const int32_t *data) {
+	uint8_t buf[2] = {data[0]};
+
+	if( count == 2 )
+		buf[1] = data[1];
+
+	if( col )
+		osc_sync_grid_col(&layer->sync.grid, idx, count, buf);
+	else
+		osc_sync_grid_row(&layer->sync.grid, idx, count, buf);
+
+	ms_device_refresh(layer->dev);
+	return 0;
+}
+
+static int layer_frame(ms_layer_t *layer, int quadrant, const int32_t *data) {
+	uint8_t buf[8];
+	uint i;
+
+	if( quadrant < 0 || quadrant > 3 )
+		return -1;
+
+	for( i = 0; i < 8; i++ )
+		buf[i] = data[i];
+
+	osc_sync_grid_frame(&layer->sync.grid, quadrant, buf);
+	ms_device_refresh(layer->dev);
+
+	return 0;
+}
+
+static int layer_map(ms_layer_t *layer, int x_off, int y_off, int cols,
+					 int rows, const uint8_t *map, size_t size) {
+	uint8_t frame[8], mask;
+	int stride, x, y, i;
+
+	stride = (cols + 7) / 8;
+
+	/* offsets have to land on a quadrant, same as for the serial device */
+	if( x_off < 0 || y_off < 0 || (x_off | y_off) & 7 ||
+		cols < 1 || rows < 1 || x_off + cols > 16 || y_off + rows > 16 ||
+		size < rows * stride )
+		return -1;
+
+	if( !x_off && !y_off )
+		osc_sync_grid_map(&layer->sync.grid, cols, rows, map);
+	else
+		for( y = 0; y < rows; y += 8 )
+			for( x = 0; x < cols; x += 8 ) {
+				/* padding bits past the last column don't get to light
+				   anything up */
+				mask = (cols - x < 8) ? (1 << (cols - x)) - 1 : 0xFF;
+
+				for( i = 0; i < 8; i++ )
+					frame[i] = (y + i < rows) ? map[(y + i) * stride + x / 8] & mask : 0;
+
+				osc_sync_grid_frame(&layer->sync.grid,
+									((y_off + y) / 8) * 2 + (x_off + x) / 8,
+									frame);
+			}
+
+	ms_device_refresh(layer->dev);
+	return 0;
+}
+
+static int osc_led_handler(const char *path, const char *types,
+						   lo_arg **argv, int argc,
+						   lo_message data, void *user_data) {
+	return layer_led(user_data, argv[0]->i, argv[1]->i, argv[2]->i);
+}
+
+static int osc_led_col_row_handler(const char *path, const char *types,
+								   lo_arg **argv, int argc,
+								   lo_message data, void *user_data) {
+	int32_t buf[2] = {argv[1]->i};
+
+	if( argc == 3 )
+		buf[1] = argv[2]->i;
+
+	return layer_led_col_row(user_data, !!strstr(path, "led_col"),
+							 argv[0]->i, argc - 1, buf);
+}
+
+static int osc_frame_handler(const char *path, const char *types,
+							 lo_arg **argv, int argc,
+							 lo_message data, void *user_data) {
+	int32_t buf[8];
+	uint i;
+
+	for( i = 0; i < 8; i++ )
+		buf[i] = argv[i]->i;
+
+	switch( argc ) {
+	case 8:
+		return layer_frame(user_data, 0, buf);
+
+	case 9:
+		return layer_frame(user_data, argv[8]->i, buf);
+
+	default:
+		/**
+		 * okay, this isn't implemented yet.
+		 * passing 10 arguments to /frame means you want to offset
+		 * it by argv[8] and argv[9].
+		 *
+		 * thing is, there's no clean mapping to the serial protocol,
+		 * so this is going to have to wait.
+		 */
+		return -1;
+	}
+}
+
+static int osc_map_handler(const char *path, const char *types,
+						   lo_arg **argv, int argc,
+						   lo_message data, void *user_data) {
+	lo_blob blob = (lo_blob) argv[4];
+
+	return layer_map(user_data, argv[0]->i, argv[1]->i, argv[2]->i,
+					 argv[3]->i, lo_blob_dataptr(blob),
+					 lo_blob_datasize(blob));
+}
+
+/* LED messages are nearly everything that comes in, and liblo allocates a
+   message and its arguments for every one it dispatches.  so each layer
+   has the path and type tags of each of them serialised up front, and a
+   packet that starts with one of those gets its arguments picked out
+   here instead.  anything else, or anything that doesn't add up, is left
+   for liblo. */
+
+typedef enum {
+	LED_IN,
+	LED_ROW_IN,
+	LED_ROW2_IN,
+	LED_COL_IN,
+	LED_COL2_IN,
+	FRAME_IN,
+	FRAME_QUADRANT_IN,
+	MAP_IN
+} led_in_t;
+
+static const struct {
+	const char *what;
+	const char *types;
+} led_in_specs[LED_TEMPLATES] = {
+	[LED_IN]            = {"led",     "iii"},
+	[LED_ROW_IN]        = {"led_row", "ii"},
+	[LED_ROW2_IN]       = {"led_row", "iii"},
+	[LED_COL_IN]        = {"led_col", "ii"},
+	[LED_COL2_IN]       = {"led_col", "iii"},
+	[FRAME_IN]          = {"frame",   "iiiiiiii"},
+	[FRAME_QUADRANT_IN] = {"frame",   "iiiiiiiii"},
+	[MAP_IN]            = {"map",     "iiiib"}
+};
+
+/* OSC strings are nul-terminated and padded out to a multiple of 4 */
+static uint8_t *put_string(uint8_t *p, const uint8_t *end, const char *str) {
+	size_t len = strlen(str), padded = (len + 4) & ~3;
+
+	if( padded > end - p )
+		return NULL;
+
+	memcpy(p, str, len);
+	memset(p + len, 0, padded - len);
+
+	return p + padded;
+}
+
+static void build_led_templates(ms_layer_t *layer) {
+	char path[PRESS_MSG_MAX], types[16];
+	ms_template_t *t;
+	uint8_t *p;
+	int i;
+
+	for( i = 0; i < LED_TEMPLATES; i++ ) {
+		t = &layer->led_in[i];
+
+		snprintf(path, sizeof(path), "/%s/%s", layer->prefix,
+				 led_in_specs[i].what);
+		snprintf(types, sizeof(types), ",%s", led_in_specs[i].types);
+
+		/* a prefix too long to fit just means liblo gets all of them */
+		if( !(p = put_string(t->head, t->head + sizeof(t->head), path)) ||
+			!(p = put_string(p, t->head + sizeof(t->head), types)) )
+			t->len = 0;
+		else
+			t->len = p - t->head;
+	}
+}
+
+static int32_t get_int(const uint8_t *p) {
+	uint32_t i;
+
+	memcpy(&i, p, sizeof(i));
+	return (int32_t) ntohl(i);
+}
+
+static int dispatch_led(ms_layer_t *layer, led_in_t what,
+						const uint8_t *args, size_t len) {
+	int32_t argv[9];
+	size_t nargs, blob;
+	uint i;
+
+	nargs = strlen(led_in_specs[what].types) - (what == MAP_IN);
+
+	if( len < nargs * 4 || (what != MAP_IN && len != nargs * 4) )
+		return 0;
+
+	for( i = 0; i < nargs; i++ )
+		argv[i] = get_int(args + i * 4);
+
+	switch( what ) {
+	case LED_IN:
+		layer_led(layer, argv[0], argv[1], argv[2]);
+		return 1;
+
+	case LED_ROW_IN:
+	case LED_ROW2_IN:
+	case LED_COL_IN:
+	case LED_COL2_IN:
+		layer_led_col_row(layer, what >= LED_COL_IN, argv[0], nargs - 1,
+						  &argv[1]);
+		return 1;
+
+	case FRAME_IN:
+	case FRAME_QUADRANT_IN:
+		layer_frame(layer, (what == FRAME_IN) ? 0 : argv[8], argv);
+		return 1;
+
+	case MAP_IN:
+		/* the blob's size, then the blob, padded out to 4 */
+		if( len < 20 || (blob = get_int(args + 16)) > len - 20 ||
+			len - 20 != ((blob + 3) & ~3) )
+			return 0;
+
+		layer_map(layer, argv[0], argv[1], argv[2], argv[3], args + 20, blob);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void send_sync_reply(ms_layer_t *layer, uint8_t *msg, size_t len,
+							uint32_t seq) {
+	seq = htonl(seq);
+	memcpy(msg + len - sizeof(seq), &seq, sizeof(seq));
+	ms_send_raw_to_app(layer, msg, len);
+}
+
+static int osc_sync_handler(const char *path, const char *types,
+							lo_arg **argv, int argc,
+							lo_message data, void *user_data) {
+	ms_layer_t *layer = user_data;
+	lo_blob blob = (lo_blob) argv[argc - 1];
+	int ret;
+
+	if( argc == 2 )
+		ret = osc_sync_apply_key(&layer->sync, argv[0]->i,
+								 lo_blob_dataptr(blob), lo_blob_datasize(blob));
+	else
+		ret = osc_sync_apply_delta(&layer->sync, argv[0]->i, argv[1]->i,
+								   lo_blob_dataptr(blob), lo_blob_datasize(blob));
+
+	if( ret > 0 ) {
+		ms_device_refresh(layer->dev);
+		send_sync_reply(layer, layer->ack_msg, layer->ack_len, layer->sync.seq);
+	} else if( ret < 0 )
+		send_sync_reply(layer, layer->resync_msg, layer->resync_len,
+						layer->sync.seq);
+
+	return 0;
+}
+
+static void sync_ack_cb(ms_timer_t *timer) {
+	ms_layer_t *layer;
+	int i, j;
+
+	for( i = 0; i < state.ndevices; i++ )
+		for( j = 0; j < state.devices[i].nlayers; j++ ) {
+			layer = &state.devices[i].layers[j];
+
+			if( layer->sync.seq )
+				send_sync_reply(layer, layer->ack_msg, layer->ack_len,
+								layer->sync.seq);
+		}
+
+	ms_timer_arm(timer, SYNC_ACK_INTERVAL);
+}
+
+/* no arguments focuses the layer the message was sent to, otherwise it's
+   another layer on the same device, by prefix or by index. */
+static int osc_focus_handler(const char *path, const char *types,
+							 lo_arg **argv, int argc,
+							 lo_message data, void *user_data) {
+	ms_layer_t *layer = user_data;
+	ms_device_t *dev = layer->dev;
+	int i;
+
+	if( !argc )
+		return ms_device_focus(dev, layer - dev->layers);
+
+	if( types[0] == 'i' )
+		return ms_device_focus(dev, argv[0]->i);
+
+	for( i = 0; i < dev->nlayers; i++ )
+		if( !strcmp(dev->layers[i].prefix, &argv[0]->s) )
+			return ms_device_focus(dev, i);
+
+	return -1;
+}
+
+static int osc_region_handler(const char *path, const char *types,
+							  lo_arg **argv, int argc,
+							  lo_message data, void *user_data) {
+	ms_layer_t *layer = user_data;
+
+	ms_layer_set_region(layer, argv[0]->i, argv[1]->i, argv[2]->i, argv[3]->i);
+	ms_device_refresh(layer->dev);
+
+	return 0;
+}
+
+/* returns 1 if buf was an LED message for one of the layers, and has been
+   dealt with.  0 means it's liblo's. */
+int ms_osc_dispatch_led(const uint8_t *buf, size_t len) {
+	ms_template_t *t;
+	ms_layer_t *layer;
+	int i, j, k;
+
+	for( i = 0; i < state.ndevices; i++ )
+		for( j = 0; j < state.devices[i].nlayers; j++ ) {
+			layer = &state.devices[i].layers[j];
+
+			for( k = 0; k < LED_TEMPLATES; k++ ) {
+				t = &layer->led_in[k];
+
+				if( t->len && len >= t->len && !memcmp(buf, t->head, t->len) )
+					return dispatch_led(layer, k, buf + t->len, len - t->len);
+			}
+		}
+
+	return 0;
+}
+
+void ms_register_osc_methods(ms_layer_t *layer) {
+	lo_server srv = state.server;
+	char *prefix = layer->prefix;
+	char *cmd_buf;
+
+	build_led_templates(layer);
+
+	asprintf(&cmd_buf, "/%s/clear", prefix);
+	lo_server_add_method(srv, cmd_buf, "", osc_clear_handler, layer);
+	lo_server_add_method(srv, cmd_buf, "i", osc_clear_handler, layer);
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/intensity", prefix);
+	lo_server_add_method(srv, cmd_buf, "", osc_intensity_handler, layer);
+	lo_server_add_method(srv, cmd_buf, "i", osc_intensity_handler, layer);
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/led", prefix);
+	lo_server_add_method(srv, cmd_buf, "iii", osc_led_handler, layer);
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/led_row", prefix);
+	lo_server_add_method(srv, cmd_buf, "ii", osc_led_col_row_handler, layer);
+	lo_server_add_method(srv, cmd_buf, "iii", osc_led_col_row_handler, layer);
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/led_col", prefix);
+	lo_server_add_method(srv, cmd_buf, "ii", osc_led_col_row_handler, layer);
+	lo_server_add_method(srv, cmd_buf, "iii", osc_led_col_row_handler, layer);
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/frame", prefix);
+	lo_server_add_method(srv, cmd_buf, "iiiiiiii", osc_frame_handler, layer);
+	lo_server_add_method(srv, cmd_buf, "iiiiiiiii", osc_frame_handler, layer);
+	lo_server_add_method(srv, cmd_buf, "iiiiiiiiii",
+						 osc_frame_handler, layer);
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/map", prefix);
+	lo_server_add_method(srv, cmd_buf, "iiiib", osc_map_handler, layer);
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/sync/delta", prefix);
+	lo_server_add_method(srv, cmd_buf, "iib", osc_sync_handler, layer);
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/sync/key", prefix);
+	lo_server_add_method(srv, cmd_buf, "ib", osc_sync_handler, layer);
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/focus", prefix);
+	lo_server_add_method(srv, cmd_buf, "", osc_focus_handler, layer);
+	lo_server_add_method(srv, cmd_buf, "i", osc_focus_handler, layer);
+	lo_server_add_method(srv, cmd_buf, "s", osc_focus_handler, layer);
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/region", prefix);
+	lo_server_add_method(srv, cmd_buf, "iiii", osc_region_handler, layer);
+	free(cmd_buf);
+}
+
+void ms_unregister_osc_methods(ms_layer_t *layer) {
+	lo_server srv = state.server;
+	char *prefix = layer->prefix;
+	char *cmd_buf;
+	int i;
+
+	for( i = 0; i < LED_TEMPLATES; i++ )
+		layer->led_in[i].len = 0;
+
+	asprintf(&cmd_buf, "/%s/clear", prefix);
+	lo_server_del_method(srv, cmd_buf, "");
+	lo_server_del_method(srv, cmd_buf, "i");
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/intensity", prefix);
+	lo_server_del_method(srv, cmd_buf, "");
+	lo_server_del_method(srv, cmd_buf, "i");
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/led", prefix);
+	lo_server_del_method(srv, cmd_buf, "iii");
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/led_row", prefix);
+	lo_server_del_method(srv, cmd_buf, "ii");
+	lo_server_del_method(srv, cmd_buf, "iii");
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/led_col", prefix);
+	lo_server_del_method(srv, cmd_buf, "ii");
+	lo_server_del_method(srv, cmd_buf, "iii");
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/frame", prefix);
+	lo_server_del_method(srv, cmd_buf, "iiiiiiii");
+	lo_server_del_method(srv, cmd_buf, "iiiiiiiii");
+	lo_server_del_method(srv, cmd_buf, "iiiiiiiiii");
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/map", prefix);
+	lo_server_del_method(srv, cmd_buf, "iiiib");
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/sync/delta", prefix);
+	lo_server_del_method(srv, cmd_buf, "iib");
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/sync/key", prefix);
+	lo_server_del_method(srv, cmd_buf, "ib");
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/focus", prefix);
+	lo_server_del_method(srv, cmd_buf, "");
+	lo_server_del_method(srv, cmd_buf, "i");
+	lo_server_del_method(srv, cmd_buf, "s");
+	free(cmd_buf);
+
+	asprintf(&cmd_buf, "/%s/region", prefix);
+	lo_server_del_method(srv, cmd_buf, "iiii");
+	free(cmd_buf);
+}
+
+int ms_sync_ack_start() {
+	if( ms_timer_add(&state.network_loop, &sync_ack_timer, sync_ack_cb, NULL) )
+		return -1;
+
+	ms_timer_arm(&sync_ack_timer, SYNC_ACK_INTERVAL);
+	return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <monome.h>
+
+#include "monomeserial.h"
+
+/* monomeserial runs as two threads.  the device thread reads presses off
+   the serial ports and writes LED updates to them, at whatever pace the
+   links allow.  the network thread handles OSC in both directions and
+   owns all the layer and compositing state.  they only talk through a
+   queue in each direction (plus the composited grid handover, see
+   compositor.c), so a saturated LED link can't hold up a press. */
+
+/**
+ * network thread
+ */
+
+static void forward_press(ms_device_t *dev, uint x, uint y, uint type,
+						  uint64_t stamp) {
+	uint64_t begin = monome_trace_begin();
+	ms_layer_t *layer;
+	uint32_t args[3];
+
+	if( type == MONOME_BUTTON_DOWN ) {
+		layer = ms_device_layer_at(dev, x, y);
+		dev->held_by[y][x] = layer - dev->layers + 1;
+	} else {
+		/* a release nobody saw go down, most likely one that was already
+		   let go of for it when the device went away */
+		if( !dev->held_by[y][x] )
+			return;
+
+		layer = &dev->layers[dev->held_by[y][x] - 1];
+		dev->held_by[y][x] = 0;
+	}
+
+	args[0] = htonl(x);
+	args[1] = htonl(y);
+	args[2] = htonl(type);
+
+	memcpy(layer->press_msg + layer->press_len - sizeof(args), args,
+		   sizeof(args));
+	ms_fan_out(layer, layer->press_msg, layer->press_len);
+	dev->presses++;
+	monome_trace_end("press", begin, (y << 4) | x);
+
+	ms_latency_record(&state.press_latency, ms_now() - stamp);
+}
+
+static void network_queue_cb(ms_watch_t *watch) {
+	ms_queue_t *q = watch->data;
+	ms_msg_t msg;
+
+	ms_queue_rearm(q);
+
+	while( ms_queue_pop(q, &msg) )
+		if( msg.type == MS_MSG_PRESS )
+			forward_press(&state.devices[msg.device], msg.a, msg.b, msg.c,
+						  msg.stamp);
+}
+
+void ms_pipeline_grid(ms_device_t *dev) {
+	ms_msg_t msg = {MS_MSG_GRID, dev - state.devices};
+
+	/* one outstanding notification per device is plenty, the device
+	   thread always picks up the newest grid. */
+	if( __atomic_exchange_n(&dev->notified, 1, __ATOMIC_SEQ_CST) ) {
+		dev->link.stats.coalesced++;
+		return;
+	}
+
+	if( ms_queue_push(&state.to_device, &msg) )
+		__atomic_store_n(&dev->notified, 0, __ATOMIC_SEQ_CST);
+}
+
+void ms_pipeline_intensity(ms_device_t *dev, uint brightness) {
+	ms_msg_t msg = {MS_MSG_INTENSITY, dev - state.devices, brightness};
+
+	ms_queue_push(&state.to_device, &msg);
+}
+
+/**
+ * device thread
+ */
+
+void ms_pipeline_press(ms_device_t *dev, const monome_event_t *e) {
+	ms_msg_t msg = {MS_MSG_PRESS, dev - state.devices, e->x, e->y,
+					e->event_type, dev->wakeup};
+
+	if( e->x > 15 || e->y > 15 )
+		return;
+
+	if( e->event_type == MONOME_BUTTON_DOWN )
+		dev->held[e->y] |= 1 << e->x;
+	else
+		dev->held[e->y] &= ~(1 << e->x);
+
+	ms_queue_push(&state.to_network, &msg);
+}
+
+static void device_queue_cb(ms_watch_t *watch) {
+	ms_queue_t *q = watch->data;
+	ms_device_t *dev;
+	ms_msg_t msg;
+
+	ms_queue_rearm(q);
+
+	while( ms_queue_pop(q, &msg) ) {
+		dev = &state.devices[msg.device];
+
+		switch( msg.type ) {
+		case MS_MSG_GRID:
+			ms_device_output(dev);
+			break;
+
+		case MS_MSG_INTENSITY:
+			dev->intensity = msg.a;
+
+			if( dev->monome )
+				monome_intensity(dev->monome, msg.a);
+			break;
+		}
+	}
+}
+
+static void *device_thread(void *data) {
+	monome_trace_thread("device");
+	ms_realtime_thread(&state.realtime, "device");
+	ms_event_loop_run(&state.device_loop);
+	return NULL;
+}
+
+static int set_affinity(pthread_t thread, int cpu, const char *name) {
+#ifdef __linux__
+	cpu_set_t set;
+
+	if( cpu < 0 )
+		return 0;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	if( pthread_setaffinity_np(thread, sizeof(set), &set) ) {
+		printf("warning: couldn't pin the %s thread to cpu %d\n", name, cpu);
+		return -1;
+	}
+
+	return 0;
+#else
+	if( cpu >= 0 )
+		printf("warning: cpu affinity isn't supported on this platform\n");
+
+	return 0;
+#endif
+}
+
+/**
+ * public
+ */
+
+int ms_pipeline_init() {
+	if( ms_queue_init(&state.to_device, DEVICE_QUEUE_SIZE) ||
+		ms_queue_init(&state.to_network, PRESS_QUEUE_SIZE) )
+		return -1;
+
+	if( ms_watch_add(&state.device_loop, &state.to_device.watch,
+					 state.to_device.pipe[0], device_queue_cb,
+					 &state.to_device) ||
+		ms_watch_add(&state.network_loop, &state.to_network.watch,
+					 state.to_network.pipe[0], network_queue_cb,
+					 &state.to_network) ) {
+		perror("monomeserial: couldn't watch queues");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* starts the device thread.  the caller carries on as the network
+   thread. */
+int ms_pipeline_start(int device_cpu, int network_cpu) {
+	pthread_t thread;
+
+	if( pthread_create(&thread, NULL, device_thread, NULL) ) {
+		perror("monomeserial: couldn't start device thread");
+		return -1;
+	}
+
+	pthread_detach(thread);
+
+	set_affinity(thread, device_cpu, "device");
+	set_affinity(pthread_self(), network_cpu, "network");
+
+	return 0;
+}
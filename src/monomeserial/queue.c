@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "monomeserial.h"
+
+int ms_queue_init(ms_queue_t *q, uint size) {
+	memset(q, 0, sizeof(*q));
+
+	if( !(q->msgs = calloc(size, sizeof(ms_msg_t))) )
+		return -1;
+
+	q->mask = size - 1;
+
+	if( pipe(q->pipe) ) {
+		perror("monomeserial: couldn't create queue pipe");
+		goto err;
+	}
+
+	fcntl(q->pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(q->pipe[1], F_SETFL, O_NONBLOCK);
+
+	return 0;
+
+err:
+	free(q->msgs);
+	return -1;
+}
+
+/* producer side.  returns -1 (and counts a drop) if the consumer is too
+   far behind. */
+int ms_queue_push(ms_queue_t *q, const ms_msg_t *msg) {
+	uint tail = q->tail;
+	char c = 0;
+
+	if( tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask ) {
+		__atomic_fetch_add(&q->dropped, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	q->msgs[tail & q->mask] = *msg;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+	if( !__atomic_exchange_n(&q->signalled, 1, __ATOMIC_SEQ_CST) )
+		if( write(q->pipe[1], &c, 1) < 0 )
+			DPRINTF("monomeserial: couldn't wake queue consumer\n");
+
+	return 0;
+}
+
+/* consumer side.  returns 1 if there was something to pop. */
+int ms_queue_pop(ms_queue_t *q, ms_msg_t *msg) {
+	uint head = q->head;
+
+	if( head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) )
+		return 0;
+
+	*msg = q->msgs[head & q->mask];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+/* consumer side, called on wakeup before draining the queue.  anything
+   pushed after this will wake us again. */
+void ms_queue_rearm(ms_queue_t *q) {
+	char buf[64];
+
+	while( read(q->pipe[0], buf, sizeof(buf)) > 0 );
+	__atomic_store_n(&q->signalled, 0, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <sys/mman.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "monomeserial.h"
+
+/* how much stack each thread touches up front, so the first deep call
+   path doesn't page fault in the middle of forwarding a press */
+#define PREFAULT_STACK (256 * 1024)
+
+#define SELFTEST_SLEEPS 200
+#define SELFTEST_PERIOD 1000 /* microseconds */
+
+static void prefault_stack() {
+	volatile char buf[PREFAULT_STACK];
+	size_t i;
+
+	for( i = 0; i < sizeof(buf); i += 4096 )
+		buf[i] = 0;
+}
+
+static int compare_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+#ifdef __linux__
+/* "0,2-3" style, as taskset takes it */
+static int parse_cpus(const char *list, cpu_set_t *set) {
+	const char *c = list;
+	char *end;
+	long lo, hi;
+
+	CPU_ZERO(set);
+
+	while( *c ) {
+		lo = hi = strtol(c, &end, 10);
+
+		if( end == c || lo < 0 )
+			return -1;
+
+		if( *end == '-' ) {
+			c  = end + 1;
+			hi = strtol(c, &end, 10);
+
+			if( end == c || hi < lo )
+				return -1;
+		}
+
+		for( ; lo <= hi && lo < CPU_SETSIZE; lo++ )
+			CPU_SET(lo, set);
+
+		if( *end == ',' )
+			end++;
+		else if( *end )
+			return -1;
+
+		c = end;
+	}
+
+	return CPU_COUNT(set) ? 0 : -1;
+}
+#endif
+
+/**
+ * public
+ */
+
+/* process-wide: memory locking and the cpu set.  call this before the
+   device thread is started so it inherits it (the log thread is started
+   first on purpose, it's the one thread that shouldn't). */
+void ms_realtime_process(const ms_realtime_t *rt) {
+#ifdef __linux__
+	cpu_set_t set;
+#endif
+
+	if( !rt->enabled )
+		return;
+
+#ifdef __GLIBC__
+	/* keep freed memory around rather than handing it back and faulting
+	   it in again later */
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+#endif
+
+	if( mlockall(MCL_CURRENT | MCL_FUTURE) )
+		printf("realtime: couldn't lock memory (%s), carrying on without\n",
+			   strerror(errno));
+
+	if( !rt->cpus )
+		return;
+
+#ifdef __linux__
+	if( parse_cpus(rt->cpus, &set) )
+		printf("realtime: \"%s\" is not a valid cpu list\n", rt->cpus);
+	else if( sched_setaffinity(0, sizeof(set), &set) )
+		printf("realtime: couldn't restrict to cpus %s (%s)\n",
+			   rt->cpus, strerror(errno));
+#else
+	printf("realtime: cpu sets aren't supported on this platform\n");
+#endif
+}
+
+/* per-thread: scheduling class and a prefaulted stack */
+void ms_realtime_thread(const ms_realtime_t *rt, const char *name) {
+	struct sched_param param;
+	int err;
+
+	if( !rt->enabled )
+		return;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = rt->priority;
+
+	if( (err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) )
+		printf("realtime: couldn't give the %s thread SCHED_FIFO "
+			   "priority %d (%s), running it normally\n",
+			   name, rt->priority, strerror(err));
+
+	prefault_stack();
+}
+
+/* reports what we actually got, and how late this thread wakes up from
+   a run of short sleeps */
+void ms_realtime_selftest(const ms_realtime_t *rt) {
+	uint64_t late[SELFTEST_SLEEPS], sum, start, elapsed;
+	struct sched_param param;
+	struct timespec ts;
+	int policy, i;
+
+	if( !rt->enabled )
+		return;
+
+	pthread_getschedparam(pthread_self(), &policy, &param);
+
+	if( policy == SCHED_FIFO )
+		printf("realtime: SCHED_FIFO priority %d", param.sched_priority);
+	else
+		printf("realtime: normal scheduling");
+
+#ifdef __linux__
+	{
+		cpu_set_t set;
+
+		if( !sched_getaffinity(0, sizeof(set), &set) )
+			printf(", %d cpus", CPU_COUNT(&set));
+	}
+#endif
+
+	printf("\n");
+
+	ts.tv_sec  = 0;
+	ts.tv_nsec = SELFTEST_PERIOD * 1000;
+
+	for( i = 0, sum = 0; i < SELFTEST_SLEEPS; i++ ) {
+		start = ms_now();
+		nanosleep(&ts, NULL);
+
+		elapsed = ms_now() - start;
+		late[i] = (elapsed > SELFTEST_PERIOD) ? elapsed - SELFTEST_PERIOD : 0;
+		sum += late[i];
+	}
+
+	qsort(late, SELFTEST_SLEEPS, sizeof(*late), compare_u64);
+
+	printf("realtime: wakeup jitter over %d %dus sleeps: min %lluus, "
+		   "mean %lluus, p99 %lluus, max %lluus\n\n",
+		   SELFTEST_SLEEPS, SELFTEST_PERIOD,
+		   (unsigned long long) late[0],
+		   (unsigned long long) sum / SELFTEST_SLEEPS,
+		   (unsigned long long) late[SELFTEST_SLEEPS * 99 / 100],
+		   (unsigned long long) late[SELFTEST_SLEEPS - 1]);
+}
@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <lo/lo.h>
+#include <monome.h>
+
+#include "monomeserial.h"
+
+/* the /sys namespace, for monitoring a running monomeserial.
+
+   /sys/stats              replies with /sys/stats (see send_stats)
+   /sys/stats/subscribe i  sends /sys/stats every i milliseconds
+   /sys/stats/unsubscribe
+   /sys/stats/reset        zeroes the press latency histogram
+   /sys/devices            replies with one /sys/device per device
+   /sys/trace/start [i]    start tracing, with room for i events (at
+                           most MAX_TRACE_EVENTS, anyone can ask)
+   /sys/trace/stop
+   /sys/trace/dump         write the trace out to DEFAULT_TRACE_PATH.
+                           there's no choosing the path from here, we
+                           might well be running as root.
+
+   replies go back to wherever the query came from, or to every client
+   when running over TCP.  SIGUSR2 dumps the trace too. */
+
+static int trace_pipe[2] = {-1, -1};
+static ms_watch_t trace_watch;
+
+/**
+ * private
+ */
+
+static unsigned long total(size_t offset) {
+	unsigned long sum = 0;
+	int i;
+
+	for( i = 0; i < state.ndevices; i++ )
+		sum += __atomic_load_n((unsigned long *)
+							   ((char *) &state.devices[i] + offset),
+							   __ATOMIC_RELAXED);
+
+	return sum;
+}
+
+#define TOTAL(field) total(offsetof(ms_device_t, field))
+
+static uint queue_depth(ms_queue_t *q) {
+	return __atomic_load_n(&q->tail, __ATOMIC_RELAXED) -
+		__atomic_load_n(&q->head, __ATOMIC_RELAXED);
+}
+
+/* ffiiiiiiiih: messages per second from applications and to them, bytes
+   of updates waiting for room on the serial links, presses waiting for
+   the network thread, devices with an update held back by the link, then
+   dropped, coalesced and deferred totals, then press latency p50, p99
+   and max in microseconds (max as an int64, it isn't rounded). */
+static void send_stats(lo_address to) {
+	lo_message msg;
+	int i, pending, backlog;
+
+	if( !(msg = lo_message_new()) )
+		return;
+
+	for( i = 0, pending = 0, backlog = 0; i < state.ndevices; i++ ) {
+		pending += __atomic_load_n(&state.devices[i].link.pending,
+								   __ATOMIC_RELAXED);
+		backlog += __atomic_load_n(&state.devices[i].link.backlog,
+								   __ATOMIC_RELAXED);
+	}
+
+	lo_message_add_float(msg, state.sys.in_rate);
+	lo_message_add_float(msg, state.sys.out_rate);
+
+	lo_message_add_int32(msg, backlog);
+	lo_message_add_int32(msg, queue_depth(&state.to_network));
+	lo_message_add_int32(msg, pending);
+
+	lo_message_add_int32(msg,
+		__atomic_load_n(&state.to_device.dropped, __ATOMIC_RELAXED) +
+		__atomic_load_n(&state.to_network.dropped, __ATOMIC_RELAXED));
+	lo_message_add_int32(msg, TOTAL(link.stats.coalesced));
+	lo_message_add_int32(msg, TOTAL(link.stats.deferred));
+
+	lo_message_add_int32(msg, ms_latency_percentile(&state.press_latency, 50));
+	lo_message_add_int32(msg, ms_latency_percentile(&state.press_latency, 99));
+	lo_message_add_int64(msg, state.press_latency.max);
+
+	ms_send_reply(to, "/sys/stats", msg);
+	lo_message_free(msg);
+}
+
+/* isssiiii: index, prefix, serial, device path, columns, rows, layers
+   and which of them has focus */
+static void send_device(lo_address to, int idx) {
+	ms_device_t *dev = &state.devices[idx];
+	lo_message msg;
+
+	if( !(msg = lo_message_new()) )
+		return;
+
+	lo_message_add_int32(msg, idx);
+	lo_message_add_string(msg, dev->layers[0].prefix);
+	lo_message_add_string(msg, dev->serial);
+	lo_message_add_string(msg, dev->devpath);
+	lo_message_add_int32(msg, dev->cols);
+	lo_message_add_int32(msg, dev->rows);
+	lo_message_add_int32(msg, dev->nlayers);
+	lo_message_add_int32(msg, dev->focus);
+
+	ms_send_reply(to, "/sys/device", msg);
+	lo_message_free(msg);
+}
+
+static void rate_cb(ms_timer_t *timer) {
+	unsigned long in, out;
+	float secs = SYS_RATE_INTERVAL / 1000000.0;
+
+	in  = TOTAL(link.stats.commands);
+	out = TOTAL(presses);
+
+	state.sys.in_rate  = (in  - state.sys.in)  / secs;
+	state.sys.out_rate = (out - state.sys.out) / secs;
+
+	state.sys.in  = in;
+	state.sys.out = out;
+
+	ms_timer_arm(timer, SYS_RATE_INTERVAL);
+}
+
+static void watcher_cb(ms_timer_t *timer) {
+	ms_stats_watcher_t *w = timer->data;
+
+	send_stats(w->addr);
+	ms_timer_arm(timer, w->interval);
+}
+
+static int same_str(const char *a, const char *b) {
+	return (a && b) ? !strcmp(a, b) : a == b;
+}
+
+static int same_address(lo_address a, lo_address b) {
+	if( !a || !b )
+		return a == b;
+
+	return same_str(lo_address_get_hostname(a), lo_address_get_hostname(b)) &&
+		same_str(lo_address_get_port(a), lo_address_get_port(b));
+}
+
+static ms_stats_watcher_t *find_watcher(lo_address addr) {
+	int i;
+
+	for( i = 0; i < MAX_STATS_WATCHERS; i++ )
+		if( state.sys.watchers[i].active &&
+			same_address(state.sys.watchers[i].addr, addr) )
+			return &state.sys.watchers[i];
+
+	return NULL;
+}
+
+static void drop_watcher(ms_stats_watcher_t *w) {
+	ms_timer_del(&state.network_loop, &w->timer);
+
+	if( w->addr )
+		lo_address_free(w->addr);
+
+	w->addr   = NULL;
+	w->active = 0;
+}
+
+static int sys_stats_handler(const char *path, const char *types,
+							 lo_arg **argv, int argc,
+							 lo_message data, void *user_data) {
+	send_stats(lo_message_get_source(data));
+	return 0;
+}
+
+static int sys_devices_handler(const char *path, const char *types,
+							   lo_arg **argv, int argc,
+							   lo_message data, void *user_data) {
+	lo_address from = lo_message_get_source(data);
+	int i;
+
+	for( i = 0; i < state.ndevices; i++ )
+		send_device(from, i);
+
+	return 0;
+}
+
+static int sys_reset_handler(const char *path, const char *types,
+							 lo_arg **argv, int argc,
+							 lo_message data, void *user_data) {
+	ms_latency_reset(&state.press_latency);
+	return 0;
+}
+
+static int sys_subscribe_handler(const char *path, const char *types,
+								 lo_arg **argv, int argc,
+								 lo_message data, void *user_data) {
+	lo_address from = lo_message_get_source(data), addr = NULL;
+	ms_stats_watcher_t *w;
+	int i;
+
+	if( argv[0]->i <= 0 )
+		return -1;
+
+	/* subscribing again just changes the interval */
+	if( !(w = find_watcher((state.transport == LO_TCP) ? NULL : from)) ) {
+		for( i = 0; i < MAX_STATS_WATCHERS; i++ )
+			if( !state.sys.watchers[i].active )
+				break;
+
+		if( i == MAX_STATS_WATCHERS ) {
+			printf("warning: too many /sys/stats subscribers\n");
+			return -1;
+		}
+
+		if( state.transport != LO_TCP &&
+			(!from ||
+			 !(addr = lo_address_new_with_proto(lo_address_get_protocol(from),
+												lo_address_get_hostname(from),
+												lo_address_get_port(from)))) )
+			return -1;
+
+		w = &state.sys.watchers[i];
+
+		if( ms_timer_add(&state.network_loop, &w->timer, watcher_cb, w) ) {
+			if( addr )
+				lo_address_free(addr);
+
+			return -1;
+		}
+
+		w->addr   = addr;
+		w->active = 1;
+	}
+
+	w->interval = (uint64_t) argv[0]->i * 1000;
+	ms_timer_arm(&w->timer, w->interval);
+
+	return 0;
+}
+
+static int sys_unsubscribe_handler(const char *path, const char *types,
+								   lo_arg **argv, int argc,
+								   lo_message data, void *user_data) {
+	ms_stats_watcher_t *w;
+
+	if( state.transport == LO_TCP )
+		w = find_watcher(NULL);
+	else
+		w = find_watcher(lo_message_get_source(data));
+
+	if( w )
+		drop_watcher(w);
+
+	return 0;
+}
+
+static int sys_trace_start_handler(const char *path, const char *types,
+								   lo_arg **argv, int argc,
+								   lo_message data, void *user_data) {
+	int events = (argc) ? argv[0]->i : DEFAULT_TRACE_EVENTS;
+
+	if( events <= 0 || events > MAX_TRACE_EVENTS )
+		return -1;
+
+	return monome_trace_start(events);
+}
+
+static int sys_trace_stop_handler(const char *path, const char *types,
+								  lo_arg **argv, int argc,
+								  lo_message data, void *user_data) {
+	monome_trace_stop();
+	return 0;
+}
+
+static int sys_trace_dump_handler(const char *path, const char *types,
+								  lo_arg **argv, int argc,
+								  lo_message data, void *user_data) {
+	return ms_sys_trace_dump();
+}
+
+/* a signal handler can't do much, so it just wakes up the network thread
+   and the dump happens there */
+static void trace_signal(int sig) {
+	char c = 0;
+
+	if( write(trace_pipe[1], &c, 1) < 0 )
+		return;
+}
+
+static void trace_signal_cb(ms_watch_t *watch) {
+	char buf[16];
+
+	while( read(watch->fd, buf, sizeof(buf)) > 0 );
+	ms_sys_trace_dump();
+}
+
+static void watch_trace_signal() {
+	struct sigaction sa;
+
+	if( pipe(trace_pipe) ) {
+		perror("monomeserial: couldn't create trace pipe");
+		return;
+	}
+
+	fcntl(trace_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(trace_pipe[1], F_SETFL, O_NONBLOCK);
+
+	if( ms_watch_add(&state.network_loop, &trace_watch, trace_pipe[0],
+					 trace_signal_cb, NULL) ) {
+		perror("monomeserial: couldn't watch trace pipe");
+		return;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = trace_signal;
+	sa.sa_flags   = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	sigaction(SIGUSR2, &sa, NULL);
+}
+
+/**
+ * public
+ */
+
+int ms_sys_trace_dump() {
+	char path[64];
+
+	snprintf(path, sizeof(path), DEFAULT_TRACE_PATH, getpid());
+
+	if( monome_trace_dump(path) ) {
+		printf("warning: couldn't write a trace (is tracing on?)\n");
+		return -1;
+	}
+
+	printf("trace written to %s\n", path);
+	fflush(stdout);
+
+	return 0;
+}
+
+void ms_register_sys_methods() {
+	lo_server srv = state.server;
+
+	lo_server_add_method(srv, "/sys/stats", "", sys_stats_handler, NULL);
+	lo_server_add_method(srv, "/sys/stats/subscribe", "i",
+						 sys_subscribe_handler, NULL);
+	lo_server_add_method(srv, "/sys/stats/unsubscribe", "",
+						 sys_unsubscribe_handler, NULL);
+	lo_server_add_method(srv, "/sys/stats/reset", "", sys_reset_handler, NULL);
+	lo_server_add_method(srv, "/sys/devices", "", sys_devices_handler, NULL);
+
+	lo_server_add_method(srv, "/sys/trace/start", "",
+						 sys_trace_start_handler, NULL);
+	lo_server_add_method(srv, "/sys/trace/start", "i",
+						 sys_trace_start_handler, NULL);
+	lo_server_add_method(srv, "/sys/trace/stop", "",
+						 sys_trace_stop_handler, NULL);
+	lo_server_add_method(srv, "/sys/trace/dump", "",
+						 sys_trace_dump_handler, NULL);
+
+	watch_trace_signal();
+
+	if( !ms_timer_add(&state.network_loop, &state.sys.rate_timer, rate_cb,
+					  NULL) )
+		ms_timer_arm(&state.sys.rate_timer, SYS_RATE_INTERVAL);
+}
@@ -0,0 +1,412 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netdb.h>
+
+#include <lo/lo.h>
+
+#include "monomeserial.h"
+
+/* the unix socket we're listening on, removed again on the way out */
+static const char *unix_path;
+
+static void unix_path_cleanup() {
+	if( unix_path )
+		unlink(unix_path);
+}
+
+static void unix_path_signal(int sig) {
+	unix_path_cleanup();
+
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void watch_unix_path(const char *path) {
+	struct sigaction sa;
+
+	unix_path = path;
+	atexit(unix_path_cleanup);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = unix_path_signal;
+	sigemptyset(&sa.sa_mask);
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+}
+
+static void lo_error(int num, const char *error_msg, const char *path) {
+	monome_log(MONOME_LOG_ERROR, 0, "monomeserial: lo server error %d in %s: %s",
+			   num, path, error_msg);
+}
+
+static void capture_message(monome_capture_kind_t kind, const char *path,
+							lo_message msg) {
+	uint8_t buf[OSC_STREAM_MAX_PACKET];
+	size_t len;
+
+	if( (len = lo_message_length(msg, path)) <= sizeof(buf) &&
+		lo_message_serialise(msg, path, buf, &len) )
+		monome_capture(kind, 0, buf, len);
+}
+
+/* added ahead of every other method when capturing, so it sees each
+   message first.  returning 1 passes it on to the real handlers. */
+static int capture_handler(const char *path, const char *types,
+						   lo_arg **argv, int argc,
+						   lo_message data, void *user_data) {
+	capture_message(MONOME_CAPTURE_OSC_IN, path, data);
+	return 1;
+}
+
+/* a client that's gone, or fallen too far behind to catch up, gets cut
+   off.  it's only shut down here, since this can be called from inside
+   its own read callback, and it's closed when that next sees the end of
+   the stream.  no lingering, either: whatever the kernel still has
+   queued for it is thrown away and it gets a reset. */
+static void stream_drop(osc_stream_t *stream) {
+	struct linger lg = {1, 0};
+
+	setsockopt(stream->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+	shutdown(stream->fd, SHUT_RDWR);
+}
+
+static void stream_write_all(const void *buf, size_t len) {
+	osc_stream_t *stream;
+	int i;
+
+	for( i = 0; i < MAX_STREAM_CLIENTS; i++ ) {
+		stream = &state.streams[i];
+
+		if( stream->fd < 0 )
+			continue;
+
+		if( osc_stream_write(stream, buf, len) )
+			stream_drop(stream);
+		else if( stream->queued )
+			ms_watch_want_write(&state.network_loop,
+								&state.stream_watches[i], 1);
+	}
+}
+
+static void stream_broadcast(const char *path, lo_message msg) {
+	uint8_t buf[OSC_STREAM_MAX_PACKET];
+	size_t len;
+
+	if( (len = lo_message_length(msg, path)) > sizeof(buf) ||
+		!lo_message_serialise(msg, path, buf, &len) )
+		return;
+
+	stream_write_all(buf, len);
+}
+
+/* LED messages are picked apart by osc_methods.c without going through
+   liblo (which allocates for every message), see there.  returns 1 if
+   buf was one. */
+static int dispatch_led(const void *buf, size_t len) {
+	if( !ms_osc_dispatch_led(buf, len) )
+		return 0;
+
+	if( monome_capture_active() )
+		monome_capture(MONOME_CAPTURE_OSC_IN, 0, buf, len);
+
+	return 1;
+}
+
+static void stream_dispatch(osc_stream_t *stream, void *packet, size_t len,
+							void *user_data) {
+	if( !dispatch_led(packet, len) )
+		lo_server_dispatch_data(state.server, packet, len);
+}
+
+static void stream_client_cb(ms_watch_t *watch) {
+	osc_stream_t *stream = watch->data;
+
+	if( watch->writable ) {
+		if( osc_stream_flush(stream) )
+			stream_drop(stream);
+		else if( !stream->queued )
+			ms_watch_want_write(&state.network_loop, watch, 0);
+	}
+
+	if( osc_stream_read(stream, stream_dispatch, NULL) ) {
+		ms_watch_del(&state.network_loop, watch);
+		osc_stream_close(stream);
+	}
+}
+
+static void stream_accept_cb(ms_watch_t *watch) {
+	osc_stream_t discard;
+	int i;
+
+	for( i = 0; i < MAX_STREAM_CLIENTS; i++ )
+		if( state.streams[i].fd < 0 ) {
+			if( osc_stream_accept(&state.streams[i], watch->fd) )
+				return;
+
+			if( ms_watch_add(&state.network_loop, &state.stream_watches[i],
+							 state.streams[i].fd, stream_client_cb,
+							 &state.streams[i]) )
+				osc_stream_close(&state.streams[i]);
+
+			return;
+		}
+
+	/* no room at the inn */
+	if( !osc_stream_accept(&discard, watch->fd) )
+		osc_stream_close(&discard);
+}
+
+/* the packet's only peeked at first.  if it's an LED message it's thrown
+   away once it's been dealt with, otherwise it's still there for liblo
+   to read, along with who sent it (which /sys replies need). */
+static void server_cb(ms_watch_t *watch) {
+	uint64_t begin = monome_trace_begin();
+	uint8_t buf[OSC_STREAM_MAX_PACKET];
+	ssize_t len;
+
+	len = recv(watch->fd, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+
+	if( len > 0 && len < sizeof(buf) && dispatch_led(buf, len) )
+		recv(watch->fd, buf, 0, MSG_DONTWAIT);
+	else
+		lo_server_recv_noblock(state.server, 0);
+
+	monome_trace_end("osc", begin, 0);
+}
+
+int ms_transport_open(const char *sport) {
+	int i;
+
+	for( i = 0; i < MAX_STREAM_CLIENTS; i++ ) {
+		osc_stream_init(&state.streams[i], -1);
+		state.stream_watches[i].fd = -1;
+	}
+
+	state.stream_watch.fd = -1;
+
+	switch( state.transport ) {
+	case LO_UNIX:
+		if( osc_unix_unlink_stale(sport) ) {
+			printf("monomeserial: something's already listening on %s\n", sport);
+			return 1;
+		}
+
+		if( !(state.server = lo_server_new_with_proto(sport, LO_UNIX, lo_error)) )
+			return 1;
+
+		watch_unix_path(sport);
+		break;
+
+	case LO_TCP:
+		/* UDP stays up on the same port number alongside the listener,
+		   it's also where TCP packets get dispatched through. */
+		if( (i = osc_stream_listen(sport)) < 0 ) {
+			printf("failed to listen on tcp port %s\n", sport);
+			return 1;
+		}
+
+		if( ms_watch_add(&state.network_loop, &state.stream_watch, i,
+						 stream_accept_cb, NULL) ) {
+			perror("monomeserial: couldn't watch tcp listener");
+			return 1;
+		}
+
+		/* fall through */
+
+	default:
+		if( !(state.server = lo_server_new(sport, lo_error)) )
+			return 1;
+
+		break;
+	}
+
+	if( monome_capture_active() )
+		lo_server_add_method(state.server, NULL, NULL, capture_handler, NULL);
+
+	if( ms_watch_add(&state.network_loop, &state.server_watch,
+					 lo_server_get_socket_fd(state.server), server_cb, NULL) ) {
+		perror("monomeserial: couldn't watch osc server");
+		return 1;
+	}
+
+	return 0;
+}
+
+lo_address ms_transport_app_address(const char *ahost, const char *aport) {
+	if( state.transport == LO_UNIX )
+		return lo_address_new_with_proto(LO_UNIX, NULL, aport);
+
+	return lo_address_new(ahost, aport);
+}
+
+/* for unix sockets, the port is the socket path and the host is ignored */
+int ms_transport_resolve(ms_dest_t *dest, const char *host, const char *port) {
+	struct sockaddr_storage self;
+	struct sockaddr_un *sun;
+	struct addrinfo hints, *res;
+	socklen_t len = sizeof(self);
+
+	memset(dest, 0, sizeof(*dest));
+
+	if( state.transport == LO_UNIX ) {
+		sun = (struct sockaddr_un *) &dest->addr;
+
+		if( strlen(port) >= sizeof(sun->sun_path) )
+			return -1;
+
+		sun->sun_family = AF_UNIX;
+		strcpy(sun->sun_path, port);
+		dest->len = sizeof(*sun);
+
+		return 0;
+	}
+
+	/* we send from the server's socket, so the address had better be
+	   in the same family as it is */
+	if( getsockname(lo_server_get_socket_fd(state.server),
+					(struct sockaddr *) &self, &len) )
+		return -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = self.ss_family;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if( getaddrinfo(host, port, &hints, &res) )
+		return -1;
+
+	memcpy(&dest->addr, res->ai_addr, res->ai_addrlen);
+	dest->len = res->ai_addrlen;
+
+	freeaddrinfo(res);
+	return 0;
+}
+
+void ms_send_to_app(ms_layer_t *layer, const char *path, lo_message msg) {
+	if( monome_capture_active() )
+		capture_message(MONOME_CAPTURE_OSC_OUT, path, msg);
+
+	if( state.transport == LO_TCP )
+		stream_broadcast(path, msg);
+	else
+		lo_send_message_from(layer->outgoing, state.server, path, msg);
+}
+
+/* an already-serialised packet, to the layer's application only */
+void ms_send_raw_to_app(ms_layer_t *layer, const void *buf, size_t len) {
+	if( monome_capture_active() )
+		monome_capture(MONOME_CAPTURE_OSC_OUT, 0, buf, len);
+
+	if( state.transport == LO_TCP )
+		stream_write_all(buf, len);
+	else if( layer->app_dest.len )
+		sendto(lo_server_get_socket_fd(state.server), buf, len, MSG_DONTWAIT,
+			   (struct sockaddr *) &layer->app_dest.addr, layer->app_dest.len);
+}
+
+/* for answering whoever sent us something, rather than an application */
+void ms_send_reply(lo_address to, const char *path, lo_message msg) {
+	if( monome_capture_active() )
+		capture_message(MONOME_CAPTURE_OSC_OUT, path, msg);
+
+	if( state.transport == LO_TCP )
+		stream_broadcast(path, msg);
+	else if( to )
+		lo_send_message_from(to, state.server, path, msg);
+}
+
+static void fill_msghdr(struct msghdr *hdr, struct iovec *iov, ms_dest_t *dest) {
+	memset(hdr, 0, sizeof(*hdr));
+
+	hdr->msg_name    = &dest->addr;
+	hdr->msg_namelen = dest->len;
+	hdr->msg_iov     = iov;
+	hdr->msg_iovlen  = 1;
+}
+
+/* sends an already-serialised packet to the layer's application and to
+   every subscriber.  on linux that's a single sendmmsg() for the lot. */
+void ms_fan_out(ms_layer_t *layer, const void *buf, size_t len) {
+	struct iovec iov = {(void *) buf, len};
+	int fd, i, n;
+
+#ifdef __linux__
+	struct mmsghdr msgs[MAX_SUBSCRIBERS + 1];
+	int sent;
+#else
+	struct msghdr msgs[MAX_SUBSCRIBERS + 1];
+#endif
+
+	if( monome_capture_active() )
+		monome_capture(MONOME_CAPTURE_OSC_OUT, 0, buf, len);
+
+	if( state.transport == LO_TCP ) {
+		stream_write_all(buf, len);
+		return;
+	}
+
+	fd = lo_server_get_socket_fd(state.server);
+	n  = 0;
+
+#ifdef __linux__
+	if( layer->app_dest.len )
+		fill_msghdr(&msgs[n++].msg_hdr, &iov, &layer->app_dest);
+
+	for( i = 0; i < state.nsubscribers; i++ )
+		fill_msghdr(&msgs[n++].msg_hdr, &iov, &state.subscribers[i]);
+
+	/* sendmmsg() stops at the first destination that fails, so step over
+	   it and carry on with the rest. */
+	for( i = 0; i < n; i += (sent > 0) ? sent : 1 )
+		if( (sent = sendmmsg(fd, msgs + i, n - i, MSG_DONTWAIT)) < 0 )
+			DPRINTF("monomeserial: press to subscriber %d dropped\n", i);
+#else
+	if( layer->app_dest.len )
+		fill_msghdr(&msgs[n++], &iov, &layer->app_dest);
+
+	for( i = 0; i < state.nsubscribers; i++ )
+		fill_msghdr(&msgs[n++], &iov, &state.subscribers[i]);
+
+	for( i = 0; i < n; i++ )
+		sendmsg(fd, &msgs[i], MSG_DONTWAIT);
+#endif
+}
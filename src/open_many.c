@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* brings up a set of devices at once.  most of what monome_open spends
+   its time on is waiting (on udev, on the usb serial driver setting the
+   line up, on the first clear draining), so a handful of threads pulling
+   devices off a shared list gets through eight grids in not much more
+   time than one. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <monome.h>
+#include "internal.h"
+
+#define DEFAULT_OPEN_THREADS 4
+#define MAX_OPEN_THREADS     16
+
+typedef struct {
+	monome_open_request_t *requests;
+	int count;
+	int next;
+	int flags;
+} open_queue_t;
+
+/**
+ * private
+ */
+
+static void open_one(monome_open_request_t *r, int flags) {
+	errno = 0;
+
+	if( !(r->monome = monome_open(r->dev, r->port)) ) {
+		r->error = (errno) ? errno : ENODEV;
+		return;
+	}
+
+	r->error = 0;
+
+	if( flags & MONOME_OPEN_CLEAR )
+		monome_clear(r->monome, MONOME_CLEAR_OFF);
+}
+
+static void *open_worker(void *data) {
+	open_queue_t *q = data;
+	int i;
+
+	while( (i = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED)) < q->count )
+		open_one(&q->requests[i], q->flags);
+
+	return NULL;
+}
+
+/**
+ * public
+ */
+
+/* returns how many opened.  threads is how many to open on at once, 0
+   for the default, and the calling thread is one of them. */
+int monome_open_many(monome_open_request_t *requests, int count,
+                     int threads, int flags) {
+	pthread_t workers[MAX_OPEN_THREADS];
+	open_queue_t q = {requests, count, 0, flags};
+	int i, started, opened = 0;
+
+	if( threads <= 0 )
+		threads = DEFAULT_OPEN_THREADS;
+
+	if( threads > MAX_OPEN_THREADS )
+		threads = MAX_OPEN_THREADS;
+
+	if( threads > count )
+		threads = count;
+
+	/* if a thread can't be started, whoever did start picks up the slack */
+	for( started = 0; started < threads - 1; started++ )
+		if( pthread_create(&workers[started], NULL, open_worker, &q) )
+			break;
+
+	open_worker(&q);
+
+	for( i = 0; i < started; i++ )
+		pthread_join(workers[i], NULL);
+
+	for( i = 0; i < count; i++ )
+		if( requests[i].monome )
+			opened++;
+
+	return opened;
+}
@@ -27,6 +27,7 @@
  */
 
 #include <assert.h>
+#include <glob.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -50,4 +51,20 @@ char *monome_platform_get_dev_serial(const char *path) {
 	return strdup(serial + 1);
 }
 
+int monome_platform_enumerate(monome_platform_found_t found, void *data) {
+	glob_t gb;
+	size_t i;
+
+	if( glob("/dev/tty.usbserial-*", 0, NULL, &gb) ) {
+		globfree(&gb);
+		return 0;
+	}
+
+	for( i = 0; i < gb.gl_pathc; i++ )
+		found(gb.gl_pathv[i], strchr(gb.gl_pathv[i], '-') + 1, data);
+
+	globfree(&gb);
+	return 0;
+}
+
 #include "posix.inc"
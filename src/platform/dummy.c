@@ -29,6 +29,7 @@
 #include <stdio.h>
 
 #include "internal.h"
+#include "platform.h"
 
 #warning "using the \"dummy\" platform, please make sure this is what you want!"
 
@@ -39,6 +40,10 @@ int monome_platform_open(monome_t *monome) {
 	return 1;
 }
 
+int monome_platform_enumerate(monome_platform_found_t found, void *data) {
+	return 0;
+}
+
 int monome_platform_close(monome_t *monome) {
 	return 0;
 }
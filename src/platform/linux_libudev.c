@@ -30,12 +30,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include <libudev.h>
 
 #include <monome.h>
 #include "internal.h"
+#include "platform.h"
 
+/* one context for the life of the process, made the first time it's
+   needed.  libudev contexts aren't safe to share between threads, so
+   whoever is using it holds udev_lock. */
 static struct udev *udev;
+static pthread_mutex_t udev_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static char *get_monome_information(struct udev_device *d) {
 	const char *serial, *tty;
@@ -71,13 +77,18 @@ char *monome_platform_get_dev_serial(const char *device) {
 
 	assert(device);
 
-	udev = udev_new();
+	pthread_mutex_lock(&udev_lock);
+
+	if( !udev && !(udev = udev_new()) )
+		goto err_udev;
+
+	if( !(ue = udev_enumerate_new(udev)) )
+		goto err_udev;
 
-	ue = udev_enumerate_new(udev);
 	udev_enumerate_add_match_property(ue, "DEVNAME", device);
 
 	if( udev_enumerate_scan_devices(ue) )
-		return NULL;
+		goto err;
 
 	c = udev_enumerate_get_list_entry(ue);
 
@@ -88,8 +99,52 @@ char *monome_platform_get_dev_serial(const char *device) {
 
 err:
 	udev_enumerate_unref(ue);
-	udev_unref(udev);
+
+err_udev:
+	pthread_mutex_unlock(&udev_lock);
 	return serial;
 }
 
+int monome_platform_enumerate(monome_platform_found_t found, void *data) {
+	struct udev_enumerate *ue;
+	struct udev_list_entry *c;
+	struct udev_device *d;
+	const char *tty, *serial;
+	int ret = -1;
+
+	pthread_mutex_lock(&udev_lock);
+
+	if( !udev && !(udev = udev_new()) )
+		goto err_udev;
+
+	if( !(ue = udev_enumerate_new(udev)) )
+		goto err_udev;
+
+	udev_enumerate_add_match_subsystem(ue, "tty");
+	udev_enumerate_add_match_property(ue, "ID_BUS", "usb");
+
+	if( udev_enumerate_scan_devices(ue) )
+		goto err;
+
+	udev_list_entry_foreach(c, udev_enumerate_get_list_entry(ue)) {
+		if( !(d = udev_device_new_from_syspath(udev, udev_list_entry_get_name(c))) )
+			continue;
+
+		if( (tty    = udev_device_get_devnode(d)) &&
+			(serial = udev_device_get_property_value(d, "ID_SERIAL_SHORT")) )
+			found(tty, serial, data);
+
+		udev_device_unref(d);
+	}
+
+	ret = 0;
+
+err:
+	udev_enumerate_unref(ue);
+
+err_udev:
+	pthread_mutex_unlock(&udev_lock);
+	return ret;
+}
+
 #include "posix.inc"
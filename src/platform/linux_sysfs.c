@@ -40,6 +40,7 @@
 
 #include <monome.h>
 #include "internal.h"
+#include "platform.h"
 
 #define FTDI_PATH "/sys/bus/usb/drivers/ftdi_sio"
 #define MAX_LENGTH 128
@@ -71,7 +72,7 @@ err:
 }
 
 char *monome_platform_get_dev_serial(const char *path) {
-	int bus, device;
+	int bus, device, matched;
 	glob_t gb;
 	char *buf;
 
@@ -80,21 +81,60 @@ char *monome_platform_get_dev_serial(const char *path) {
 	if( *path == '/' )
 		path++;
 
-	path = strchr(path, '/') + 1;
+	if( !(path = strchr(path, '/')) )
+		return NULL;
 
-	asprintf(&buf, FTDI_PATH "/*/%s", path);
-	glob(buf, 0, NULL, &gb);
-	free(buf);
+	if( asprintf(&buf, FTDI_PATH "/*/%s", path + 1) < 0 )
+		return NULL;
 
-	if( !gb.gl_pathc )
+	/* glob() can have allocated even when it comes back empty */
+	if( glob(buf, 0, NULL, &gb) ) {
+		globfree(&gb);
+		free(buf);
 		return NULL;
+	}
+
+	free(buf);
 
-	sscanf(*gb.gl_pathv, FTDI_PATH "/%d-%d", &bus, &device);
+	matched = sscanf(*gb.gl_pathv, FTDI_PATH "/%d-%d", &bus, &device);
 	globfree(&gb);
 
-	if( (buf = get_serial(bus, device)) )
-		return buf;
-	return NULL;
+	if( matched != 2 )
+		return NULL;
+
+	return get_serial(bus, device);
+}
+
+/* the ftdi driver's directory has one entry per interface it's bound to,
+   named for the usb device, with the tty underneath:
+   /sys/bus/usb/drivers/ftdi_sio/2-1:1.0/ttyUSB0 */
+int monome_platform_enumerate(monome_platform_found_t found, void *data) {
+	char devpath[MAX_LENGTH], *serial, *tty;
+	int bus, device;
+	glob_t gb;
+	size_t i;
+
+	if( glob(FTDI_PATH "/*/ttyUSB*", 0, NULL, &gb) ) {
+		globfree(&gb);
+		return 0;
+	}
+
+	for( i = 0; i < gb.gl_pathc; i++ ) {
+		if( sscanf(gb.gl_pathv[i], FTDI_PATH "/%d-%d", &bus, &device) != 2 )
+			continue;
+
+		tty = strrchr(gb.gl_pathv[i], '/') + 1;
+		snprintf(devpath, sizeof(devpath), "/dev/%s", tty);
+
+		if( !(serial = get_serial(bus, device)) )
+			continue;
+
+		found(devpath, serial, data);
+		free(serial);
+	}
+
+	globfree(&gb);
+	return 0;
 }
 
 #include "posix.inc"
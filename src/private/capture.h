@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MONOME_CAPTURE_H
+#define _MONOME_CAPTURE_H
+
+#include <stdint.h>
+
+#include <monome.h>
+#include "internal.h"
+
+/* set while monome_capture_start() is in effect.  with capture off, a
+   device read or write pays a load and a branch for it. */
+extern int monome_capturing;
+
+void monome_capture_from_env();
+void monome_capture_device(monome_t *monome, monome_capture_kind_t kind,
+						   const uint8_t *buf, size_t len);
+
+static inline void capture_device(monome_t *monome, monome_capture_kind_t kind,
+								  const uint8_t *buf, ssize_t len) {
+	if( len > 0 && __atomic_load_n(&monome_capturing, __ATOMIC_RELAXED) )
+		monome_capture_device(monome, kind, buf, len);
+}
+
+#endif
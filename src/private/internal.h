@@ -40,6 +40,7 @@
 typedef struct monome_callback monome_callback_t;
 typedef struct monome_rotspec monome_rotspec_t;
 typedef struct monome_devmap monome_devmap_t;
+typedef struct monome_mem monome_mem_t;
 
 typedef void (*monome_coord_cb)(monome_t *, uint *x, uint *y);
 typedef void (*monome_frame_cb)(monome_t *, uint *quadrant, uint8_t *frame_data);
@@ -73,14 +74,32 @@ struct monome_rotspec {
 struct monome {
 	char *serial;
 	char *device;
+	const char *proto; /* the module's name, static */
 	int rows, cols;
 
 	struct termios ot;
 	int fd;
 
+	/* set instead of fd for mem:// devices, see loopback.c */
+	monome_mem_t *mem;
+
 	monome_callback_t handlers[3];
 	monome_cable_t orientation;
 
+	/* how long monome_event_loop spins on non-blocking reads after the
+	   last event before it goes back to sleeping in select() */
+	uint busy_poll;
+
+	/* see stats.h.  cmd is whatever command is being written at the
+	   moment, so monome_platform_write knows whose bytes they are. */
+	monome_stats_t stats;
+	monome_cmd_t cmd;
+
+	/* which device this is in a capture, and which capture it's last
+	   been announced in (see capture.c) */
+	uint stream;
+	uint capture_gen;
+
 	int  (*open)(monome_t *monome, const char *dev, va_list args);
 	int  (*close)(monome_t *monome);
 	void (*free)(monome_t *monome);
@@ -96,6 +115,7 @@ struct monome {
 	int  (*led_col)(monome_t *monome, uint col, size_t count, const uint8_t *data);
 	int  (*led_row)(monome_t *monome, uint row, size_t count, const uint8_t *data);
 	int  (*led_frame)(monome_t *monome, uint quadrant, const uint8_t *frame_data);
+	int  (*led_map)(monome_t *monome, uint cols, uint rows, const uint8_t *map_data);
 };
 
 #endif
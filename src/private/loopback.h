@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MONOME_LOOPBACK_H
+#define _MONOME_LOOPBACK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "internal.h"
+
+#define MONOME_MEM_PREFIX     "mem://"
+#define MONOME_MEM_DEFAULT    "m256-000"
+
+#define IS_MEM_DEVICE(dev) (!strncmp(dev, MONOME_MEM_PREFIX, \
+                                     sizeof(MONOME_MEM_PREFIX) - 1))
+
+char *monome_mem_get_serial(const char *dev);
+
+int monome_mem_open(monome_t *monome, const char *dev);
+int monome_mem_close(monome_t *monome);
+
+ssize_t monome_mem_write(monome_t *monome, const uint8_t *buf, ssize_t bufsize);
+ssize_t monome_mem_read(monome_t *monome, uint8_t *buf, ssize_t count);
+
+#endif
@@ -28,8 +28,14 @@
 
 #include "internal.h"
 
+typedef void (*monome_platform_found_t)
+	(const char *devpath, const char *serial, void *data);
+
 char *monome_platform_get_dev_serial(const char *device);
 
+/* calls found for every serial device that might be a grid */
+int monome_platform_enumerate(monome_platform_found_t found, void *data);
+
 int monome_platform_open(monome_t *monome, const char *dev);
 int monome_platform_close(monome_t *monome);
 
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MONOME_PROBES_H
+#define _MONOME_PROBES_H
+
+/* USDT probes, for bpftrace/perf/systemtap against an unmodified build.
+   they're a single nop each until something attaches, and they vanish
+   entirely if sys/sdt.h isn't around (or with -DMONOME_NO_PROBES).
+
+   all of them are in the "libmonome" provider:
+
+     write_entry(fd, bytes)
+     write_return(fd, written, blocked_ns)   blocked in select/tcdrain
+     read_return(fd, wanted, got)
+     encode(cmd, opcode, bytes)              monome_cmd_t, first byte
+     event(type, x, y)                       a message parsed
+     parse_error(opcode, bytes)
+     dispatch_entry(type, x, y)
+     dispatch_return(type, x, y)
+
+   see contrib/bpftrace for some examples. */
+
+#if !defined(MONOME_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define MONOME_HAVE_PROBES
+#endif
+#endif
+
+#ifdef MONOME_HAVE_PROBES
+#include <sys/sdt.h>
+
+#define PROBE2(name, a, b)    DTRACE_PROBE2(libmonome, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(libmonome, name, a, b, c)
+#else
+#define PROBE2(name, a, b)    ((void) 0)
+#define PROBE3(name, a, b, c) ((void) 0)
+#endif
+
+#endif
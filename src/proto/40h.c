@@ -28,11 +28,14 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <monome.h>
 #include "internal.h"
 #include "platform.h"
+#include "probes.h"
 #include "rotation.h"
+#include "stats.h"
 
 #include "40h.h"
 
@@ -41,6 +44,8 @@
  */
 
 static int monome_write(monome_t *monome, const uint8_t *buf, ssize_t bufsize) {
+	PROBE3(encode, monome->cmd, buf[0], bufsize);
+
 	if( monome_platform_write(monome, buf, bufsize) == bufsize )
 		return 0;
 
@@ -150,14 +155,8 @@ static int proto_40h_led_frame(monome_t *monome, uint quadrant, const uint8_t *f
 	int ret = 0;
 	uint i;
 
-	/* by treating frame_data as a bigger integer, we can copy it in
-	   one or two operations (instead of 8) */
-#ifdef __LP64__
-	*((uint64_t *) &buf[1]) = *((uint64_t *) frame_data);
-#else
-	*((uint32_t *) &buf[1]) = *((uint32_t *) frame_data);
-	*((uint32_t *) &buf[5]) = *(((uint32_t *) frame_data) + 1);
-#endif
+	/* a constant size memcpy() copies the whole frame in one move */
+	memcpy(buf, frame_data, sizeof(buf));
 
 	ORIENTATION(monome).frame_cb(monome, &quadrant, buf);
 
@@ -169,9 +168,17 @@ static int proto_40h_led_frame(monome_t *monome, uint quadrant, const uint8_t *f
 
 static int proto_40h_next_event(monome_t *monome, monome_event_t *e) {
 	uint8_t buf[2] = {0, 0};
+	ssize_t len;
+
+	if( (len = monome_platform_read(monome, buf, sizeof(buf))) < (ssize_t) sizeof(buf) ) {
+		/* half a message that never got finished */
+		if( len > 0 ) {
+			stats_add(&monome->stats.parse_errors, 1);
+			PROBE2(parse_error, buf[0], len);
+		}
 
-	if( monome_platform_read(monome, buf, sizeof(buf)) < sizeof(buf) )
 		return 0;
+	}
 
 	switch( buf[0] ) {
 	case PROTO_40h_BUTTON_DOWN:
@@ -181,6 +188,7 @@ static int proto_40h_next_event(monome_t *monome, monome_event_t *e) {
 		e->y = buf[1] & 0xF;
 
 		UNROTATE_COORDS(monome, e->x, e->y);
+		PROBE3(event, e->event_type, e->x, e->y);
 		return 1;
 
 	case PROTO_40h_AUX_INPUT:
@@ -188,6 +196,8 @@ static int proto_40h_next_event(monome_t *monome, monome_event_t *e) {
 		return 0;
 	}
 
+	stats_add(&monome->stats.parse_errors, 1);
+	PROBE2(parse_error, buf[0], len);
 	return 0;
 }
 
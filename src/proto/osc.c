@@ -30,6 +30,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <lo/lo.h>
 
 #include <monome.h>
@@ -38,7 +44,11 @@
 #include "osc.h"
 
 #define SELF_FROM(what_okay) monome_osc_t *self = (monome_osc_t *) what_okay;
-#define LO_SEND_MSG(type, ...) lo_send_from(self->outgoing, self->server, LO_TT_IMMEDIATE, self->type##_str, __VA_ARGS__)
+#define OSC_SEND_MSG(type, ...) proto_osc_send(self, self->type##_str, __VA_ARGS__)
+
+#define DEFAULT_UNIX_PREFIX "/monome"
+
+static int proto_osc_sync_send(monome_osc_t *self);
 
 static int proto_osc_close(monome_t *monome);
 static void proto_osc_free(monome_t *monome);
@@ -48,8 +58,8 @@ static void proto_osc_free(monome_t *monome);
  */
 
 static void proto_osc_lo_error(int num, const char *error_msg, const char *path) {
-	fprintf(stderr, "libmonome: liblo server error %d in %s:\n\t%s\n", num, path, error_msg);
-	fflush(stderr);
+	monome_log(MONOME_LOG_ERROR, 0, "libmonome: liblo server error %d in %s: %s",
+			   num, path, error_msg);
 }
 
 static int proto_osc_press_handler(const char *path, const char *types, lo_arg **argv, int argc, lo_message data, void *user_data) {
@@ -67,93 +77,443 @@ static int proto_osc_press_handler(const char *path, const char *types, lo_arg *
 	return 0;
 }
 
+/* OSC strings are nul-terminated and padded out to a multiple of 4 */
+static uint8_t *proto_osc_put_string(uint8_t *p, uint8_t *end, const char *prefix, const char *str) {
+	size_t plen = strlen(prefix), len = strlen(str), padded;
+
+	padded = (plen + len + 4) & ~3;
+	if( padded > end - p )
+		return NULL;
+
+	memcpy(p, prefix, plen);
+	memcpy(p + plen, str, len);
+	memset(p + plen + len, 0, padded - plen - len);
+
+	return p + padded;
+}
+
+/* serialises a message by hand rather than building an lo_message, so
+   nothing gets allocated per LED call.  ints are 'i', blobs are 'b' and
+   take a length and a pointer to the data. */
+static ssize_t proto_osc_encode(uint8_t *buf, size_t size, const char *path, const char *types, va_list args) {
+	uint8_t *p = buf, *end = buf + size;
+	const uint8_t *data;
+	uint32_t i;
+	size_t len;
+
+	if( !(p = proto_osc_put_string(p, end, "", path)) ||
+		!(p = proto_osc_put_string(p, end, ",", types)) )
+		return -1;
+
+	for( ; *types; types++ )
+		switch( *types ) {
+		case 'i':
+			if( end - p < sizeof(i) )
+				return -1;
+
+			i = htonl(va_arg(args, int));
+			memcpy(p, &i, sizeof(i));
+			p += sizeof(i);
+			break;
+
+		case 'b':
+			len  = va_arg(args, size_t);
+			data = va_arg(args, const uint8_t *);
+
+			if( end - p < sizeof(i) + ((len + 3) & ~3) )
+				return -1;
+
+			i = htonl(len);
+			memcpy(p, &i, sizeof(i));
+			memcpy(p + sizeof(i), data, len);
+			memset(p + sizeof(i) + len, 0, ((len + 3) & ~3) - len);
+			p += sizeof(i) + ((len + 3) & ~3);
+			break;
+
+		default:
+			return -1;
+		}
+
+	return p - buf;
+}
+
+static ssize_t proto_osc_build(uint8_t *buf, size_t size, const char *path, const char *types, ...) {
+	va_list args;
+	ssize_t len;
+
+	va_start(args, types);
+	len = proto_osc_encode(buf, size, path, types, args);
+	va_end(args);
+
+	return len;
+}
+
+static int proto_osc_send(monome_osc_t *self, const char *path, const char *types, ...) {
+	uint8_t buf[OSC_STREAM_MAX_PACKET];
+	va_list args;
+	ssize_t len;
+
+	va_start(args, types);
+	len = proto_osc_encode(buf, sizeof(buf), path, types, args);
+	va_end(args);
+
+	if( len < 0 )
+		return -1;
+
+	if( self->stream.fd >= 0 )
+		return osc_stream_write(&self->stream, buf, len);
+
+	if( sendto(self->parent.fd, buf, len, 0,
+			   (struct sockaddr *) &self->dest, self->dest_len) < 0 )
+		return -1;
+
+	return 0;
+}
+
+static int proto_osc_sync_send(monome_osc_t *self) {
+	uint8_t buf[OSC_SYNC_MAX_DELTA];
+	uint32_t seq, base;
+	size_t len;
+
+	switch( osc_sync_next(self->sync, buf, &len, &seq, &base) ) {
+	case OSC_SYNC_KEY:
+		return OSC_SEND_MSG(sync_key, "ib", seq, len, buf);
+
+	case OSC_SYNC_DELTA:
+		return OSC_SEND_MSG(sync_delta, "iib", seq, base, len, buf);
+
+	default:
+		return 0;
+	}
+}
+
+/* in sync mode, LED commands only touch our copy of the grid and the
+   result goes out as a delta. */
+#define SYNC_OR_SEND(op, ...) do {\
+	if( self->sync ) {\
+		osc_sync_grid_##op(&self->sync->grid, __VA_ARGS__);\
+		return proto_osc_sync_send(self);\
+	}\
+} while( 0 )
+
+/* unix socket paths take up the whole path part of the URL, so the prefix
+   gets tacked on as a fragment: osc.unix:///tmp/monomeserial.sock#/monome */
+static char *proto_osc_unix_split(const char *url, char **prefix) {
+	const char *path, *frag;
+
+	if( !(path = strstr(url, "://")) )
+		return NULL;
+
+	if( !(path = strchr(path + 3, '/')) )
+		return NULL;
+
+	if( (frag = strchr(path, '#')) && frag[1] ) {
+		*prefix = strdup(frag + 1);
+		return strndup(path, frag - path);
+	}
+
+	*prefix = strdup(DEFAULT_UNIX_PREFIX);
+	return strndup(path, (frag) ? frag - path : strlen(path));
+}
+
 /**
  * public
  */
 
 static int proto_osc_clear(monome_t *monome, monome_clear_status_t status) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(clear, "i", status);
+	SYNC_OR_SEND(clear, status);
+	return OSC_SEND_MSG(clear, "i", status);
 }
 
 static int proto_osc_intensity(monome_t *monome, uint brightness) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(intensity, "i", brightness);
+	return OSC_SEND_MSG(intensity, "i", brightness);
 }
 
 static int proto_osc_mode(monome_t *monome, monome_mode_t mode) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(mode, "i", mode);
+	return OSC_SEND_MSG(mode, "i", mode);
 }
 
 static int proto_osc_led_on(monome_t *monome, uint x, uint y) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(led, "iii", x, y, 1);
+	SYNC_OR_SEND(led, x, y, 1);
+	return OSC_SEND_MSG(led, "iii", x, y, 1);
 }
 
 static int proto_osc_led_off(monome_t *monome, uint x, uint y) {
 	SELF_FROM(monome);
-	return LO_SEND_MSG(led, "iii", x, y, 0);
+	SYNC_OR_SEND(led, x, y, 0);
+	return OSC_SEND_MSG(led, "iii", x, y, 0);
 }
 
 static int proto_osc_led_col(monome_t *monome, uint col, size_t count, const uint8_t *data) {
 	SELF_FROM(monome);
+	SYNC_OR_SEND(col, col, count, data);
 
 	if( count == 1 )
-		return LO_SEND_MSG(led_col, "ii", col, data[0]);
+		return OSC_SEND_MSG(led_col, "ii", col, data[0]);
 
-	return LO_SEND_MSG(led_col, "iii", col, data[0], data[1]);
+	return OSC_SEND_MSG(led_col, "iii", col, data[0], data[1]);
 }
 
 static int proto_osc_led_row(monome_t *monome, uint row, size_t count, const uint8_t *data) {
 	SELF_FROM(monome);
+	SYNC_OR_SEND(row, row, count, data);
 
 	if( count == 1 )
-		return LO_SEND_MSG(led_row, "ii", row, data[0]);
+		return OSC_SEND_MSG(led_row, "ii", row, data[0]);
+
+	return OSC_SEND_MSG(led_row, "iii", row, data[0], data[1]);
+}
+
+/* frames and maps both go out as a single /map message carrying a packed
+   bitmap blob: x offset, y offset, width, height, then the rows, each
+   (width + 7) / 8 bytes long.  a full 256 fits in one 32 byte blob. */
+static int proto_osc_send_map(monome_osc_t *self, uint x, uint y, uint cols, uint rows, const uint8_t *data) {
+	size_t len = rows * ((cols + 7) / 8);
+	return OSC_SEND_MSG(map, "iiiib", x, y, cols, rows, len, data);
+}
 
-	return LO_SEND_MSG(led_row, "iii", row, data[0], data[1]);
+static int proto_osc_led_frame(monome_t *monome, uint quadrant, const uint8_t *frame_data) {
+	SELF_FROM(monome);
+	SYNC_OR_SEND(frame, quadrant, frame_data);
+	return proto_osc_send_map(self, (quadrant & 1) * 8, (quadrant & 2) * 4, 8, 8, frame_data);
 }
 
-static int proto_osc_led_frame(monome_t *monome, uint quadrant, const uint8_t *f) {
+static int proto_osc_led_map(monome_t *monome, uint cols, uint rows, const uint8_t *map_data) {
 	SELF_FROM(monome);
+	SYNC_OR_SEND(map, cols, rows, map_data);
+	return proto_osc_send_map(self, 0, 0, cols, rows, map_data);
+}
+
+/* whether buf is the template msg with different int arguments, which
+   get copied out (still big-endian) if it is */
+static int proto_osc_match(const uint8_t *msg, size_t msg_len, const uint8_t *buf, size_t len, uint32_t *args, int nargs) {
+	size_t args_len = nargs * sizeof(*args);
+
+	if( !msg_len || len != msg_len || memcmp(buf, msg, len - args_len) )
+		return 0;
 
-	/* there has to be a cleaner way to do this */
-	return LO_SEND_MSG(frame, "iiiiiiiii", f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7], quadrant);
+	memcpy(args, buf + len - args_len, args_len);
+	return 1;
+}
+
+/* presses are nearly everything that comes in, and liblo allocates a
+   message for each one it dispatches, so they get matched against the
+   template and picked apart here, as do sync replies.  anything else is
+   liblo's problem, except over TCP where there's no server to hand it
+   to. */
+static void proto_osc_dispatch(monome_osc_t *self, const uint8_t *buf, size_t len) {
+	monome_event_t *e = self->e_ptr;
+	uint32_t args[3];
+
+	if( proto_osc_match(self->press_msg, self->press_len, buf, len, args, 3) ) {
+		e->x          = ntohl(args[0]);
+		e->y          = ntohl(args[1]);
+		e->event_type = ntohl(args[2]) & 1;
+
+		self->have_event = 1;
+	} else if( proto_osc_match(self->ack_msg, self->ack_len, buf, len, args, 1) ) {
+		/* a repeated ack with updates still outstanding means the last
+		   one never made it */
+		if( !osc_sync_ack(self->sync, ntohl(args[0])) &&
+			self->sync->base != self->sync->seq )
+			proto_osc_sync_send(self);
+	} else if( proto_osc_match(self->resync_msg, self->resync_len, buf, len, args, 1) ) {
+		osc_sync_resync(self->sync);
+		proto_osc_sync_send(self);
+	} else if( self->server )
+		lo_server_dispatch_data(self->server, (void *) buf, len);
 }
 
 static int proto_osc_next_event(monome_t *monome, monome_event_t *e) {
 	SELF_FROM(monome);
+	uint8_t buf[OSC_STREAM_MAX_PACKET];
+	ssize_t len;
 
 	self->e_ptr = e;
 	self->have_event = 0;
 
-	lo_server_recv_noblock(self->server, 0);
+	if( self->stream.fd < 0 )
+		len = recv(monome->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	else
+		len = osc_stream_recv_one(&self->stream, buf, sizeof(buf));
+
+	if( len > 0 )
+		proto_osc_dispatch(self, buf, len);
 
 	return self->have_event;
 }
 
+/* we send from the server's socket, so the address has to be in the same
+   family as it is */
+static int proto_osc_resolve(monome_osc_t *self, const char *host, const char *port) {
+	struct sockaddr_storage local;
+	socklen_t len = sizeof(local);
+	struct addrinfo hints, *res;
+
+	if( getsockname(self->parent.fd, (struct sockaddr *) &local, &len) )
+		return -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = local.ss_family;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if( getaddrinfo(host, port, &hints, &res) )
+		return -1;
+
+	memcpy(&self->dest, res->ai_addr, res->ai_addrlen);
+	self->dest_len = res->ai_addrlen;
+
+	freeaddrinfo(res);
+	return 0;
+}
+
+static int proto_osc_resolve_unix(monome_osc_t *self, const char *path) {
+	struct sockaddr_un *sun = (struct sockaddr_un *) &self->dest;
+
+	if( strlen(path) >= sizeof(sun->sun_path) )
+		return -1;
+
+	sun->sun_family = AF_UNIX;
+	strcpy(sun->sun_path, path);
+	self->dest_len = sizeof(*sun);
+
+	return 0;
+}
+
 static int proto_osc_open(monome_t *monome, const char *dev, va_list args) {
 	SELF_FROM(monome);
-	char *port, *buf;
+	char *port, *buf, *host;
+	ssize_t len;
+	int interval, err;
 
 	port = va_arg(args, char *);
+	osc_stream_init(&self->stream, -1);
 
-	if( !(self->server = lo_server_new(port, proto_osc_lo_error)) )
-		return 1;
+	switch( (self->proto = lo_url_get_protocol_id(dev)) ) {
+	case LO_UDP:
+		if( !(self->server = lo_server_new(port, proto_osc_lo_error)) )
+			return 1;
+
+		self->prefix = lo_url_get_path(dev);
+		monome->fd   = lo_server_get_socket_fd(self->server);
+
+		host = lo_url_get_hostname(dev);
+		buf  = lo_url_get_port(dev);
+
+		err = proto_osc_resolve(self, host, buf);
+
+		if( err )
+			fprintf(stderr, "libmonome: could not resolve %s:%s\n", host, buf);
+
+		free(host);
+		free(buf);
+
+		if( err )
+			return 1;
+		break;
+
+	case LO_UNIX:
+		/* for unix sockets, "port" is the path we listen on */
+		if( osc_unix_unlink_stale(port) ) {
+			fprintf(stderr, "libmonome: something's already listening on %s\n", port);
+			return 1;
+		}
+
+		if( !(self->server = lo_server_new_with_proto(port, LO_UNIX, proto_osc_lo_error)) )
+			return 1;
+
+		if( port )
+			self->unix_path = strdup(port);
+
+		if( !(buf = proto_osc_unix_split(dev, &self->prefix)) )
+			return 1;
+
+		monome->fd = lo_server_get_socket_fd(self->server);
+
+		err = proto_osc_resolve_unix(self, buf);
+
+		if( err )
+			fprintf(stderr, "libmonome: socket path %s is too long\n", buf);
+
+		free(buf);
+
+		if( err )
+			return 1;
+		break;
+
+	case LO_TCP:
+		/* presses come back over the same connection, so there's no
+		   server, just the stream */
+		host = lo_url_get_hostname(dev);
+		buf  = lo_url_get_port(dev);
+
+		err = osc_stream_connect(&self->stream, host, buf);
 
-	self->prefix   = lo_url_get_path(dev);
-	self->outgoing = lo_address_new_from_url(dev);
+		if( err )
+			fprintf(stderr, "libmonome: could not connect to %s:%s\n", host, buf);
 
-	if( (monome->fd = lo_server_get_socket_fd(self->server)) < 0 ) {
-		proto_osc_close(monome);
-		proto_osc_free(monome);
+		free(host);
+		free(buf);
+
+		if( err )
+			return 1;
+
+		self->prefix = lo_url_get_path(dev);
+		monome->fd   = self->stream.fd;
+		break;
+
+	default:
+		fprintf(stderr, "libmonome: unsupported OSC transport in %s\n", dev);
 		return 1;
 	}
 
+	if( !self->prefix || monome->fd < 0 )
+		return 1;
+
 	asprintf(&buf, "%s/press", self->prefix);
-	lo_server_add_method(self->server, buf, "iii", proto_osc_press_handler, self);
+
+	if( self->server )
+		lo_server_add_method(self->server, buf, "iii", proto_osc_press_handler, self);
+
+	len = proto_osc_build(self->press_msg, sizeof(self->press_msg), buf, "iii", 0, 0, 0);
 	free(buf);
 
+	if( len < 0 )
+		return 1;
+
+	self->press_len = len;
+
+	/* MONOME_OSC_SYNC=<n> switches on delta sync, with a keyframe at
+	   least every n updates. */
+	if( (buf = getenv("MONOME_OSC_SYNC")) && (interval = atoi(buf)) > 0 ) {
+		if( !(self->sync = malloc(sizeof(osc_sync_t))) )
+			return 1;
+
+		osc_sync_init(self->sync, interval);
+
+		asprintf(&buf, "%s/sync/ack", self->prefix);
+		len = proto_osc_build(self->ack_msg, sizeof(self->ack_msg), buf, "i", 0);
+		free(buf);
+
+		if( len < 0 )
+			return 1;
+
+		self->ack_len = len;
+
+		asprintf(&buf, "%s/sync/resync", self->prefix);
+		len = proto_osc_build(self->resync_msg, sizeof(self->resync_msg), buf, "i", 0);
+		free(buf);
+
+		if( len < 0 )
+			return 1;
+
+		self->resync_len = len;
+	}
+
 #define cache_osc_path(base) asprintf(&self->base##_str, "%s/" #base, self->prefix)
 	cache_osc_path(clear);
 	cache_osc_path(intensity);
@@ -161,13 +521,19 @@ static int proto_osc_open(monome_t *monome, const char *dev, va_list args) {
 	cache_osc_path(led);
 	cache_osc_path(led_row);
 	cache_osc_path(led_col);
-	cache_osc_path(frame);
+	cache_osc_path(map);
 #undef cache_osc_path
 
+	asprintf(&self->sync_delta_str, "%s/sync/delta", self->prefix);
+	asprintf(&self->sync_key_str, "%s/sync/key", self->prefix);
+
 	return 0;
 }
 
 static int proto_osc_close(monome_t *monome) {
+	SELF_FROM(monome);
+
+	osc_stream_close(&self->stream);
 	return 0;
 }
 
@@ -181,16 +547,25 @@ static void proto_osc_free(monome_t *monome) {
 	clear_osc_path(led);
 	clear_osc_path(led_row);
 	clear_osc_path(led_col);
-	clear_osc_path(frame);
+	clear_osc_path(map);
+	clear_osc_path(sync_delta);
+	clear_osc_path(sync_key);
 #undef clear_osc_path
 
 	free(self->prefix);
-	lo_server_free(self->server);
-	lo_address_free(self->outgoing);
+	free(self->sync);
+	osc_stream_close(&self->stream);
+
+	if( self->server )
+		lo_server_free(self->server);
 
-	self->prefix   = NULL;
-	self->server   = NULL;
-	self->outgoing = NULL;
+	if( self->unix_path ) {
+		unlink(self->unix_path);
+		free(self->unix_path);
+	}
+
+	self->prefix = NULL;
+	self->server = NULL;
 
 	free(self);
 }
@@ -201,6 +576,8 @@ monome_t *monome_protocol_new() {
 	
 	if( !monome )
 		return NULL;
+
+	osc_stream_init(&self->stream, -1);
 	
 	monome->open       = proto_osc_open;
 	monome->close      = proto_osc_close;
@@ -217,6 +594,7 @@ monome_t *monome_protocol_new() {
 	monome->led_col    = proto_osc_led_col;
 	monome->led_row    = proto_osc_led_row;
 	monome->led_frame  = proto_osc_led_frame;
+	monome->led_map    = proto_osc_led_map;
 
 	return monome;
 }
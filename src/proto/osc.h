@@ -26,23 +26,55 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/socket.h>
 #include <lo/lo.h>
 
 #include "monome.h"
 #include "internal.h"
 
+#include "osc_stream.h"
+#include "osc_sync.h"
+
+/* big enough for "<prefix>/press" and three ints */
+#define OSC_PRESS_MAX 128
+
 typedef struct monome_osc monome_osc_t;
 
 struct monome_osc {
 	monome_t parent;
 
+	/* not used over TCP, where everything comes in on the stream */
 	lo_server server;
-	lo_address outgoing;
 	char *prefix;
 
+	/* where UDP and unix socket messages go, resolved once at open so
+	   sending doesn't have to */
+	struct sockaddr_storage dest;
+	socklen_t dest_len;
+
+	int proto;
+	osc_stream_t stream;
+
+	/* only allocated in sync mode */
+	osc_sync_t *sync;
+
 	int have_event;
 	monome_event_t *e_ptr;
 
+	/* a serialised <prefix>/press, incoming packets that match it up to
+	   the last 12 bytes (the three ints) skip liblo's dispatcher.  the
+	   same goes for <prefix>/sync/ack and /sync/resync in sync mode. */
+	uint8_t press_msg[OSC_PRESS_MAX];
+	size_t press_len;
+
+	uint8_t ack_msg[OSC_PRESS_MAX];
+	uint8_t resync_msg[OSC_PRESS_MAX];
+	size_t ack_len;
+	size_t resync_len;
+
+	/* the unix socket we're listening on, if that's the transport */
+	char *unix_path;
+
 	char *clear_str;
 	char *intensity_str;
 	char *mode_str;
@@ -50,5 +82,8 @@ struct monome_osc {
 	char *led_str;
 	char *led_row_str;
 	char *led_col_str;
-	char *frame_str;
+	char *map_str;
+
+	char *sync_delta_str;
+	char *sync_key_str;
 };
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "osc_stream.h"
+
+#define SLIP_END     0xC0
+#define SLIP_ESC     0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+/**
+ * private
+ */
+
+static void set_nodelay(int fd) {
+	int one = 1;
+
+	/* OSC messages are tiny and latency is the whole point, don't let
+	   nagle sit on them. */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static int would_block(int err) {
+	return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+}
+
+/* SLIP or length prefix, whichever the other end is using */
+static size_t stream_frame(osc_stream_t *stream, uint8_t *out,
+                           const uint8_t *p, size_t len) {
+	uint32_t size;
+	size_t i, n = 0;
+
+	if( stream->framing != OSC_STREAM_FRAMING_SLIP ) {
+		size = htonl(len);
+		memcpy(out, &size, sizeof(size));
+		memcpy(out + sizeof(size), p, len);
+
+		return sizeof(size) + len;
+	}
+
+	out[n++] = SLIP_END;
+
+	for( i = 0; i < len; i++ )
+		switch( p[i] ) {
+		case SLIP_END:
+			out[n++] = SLIP_ESC;
+			out[n++] = SLIP_ESC_END;
+			break;
+
+		case SLIP_ESC:
+			out[n++] = SLIP_ESC;
+			out[n++] = SLIP_ESC_ESC;
+			break;
+
+		default:
+			out[n++] = p[i];
+		}
+
+	out[n++] = SLIP_END;
+	return n;
+}
+
+static int stream_read_length(osc_stream_t *stream, osc_stream_packet_cb_t cb,
+                              void *user_data) {
+	uint32_t size;
+	size_t used;
+
+	for( used = 0; stream->len - used >= 4; used += 4 + size ) {
+		memcpy(&size, stream->buf + used, sizeof(size));
+		size = ntohl(size);
+
+		if( size > OSC_STREAM_MAX_PACKET )
+			return -1;
+
+		if( stream->len - used - 4 < size )
+			break;
+
+		cb(stream, stream->buf + used + 4, size, user_data);
+	}
+
+	stream->len -= used;
+	memmove(stream->buf, stream->buf + used, stream->len);
+
+	return 0;
+}
+
+static int stream_read_slip(osc_stream_t *stream, const uint8_t *data,
+                            size_t count, osc_stream_packet_cb_t cb,
+                            void *user_data) {
+	uint8_t c;
+
+	for( ; count; data++, count-- ) {
+		c = *data;
+
+		if( stream->slip_escaped ) {
+			stream->slip_escaped = 0;
+
+			switch( c ) {
+			case SLIP_ESC_END: c = SLIP_END; break;
+			case SLIP_ESC_ESC: c = SLIP_ESC; break;
+			}
+		} else if( c == SLIP_END ) {
+			if( stream->len )
+				cb(stream, stream->buf, stream->len, user_data);
+
+			stream->len = 0;
+			continue;
+		} else if( c == SLIP_ESC ) {
+			stream->slip_escaped = 1;
+			continue;
+		}
+
+		if( stream->len >= OSC_STREAM_MAX_PACKET )
+			return -1;
+
+		stream->buf[stream->len++] = c;
+	}
+
+	return 0;
+}
+
+/**
+ * public
+ */
+
+void osc_stream_init(osc_stream_t *stream, int fd) {
+	stream->fd           = fd;
+	stream->framing      = OSC_STREAM_FRAMING_UNKNOWN;
+	stream->slip_escaped = 0;
+	stream->len          = 0;
+	stream->nonblocking  = 0;
+	stream->queued       = 0;
+}
+
+int osc_stream_listen(const char *port) {
+	struct addrinfo hints, *res, *ai;
+	int fd = -1, one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags    = AI_PASSIVE;
+
+	if( getaddrinfo(NULL, port, &hints, &res) )
+		return -1;
+
+	for( ai = res; ai; ai = ai->ai_next ) {
+		if( (fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0 )
+			continue;
+
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		if( !bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, 8) )
+			break;
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+	return fd;
+}
+
+int osc_stream_accept(osc_stream_t *stream, int listen_fd) {
+	int fd;
+
+	if( (fd = accept(listen_fd, NULL, NULL)) < 0 )
+		return -1;
+
+	/* one slow client mustn't hold up everyone else, so accepted streams
+	   queue what they can't send rather than waiting */
+	if( fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) ) {
+		close(fd);
+		return -1;
+	}
+
+	set_nodelay(fd);
+	osc_stream_init(stream, fd);
+	stream->nonblocking = 1;
+
+	return 0;
+}
+
+int osc_stream_connect(osc_stream_t *stream, const char *host, const char *port) {
+	struct addrinfo hints, *res, *ai;
+	int fd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family   = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if( getaddrinfo(host, port, &hints, &res) )
+		return -1;
+
+	for( ai = res; ai; ai = ai->ai_next ) {
+		if( (fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0 )
+			continue;
+
+		if( !connect(fd, ai->ai_addr, ai->ai_addrlen) )
+			break;
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if( fd < 0 )
+		return -1;
+
+	set_nodelay(fd);
+	osc_stream_init(stream, fd);
+	stream->framing = OSC_STREAM_FRAMING_LENGTH;
+
+	return 0;
+}
+
+void osc_stream_close(osc_stream_t *stream) {
+	if( stream->fd >= 0 )
+		close(stream->fd);
+
+	osc_stream_init(stream, -1);
+}
+
+/* reads whatever is waiting on the socket and calls cb once for every
+   complete packet.  returns -1 when the peer has gone away or sent us
+   garbage, at which point the caller should osc_stream_close(). */
+int osc_stream_read(osc_stream_t *stream, osc_stream_packet_cb_t cb,
+                    void *user_data) {
+	uint8_t slip_buf[512];
+	ssize_t nbytes;
+
+	if( stream->framing != OSC_STREAM_FRAMING_SLIP ) {
+		nbytes = recv(stream->fd, stream->buf + stream->len,
+		              sizeof(stream->buf) - stream->len, MSG_DONTWAIT);
+
+		if( nbytes <= 0 )
+			return (nbytes < 0 && errno == EAGAIN) ? 0 : -1;
+
+		/* a SLIP stream always starts with an END, whereas the first byte
+		   of a length prefix is always zero for any sane packet size. */
+		if( stream->framing == OSC_STREAM_FRAMING_UNKNOWN ) {
+			if( stream->buf[0] == SLIP_END ) {
+				stream->framing = OSC_STREAM_FRAMING_SLIP;
+				return stream_read_slip(stream, stream->buf, nbytes,
+				                        cb, user_data);
+			}
+
+			stream->framing = OSC_STREAM_FRAMING_LENGTH;
+		}
+
+		stream->len += nbytes;
+		return stream_read_length(stream, cb, user_data);
+	}
+
+	if( (nbytes = recv(stream->fd, slip_buf, sizeof(slip_buf), MSG_DONTWAIT)) <= 0 )
+		return (nbytes < 0 && errno == EAGAIN) ? 0 : -1;
+
+	return stream_read_slip(stream, slip_buf, nbytes, cb, user_data);
+}
+
+/* pulls exactly one length-prefixed packet off the socket, leaving anything
+   after it in the kernel buffer so that select() still wakes up for it.
+   nothing is taken until the whole packet is there, so this never waits.
+   returns 0 if there's no complete packet yet, -1 if the stream is gone
+   or out of sync. */
+ssize_t osc_stream_recv_one(osc_stream_t *stream, void *buf, size_t bufsize) {
+	uint32_t size;
+	ssize_t nbytes;
+
+	nbytes = recv(stream->fd, &size, sizeof(size), MSG_PEEK | MSG_DONTWAIT);
+
+	if( nbytes == 0 )
+		return -1;
+	else if( nbytes < (ssize_t) sizeof(size) )
+		return (nbytes < 0 && !would_block(errno)) ? -1 : 0;
+
+	size = ntohl(size);
+
+	/* there's no skipping one we can't hold without waiting for all of
+	   it, and losing our place in the stream is worse */
+	if( size > OSC_STREAM_MAX_PACKET || size > bufsize )
+		return -1;
+
+	nbytes = recv(stream->fd, stream->buf, sizeof(size) + size,
+	              MSG_PEEK | MSG_DONTWAIT);
+
+	if( nbytes < (ssize_t) (sizeof(size) + size) )
+		return (nbytes < 0 && !would_block(errno)) ? -1 : 0;
+
+	if( recv(stream->fd, stream->buf, sizeof(size) + size, MSG_DONTWAIT) !=
+	    sizeof(size) + size )
+		return -1;
+
+	memcpy(buf, stream->buf + sizeof(size), size);
+	return size;
+}
+
+/* sends a packet, framed the way the other end expects.  a blocking
+   stream waits until every byte is out, so the framing can't be left
+   half-written.  a non-blocking one queues whatever the socket won't take,
+   and returns -1 once too much is queued: the caller should give up on
+   a client that far behind. */
+int osc_stream_write(osc_stream_t *stream, const void *packet, size_t len) {
+	uint8_t framed[OSC_STREAM_MAX_PACKET * 2 + 2];
+	ssize_t sent;
+	size_t n, off;
+
+	if( len > OSC_STREAM_MAX_PACKET )
+		return -1;
+
+	n = stream_frame(stream, framed, packet, len);
+
+	if( stream->queued && osc_stream_flush(stream) )
+		return -1;
+
+	for( off = 0; off < n && !stream->queued; off += sent )
+		if( (sent = send(stream->fd, framed + off, n - off,
+		                 MSG_NOSIGNAL | (stream->nonblocking ? MSG_DONTWAIT : 0))) < 0 ) {
+			if( !would_block(errno) )
+				return -1;
+
+			if( stream->nonblocking )
+				break;
+
+			sent = 0;
+		}
+
+	if( off == n )
+		return 0;
+
+	if( n - off > sizeof(stream->queue) - stream->queued )
+		return -1;
+
+	memcpy(stream->queue + stream->queued, framed + off, n - off);
+	stream->queued += n - off;
+
+	return 0;
+}
+
+/* sends as much of the queue as the socket will take.  -1 if the stream
+   has gone away. */
+int osc_stream_flush(osc_stream_t *stream) {
+	ssize_t sent;
+
+	while( stream->queued ) {
+		if( (sent = send(stream->fd, stream->queue, stream->queued,
+		                 MSG_NOSIGNAL | MSG_DONTWAIT)) < 0 )
+			return would_block(errno) ? 0 : -1;
+
+		stream->queued -= sent;
+		memmove(stream->queue, stream->queue + sent, stream->queued);
+	}
+
+	return 0;
+}
+
+/* a unix socket path that's left over from a process that didn't clean up
+   after itself makes bind() fail.  it's only removed if nothing answers on
+   it, so a running instance doesn't get its socket pulled out from under
+   it.  returns -1 if something's still listening there. */
+int osc_unix_unlink_stale(const char *path) {
+	struct sockaddr_un sun;
+	struct stat st;
+	int fd, live;
+
+	if( !path || strlen(path) >= sizeof(sun.sun_path) ||
+	    lstat(path, &st) || !S_ISSOCK(st.st_mode) )
+		return 0;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	if( (fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 )
+		return 0;
+
+	live = !connect(fd, (struct sockaddr *) &sun, sizeof(sun));
+	close(fd);
+
+	if( live )
+		return -1;
+
+	if( errno == ECONNREFUSED )
+		unlink(path);
+
+	return 0;
+}
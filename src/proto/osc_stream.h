@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* length-prefixed and SLIP-framed OSC over stream sockets.
+
+   liblo only hands us a single fd for a server, which doesn't play well
+   with TCP (every accepted connection is another fd hidden inside liblo),
+   so we do the framing ourselves and hand complete packets off to
+   lo_server_dispatch_data(). */
+
+#ifndef _OSC_STREAM_H
+#define _OSC_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#define OSC_STREAM_MAX_PACKET 4096
+
+/* how much output a client can have waiting before it counts as having
+   fallen behind.  room for a few worst-case SLIP packets. */
+#define OSC_STREAM_MAX_QUEUED (8 * (OSC_STREAM_MAX_PACKET * 2 + 2))
+
+typedef enum {
+	OSC_STREAM_FRAMING_UNKNOWN = 0,
+	OSC_STREAM_FRAMING_LENGTH  = 1, /* OSC 1.0: 32-bit big-endian size */
+	OSC_STREAM_FRAMING_SLIP    = 2  /* OSC 1.1: double-END SLIP */
+} osc_stream_framing_t;
+
+typedef struct osc_stream osc_stream_t;
+
+typedef void (*osc_stream_packet_cb_t)
+	(osc_stream_t *stream, void *packet, size_t len, void *user_data);
+
+struct osc_stream {
+	int fd;
+	osc_stream_framing_t framing;
+
+	int slip_escaped;
+	size_t len;
+	uint8_t buf[OSC_STREAM_MAX_PACKET + 4];
+
+	/* accepted streams never block.  whatever the socket won't take
+	   straight away waits here for osc_stream_flush(). */
+	int nonblocking;
+	size_t queued;
+	uint8_t queue[OSC_STREAM_MAX_QUEUED];
+};
+
+void osc_stream_init(osc_stream_t *stream, int fd);
+
+int osc_stream_listen(const char *port);
+int osc_stream_accept(osc_stream_t *stream, int listen_fd);
+int osc_stream_connect(osc_stream_t *stream, const char *host, const char *port);
+void osc_stream_close(osc_stream_t *stream);
+
+int osc_stream_read(osc_stream_t *stream, osc_stream_packet_cb_t cb,
+                    void *user_data);
+ssize_t osc_stream_recv_one(osc_stream_t *stream, void *buf, size_t bufsize);
+int osc_stream_write(osc_stream_t *stream, const void *packet, size_t len);
+int osc_stream_flush(osc_stream_t *stream);
+
+int osc_unix_unlink_stale(const char *path);
+
+#endif /* defined _OSC_STREAM_H */
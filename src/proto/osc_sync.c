@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "osc_sync.h"
+
+/**
+ * private
+ */
+
+static const osc_sync_grid_t *history_find(osc_sync_t *sync, uint32_t seq) {
+	if( !seq || sync->history[seq % OSC_SYNC_HISTORY].seq != seq )
+		return NULL;
+
+	return &sync->history[seq % OSC_SYNC_HISTORY].grid;
+}
+
+static void history_store(osc_sync_t *sync, uint32_t seq,
+                          const osc_sync_grid_t *grid) {
+	sync->history[seq % OSC_SYNC_HISTORY].seq  = seq;
+	sync->history[seq % OSC_SYNC_HISTORY].grid = *grid;
+}
+
+/* on the receiving side the history is the sender's grid, and sync->grid
+   is that plus whatever plain led messages did to it since.  only the
+   leds the sender actually changed are taken from the update, so a local
+   write sticks around until the sender says something about that led. */
+static void grid_merge(osc_sync_t *sync, const osc_sync_grid_t *next) {
+	const osc_sync_grid_t *last;
+	uint16_t changed;
+	uint i;
+
+	if( !(last = history_find(sync, sync->seq)) ) {
+		sync->grid = *next;
+		return;
+	}
+
+	for( i = 0; i < 16; i++ ) {
+		changed = last->rows[i] ^ next->rows[i];
+		sync->grid.rows[i] = (sync->grid.rows[i] & ~changed) |
+		                     (next->rows[i] & changed);
+	}
+}
+
+static void grid_encode(const osc_sync_grid_t *grid, uint8_t *buf) {
+	uint i;
+
+	for( i = 0; i < 16; i++ ) {
+		*buf++ = grid->rows[i] & 0xFF;
+		*buf++ = grid->rows[i] >> 8;
+	}
+}
+
+/**
+ * grid operations
+ *
+ * these mirror what the corresponding libmonome calls do to a device,
+ * in unrotated (application) coordinates.
+ */
+
+void osc_sync_grid_led(osc_sync_grid_t *grid, uint x, uint y, int on) {
+	if( x > 15 || y > 15 )
+		return;
+
+	if( on )
+		grid->rows[y] |= 1 << x;
+	else
+		grid->rows[y] &= ~(1 << x);
+}
+
+void osc_sync_grid_row(osc_sync_grid_t *grid, uint row, size_t count, const uint8_t *data) {
+	if( row > 15 )
+		return;
+
+	if( count == 1 )
+		grid->rows[row] = (grid->rows[row] & 0xFF00) | data[0];
+	else
+		grid->rows[row] = data[0] | (data[1] << 8);
+}
+
+void osc_sync_grid_col(osc_sync_grid_t *grid, uint col, size_t count, const uint8_t *data) {
+	uint y;
+
+	if( col > 15 )
+		return;
+
+	for( y = 0; y < ((count == 1) ? 8 : 16); y++ )
+		osc_sync_grid_led(grid, col, y, data[y / 8] & (1 << (y & 7)));
+}
+
+void osc_sync_grid_frame(osc_sync_grid_t *grid, uint quadrant, const uint8_t *data) {
+	uint x = (quadrant & 1) * 8, y = (quadrant & 2) * 4, i;
+
+	for( i = 0; i < 8; i++ )
+		grid->rows[y + i] = (grid->rows[y + i] & ~(0xFF << x)) | (data[i] << x);
+}
+
+/* same semantics as monome_led_map: one frame per quadrant touched */
+void osc_sync_grid_map(osc_sync_grid_t *grid, uint cols, uint rows, const uint8_t *data) {
+	uint8_t frame[8], mask;
+	uint stride = (cols + 7) / 8, x, y, i;
+
+	if( cols > 16 || rows > 16 )
+		return;
+
+	for( y = 0; y < rows; y += 8 )
+		for( x = 0; x < cols; x += 8 ) {
+			mask = (cols - x < 8) ? (1 << (cols - x)) - 1 : 0xFF;
+
+			for( i = 0; i < 8; i++ )
+				frame[i] = (y + i < rows) ? data[(y + i) * stride + x / 8] & mask : 0;
+
+			osc_sync_grid_frame(grid, (y / 8) * 2 + x / 8, frame);
+		}
+}
+
+void osc_sync_grid_clear(osc_sync_grid_t *grid, int on) {
+	memset(grid->rows, (on) ? 0xFF : 0x00, sizeof(grid->rows));
+}
+
+/**
+ * public
+ */
+
+void osc_sync_init(osc_sync_t *sync, uint keyframe_interval) {
+	memset(sync, 0, sizeof(*sync));
+	sync->keyframe_interval = keyframe_interval;
+}
+
+/* encodes the current grid as the next update.  buf needs room for
+   OSC_SYNC_MAX_DELTA bytes. */
+osc_sync_update_t osc_sync_next(osc_sync_t *sync, uint8_t *buf, size_t *len,
+                                uint32_t *seq, uint32_t *base) {
+	const osc_sync_grid_t *b = NULL;
+	uint16_t mask, diff;
+	uint8_t *p;
+	uint i;
+
+	/* nothing to say if the grid hasn't changed since the last update and
+	   the receiver is caught up.  if it isn't, the last update (or its
+	   ack) may have been lost, so it goes out again with a new number. */
+	if( sync->base == sync->seq && (b = history_find(sync, sync->seq)) &&
+	    !memcmp(b, &sync->grid, sizeof(sync->grid)) )
+		return OSC_SYNC_NONE;
+
+	b = NULL;
+	*seq = ++sync->seq;
+
+	if( sync->since_keyframe < sync->keyframe_interval )
+		b = history_find(sync, sync->base);
+
+	history_store(sync, *seq, &sync->grid);
+
+	if( !b ) {
+		grid_encode(&sync->grid, buf);
+
+		*len  = OSC_SYNC_GRID_SIZE;
+		*base = 0;
+
+		sync->since_keyframe = 0;
+		sync->stats.keyframes++;
+		return OSC_SYNC_KEY;
+	}
+
+	p = buf + 2;
+	mask = 0;
+
+	for( i = 0; i < 16; i++ ) {
+		if( !(diff = b->rows[i] ^ sync->grid.rows[i]) )
+			continue;
+
+		mask |= 1 << i;
+		*p++ = diff & 0xFF;
+		*p++ = diff >> 8;
+	}
+
+	buf[0] = mask & 0xFF;
+	buf[1] = mask >> 8;
+
+	*len  = p - buf;
+	*base = sync->base;
+
+	sync->since_keyframe++;
+	sync->stats.deltas++;
+	return OSC_SYNC_DELTA;
+}
+
+/* returns 1 if the receiver has moved on, 0 for an ack that doesn't tell
+   us anything new (the receiver repeats its last one every so often, see
+   the top of osc_sync.h).
+
+   an ack from before base means the receiver went backwards, most likely
+   because an old keyframe turned up late, or the acks got reordered.
+   either way, what it says it has is safe to diff against, so that's
+   the base from now on, and the 0 gets the caller to send again. */
+int osc_sync_ack(osc_sync_t *sync, uint32_t seq) {
+	if( seq > sync->base && seq <= sync->seq && history_find(sync, seq) ) {
+		sync->base = seq;
+		return 1;
+	}
+
+	if( seq < sync->base )
+		sync->base = (history_find(sync, seq)) ? seq : 0;
+
+	return 0;
+}
+
+void osc_sync_resync(osc_sync_t *sync) {
+	sync->base = 0;
+	sync->stats.resyncs++;
+}
+
+/* returns 1 if the delta was applied, 0 if it was stale or garbage, and -1
+   if we don't have its base frame any more and need a resync. */
+int osc_sync_apply_delta(osc_sync_t *sync, uint32_t seq, uint32_t base,
+                         const uint8_t *delta, size_t len) {
+	const osc_sync_grid_t *b;
+	osc_sync_grid_t grid;
+	const uint8_t *end = delta + len;
+	uint16_t mask;
+	uint i;
+
+	if( seq <= sync->seq || len < 2 )
+		return 0;
+
+	if( !(b = history_find(sync, base)) ) {
+		sync->stats.resyncs++;
+		return -1;
+	}
+
+	grid  = *b;
+	mask  = delta[0] | (delta[1] << 8);
+	delta += 2;
+
+	for( i = 0; i < 16; i++ ) {
+		if( !(mask & (1 << i)) )
+			continue;
+
+		if( delta + 2 > end )
+			return 0;
+
+		grid.rows[i] ^= delta[0] | (delta[1] << 8);
+		delta += 2;
+	}
+
+	if( seq != sync->seq + 1 )
+		sync->stats.gaps++;
+
+	grid_merge(sync, &grid);
+	sync->seq = seq;
+	history_store(sync, seq, &grid);
+
+	sync->stats.deltas++;
+	return 1;
+}
+
+/* keyframes are taken even if they go backwards, since they're also how
+   a restarted sender introduces itself, and then the history goes.  one
+   that's only a little way back (within the history) is just late,
+   though, and taking it would put the grid back to how it was.
+
+   going forwards, the history stays: deltas sent before the keyframe got
+   here are still based on an older frame, and dropping it would only get
+   each of those a resync, and so another keyframe. */
+int osc_sync_apply_key(osc_sync_t *sync, uint32_t seq,
+                       const uint8_t *grid, size_t len) {
+	osc_sync_grid_t key;
+	uint i;
+
+	if( !seq || seq == sync->seq || len < OSC_SYNC_GRID_SIZE )
+		return 0;
+
+	if( seq < sync->seq && seq + OSC_SYNC_HISTORY > sync->seq )
+		return 0;
+
+	for( i = 0; i < 16; i++, grid += 2 )
+		key.rows[i] = grid[0] | (grid[1] << 8);
+
+	grid_merge(sync, &key);
+
+	if( seq < sync->seq )
+		memset(sync->history, 0, sizeof(sync->history));
+
+	sync->seq = seq;
+	history_store(sync, seq, &key);
+
+	sync->stats.keyframes++;
+	return 1;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* delta-encoded grid state sync between the osc protocol module and
+   monomeserial.
+
+   every update carries a sequence number and the sequence number of the
+   frame it's relative to.  the sender always diffs against the newest frame
+   the receiver has acknowledged, so a lost packet doesn't break anything:
+   the next delta is simply relative to an older base and includes whatever
+   got dropped.  if the receiver doesn't have the base any more it asks for
+   a resync and gets a keyframe.
+
+   the receiver repeats its last ack every so often.  an ack that doesn't
+   move the sender's base means the receiver is behind, most likely
+   because the last update got lost, so the sender sends what it has
+   again instead of waiting for the grid to change.
+
+   plain led messages can be mixed in on the receiving side: an update
+   only overwrites the leds the sender changed since its previous one.
+
+   wire format:
+
+     <prefix>/sync/delta  iib  seq base delta
+     <prefix>/sync/key    ib   seq grid
+     <prefix>/sync/ack    i    seq            (receiver -> sender)
+     <prefix>/sync/resync i    seq            (receiver -> sender)
+
+   a grid is 16 rows of 16 bits, little endian, 32 bytes.  a delta is a
+   16-bit row mask followed by the XOR of each row set in the mask. */
+
+#ifndef _OSC_SYNC_H
+#define _OSC_SYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#define OSC_SYNC_HISTORY   32
+#define OSC_SYNC_GRID_SIZE 32
+#define OSC_SYNC_MAX_DELTA (2 + OSC_SYNC_GRID_SIZE)
+
+typedef enum {
+	OSC_SYNC_NONE  = 0,
+	OSC_SYNC_DELTA = 1,
+	OSC_SYNC_KEY   = 2
+} osc_sync_update_t;
+
+typedef struct osc_sync_grid osc_sync_grid_t;
+typedef struct osc_sync osc_sync_t;
+
+struct osc_sync_grid {
+	uint16_t rows[16];
+};
+
+struct osc_sync {
+	/* on the sending side, seq is the last update we sent and base is the
+	   newest one that's been acknowledged (0 if none).  on the receiving
+	   side, seq is the last update we applied. */
+	uint32_t seq;
+	uint32_t base;
+
+	uint keyframe_interval;
+	uint since_keyframe;
+
+	osc_sync_grid_t grid;
+
+	struct {
+		uint32_t seq;
+		osc_sync_grid_t grid;
+	} history[OSC_SYNC_HISTORY];
+
+	struct {
+		unsigned long deltas;
+		unsigned long keyframes;
+		unsigned long gaps;
+		unsigned long resyncs;
+	} stats;
+};
+
+void osc_sync_init(osc_sync_t *sync, uint keyframe_interval);
+
+void osc_sync_grid_led(osc_sync_grid_t *grid, uint x, uint y, int on);
+void osc_sync_grid_row(osc_sync_grid_t *grid, uint row, size_t count, const uint8_t *data);
+void osc_sync_grid_col(osc_sync_grid_t *grid, uint col, size_t count, const uint8_t *data);
+void osc_sync_grid_frame(osc_sync_grid_t *grid, uint quadrant, const uint8_t *data);
+void osc_sync_grid_map(osc_sync_grid_t *grid, uint cols, uint rows, const uint8_t *data);
+void osc_sync_grid_clear(osc_sync_grid_t *grid, int on);
+
+osc_sync_update_t osc_sync_next(osc_sync_t *sync, uint8_t *buf, size_t *len,
+                                uint32_t *seq, uint32_t *base);
+int osc_sync_ack(osc_sync_t *sync, uint32_t seq);
+void osc_sync_resync(osc_sync_t *sync);
+
+int osc_sync_apply_delta(osc_sync_t *sync, uint32_t seq, uint32_t base,
+                         const uint8_t *delta, size_t len);
+int osc_sync_apply_key(osc_sync_t *sync, uint32_t seq,
+                       const uint8_t *grid, size_t len);
+
+#endif /* defined _OSC_SYNC_H */
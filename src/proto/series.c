@@ -32,7 +32,9 @@
 #include <monome.h>
 #include "internal.h"
 #include "platform.h"
+#include "probes.h"
 #include "rotation.h"
+#include "stats.h"
 
 #include "series.h"
 
@@ -41,7 +43,9 @@
  */
 
 static int monome_write(monome_t *monome, const uint8_t *buf, ssize_t bufsize) {
-    if( monome_platform_write(monome, buf, bufsize) == bufsize )
+	PROBE3(encode, monome->cmd, buf[0], bufsize);
+
+	if( monome_platform_write(monome, buf, bufsize) == bufsize )
 		return 0;
 
 	return -1;
@@ -204,9 +208,17 @@ static int proto_series_led_frame(monome_t *monome, uint quadrant, const uint8_t
 
 static int proto_series_next_event(monome_t *monome, monome_event_t *e) {
 	uint8_t buf[2] = {0, 0};
+	ssize_t len;
+
+	if( (len = monome_platform_read(monome, buf, sizeof(buf))) < (ssize_t) sizeof(buf) ) {
+		/* half a message that never got finished */
+		if( len > 0 ) {
+			stats_add(&monome->stats.parse_errors, 1);
+			PROBE2(parse_error, buf[0], len);
+		}
 
-	if( monome_platform_read(monome, buf, sizeof(buf)) < sizeof(buf) )
 		return 0;
+	}
 
 	switch( buf[0] ) {
 	case PROTO_SERIES_BUTTON_DOWN:
@@ -216,6 +228,7 @@ static int proto_series_next_event(monome_t *monome, monome_event_t *e) {
 		e->y = buf[1] & 0x0F;
 
 		UNROTATE_COORDS(monome, e->x, e->y);
+		PROBE3(event, e->event_type, e->x, e->y);
 		return 1;
 
 	case PROTO_SERIES_AUX_INPUT:
@@ -223,6 +236,8 @@ static int proto_series_next_event(monome_t *monome, monome_event_t *e) {
 		return 0;
 	}
 
+	stats_add(&monome->stats.parse_errors, 1);
+	PROBE2(parse_error, buf[0], len);
 	return 0;
 }
 
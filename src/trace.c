@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2007-2010, William Light <will@visinin.com>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ * 
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#else
+#include <pthread.h>
+#endif
+
+#include <monome.h>
+#include "internal.h"
+#include "stats.h"
+#include "trace.h"
+
+/* a timeline of what libmonome (and whoever else calls monome_trace_end)
+   has been up to, as spans in a ring that gets written out as Chrome
+   trace-event JSON (for chrome://tracing or ui.perfetto.dev).
+
+   any thread can record.  each one claims a slot by bumping next, fills
+   it in, then publishes it by setting its seq to the claimed index + 1.
+   the dumper only takes a slot if its seq is the same before and after
+   copying it, so a slot being overwritten underneath it gets skipped
+   instead of coming out half and half. */
+
+#define MAX_THREAD_NAMES 16
+
+typedef struct {
+	uint64_t seq;
+	const char *name;
+	uint64_t start;
+	uint64_t dur;
+	int64_t arg;
+	uint32_t tid;
+} trace_event_t;
+
+int monome_tracing;
+
+static struct {
+	trace_event_t *events;
+	uint64_t mask;
+	uint64_t next;
+
+	struct {
+		uint32_t tid;
+		const char *name;
+	} threads[MAX_THREAD_NAMES];
+	uint nthreads;
+} ring;
+
+/**
+ * private
+ */
+
+static uint32_t thread_id() {
+	static __thread uint32_t tid;
+
+	if( !tid )
+#ifdef __linux__
+		tid = syscall(SYS_gettid);
+#else
+		tid = (uint32_t) (uintptr_t) pthread_self();
+#endif
+
+	return tid;
+}
+
+static int take(trace_event_t *dst, const trace_event_t *src, uint64_t seq) {
+	uint64_t before, after;
+
+	before = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+
+	dst->name  = __atomic_load_n(&src->name, __ATOMIC_RELAXED);
+	dst->start = __atomic_load_n(&src->start, __ATOMIC_RELAXED);
+	dst->dur   = __atomic_load_n(&src->dur, __ATOMIC_RELAXED);
+	dst->arg   = __atomic_load_n(&src->arg, __ATOMIC_RELAXED);
+	dst->tid   = __atomic_load_n(&src->tid, __ATOMIC_RELAXED);
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	after = __atomic_load_n(&src->seq, __ATOMIC_RELAXED);
+
+	return before == seq && after == seq;
+}
+
+/**
+ * public
+ */
+
+void monome_trace_record(const char *name, uint64_t start, uint64_t end,
+						 int64_t arg) {
+	trace_event_t *e;
+	uint64_t idx;
+
+	idx = __atomic_fetch_add(&ring.next, 1, __ATOMIC_RELAXED);
+	e   = &ring.events[idx & ring.mask];
+
+	__atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&e->name, name, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->start, start, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->dur, end - start, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->arg, arg, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->tid, thread_id(), __ATOMIC_RELAXED);
+
+	__atomic_store_n(&e->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/* events is rounded up to a power of two.  the ring is allocated the first
+   time and kept after that (something might still be writing into it),
+   so later calls just start recording again with whatever size it is. */
+int monome_trace_start(size_t events) {
+	size_t size;
+
+	if( !ring.events ) {
+		for( size = 1; size < events; size <<= 1 );
+
+		if( !(ring.events = calloc(size, sizeof(trace_event_t))) )
+			return -1;
+
+		ring.mask = size - 1;
+	}
+
+	__atomic_store_n(&monome_tracing, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void monome_trace_stop() {
+	__atomic_store_n(&monome_tracing, 0, __ATOMIC_RELEASE);
+}
+
+/* 0 if tracing is off, otherwise a timestamp to hand to monome_trace_end */
+uint64_t monome_trace_begin() {
+	if( !__atomic_load_n(&monome_tracing, __ATOMIC_RELAXED) )
+		return 0;
+
+	return stats_now_ns();
+}
+
+/* name has to stay around (a string literal, usually), only the pointer
+   is kept until the dump */
+void monome_trace_end(const char *name, uint64_t begin, int64_t arg) {
+	if( begin )
+		trace_span(name, begin, stats_now_ns(), arg);
+}
+
+/* labels the calling thread in the dump */
+void monome_trace_thread(const char *name) {
+	uint i = __atomic_fetch_add(&ring.nthreads, 1, __ATOMIC_RELAXED);
+
+	if( i >= MAX_THREAD_NAMES )
+		return;
+
+	ring.threads[i].tid  = thread_id();
+	ring.threads[i].name = name;
+}
+
+/* writes out whatever's still in the ring, oldest first.  recording
+   carries on while this runs, anything that gets overwritten meanwhile
+   is left out. */
+int monome_trace_dump(const char *path) {
+	trace_event_t e;
+	uint64_t first, last, i;
+	const char *sep = "";
+	int pid = getpid(), fd;
+	uint n;
+	FILE *f;
+
+	if( !ring.events )
+		return -1;
+
+	/* traces usually go somewhere in /tmp, so don't follow a link that
+	   someone else has left there for us */
+	if( (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644)) < 0 ||
+		!(f = fdopen(fd, "w")) ) {
+		perror("libmonome: couldn't open trace file");
+
+		if( fd >= 0 )
+			close(fd);
+
+		return -1;
+	}
+
+	last  = __atomic_load_n(&ring.next, __ATOMIC_ACQUIRE);
+	first = (last > ring.mask) ? last - ring.mask - 1 : 0;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	n = __atomic_load_n(&ring.nthreads, __ATOMIC_RELAXED);
+
+	for( i = 0; i < n && i < MAX_THREAD_NAMES; i++, sep = "," )
+		fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+				"\"tid\":%u,\"args\":{\"name\":\"%s\"}}", sep, pid,
+				ring.threads[i].tid, ring.threads[i].name);
+
+	for( i = first; i < last; i++ ) {
+		if( !take(&e, &ring.events[i & ring.mask], i + 1) )
+			continue;
+
+		fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,"
+				"\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"args\":{\"n\":%lld}}",
+				sep, e.name, pid, e.tid,
+				(unsigned long long) e.start / 1000, (uint) (e.start % 1000),
+				(unsigned long long) e.dur / 1000, (uint) (e.dur % 1000),
+				(long long) e.arg);
+		sep = ",";
+	}
+
+	fprintf(f, "\n]}\n");
+
+	if( fclose(f) ) {
+		perror("libmonome: couldn't write trace file");
+		return -1;
+	}
+
+	return 0;
+}